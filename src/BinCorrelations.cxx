@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#include "TGraph.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "BinCorrelations.hh"
+
+namespace util {
+
+BinCorrelations::BinCorrelations(const std::vector<TH1D*>& syst)
+    : nbins(0), nuni(syst.size()) {
+  if (syst.empty()) {
+    return;
+  }
+
+  nbins = syst[0]->GetNbinsX();
+  data.resize(nbins * nuni);
+  for (size_t k=0; k<nuni; k++) {
+    assert((size_t) syst[k]->GetNbinsX() == nbins);
+    for (size_t i=0; i<nbins; i++) {
+      data[i * nuni + k] = syst[k]->GetBinContent(i + 1);
+    }
+  }
+}
+
+
+BinCorrelations::BinCorrelations(const std::vector<double>& sums,
+                                 size_t nbins, size_t nuni)
+    : nbins(nbins), nuni(nuni), data(sums) {
+  assert(data.size() == nbins * nuni);
+}
+
+
+TGraph* BinCorrelations::Scatter(size_t i, size_t j) const {
+  assert(i < nbins && j < nbins);
+  return new TGraph(nuni, Column(i), Column(j));
+}
+
+
+TH2D* BinCorrelations::Pearson(const char* name) const {
+  return Correlate(data, name);
+}
+
+
+TH2D* BinCorrelations::Spearman(const char* name) const {
+  // Replace each column with its ranks (ties get the average rank)
+  std::vector<double> ranks(data.size());
+  std::vector<size_t> order(nuni);
+  for (size_t i=0; i<nbins; i++) {
+    const double* col = Column(i);
+    double* r = ranks.data() + i * nuni;
+
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [col](size_t a, size_t b) { return col[a] < col[b]; });
+
+    for (size_t k=0; k<nuni; ) {
+      size_t m = k;
+      while (m + 1 < nuni && col[order[m + 1]] == col[order[k]]) {
+        m++;
+      }
+      double rank = 0.5 * (k + m);
+      for (size_t l=k; l<=m; l++) {
+        r[order[l]] = rank;
+      }
+      k = m + 1;
+    }
+  }
+
+  return Correlate(ranks, name);
+}
+
+
+TH2D* BinCorrelations::Correlate(const std::vector<double>& cols,
+                                 const char* name) const {
+  TH2D* h = new TH2D(name, "", nbins, 0, nbins, nbins, 0, nbins);
+
+  if (nuni == 0) {
+    return h;
+  }
+
+  // Standardize each column once, so each pair is a plain dot product
+  std::vector<double> z(cols.size());
+  for (size_t i=0; i<nbins; i++) {
+    const double* c = cols.data() + i * nuni;
+    double* zi = z.data() + i * nuni;
+
+    double mean = 0;
+    for (size_t k=0; k<nuni; k++) {
+      mean += c[k];
+    }
+    mean /= nuni;
+
+    double ss = 0;
+    for (size_t k=0; k<nuni; k++) {
+      zi[k] = c[k] - mean;
+      ss += zi[k] * zi[k];
+    }
+
+    double norm = (ss > 0 ? 1.0 / sqrt(ss) : 0);
+    for (size_t k=0; k<nuni; k++) {
+      zi[k] *= norm;
+    }
+  }
+
+  for (size_t i=0; i<nbins; i++) {
+    const double* zi = z.data() + i * nuni;
+    for (size_t j=i; j<nbins; j++) {
+      const double* zj = z.data() + j * nuni;
+      double r = 0;
+      for (size_t k=0; k<nuni; k++) {
+        r += zi[k] * zj[k];
+      }
+      h->SetBinContent(i + 1, j + 1, r);
+      h->SetBinContent(j + 1, i + 1, r);
+    }
+  }
+
+  return h;
+}
+
+}  // namespace util
+
@@ -0,0 +1,102 @@
+#ifndef __ts_BinCorrelations__
+#define __ts_BinCorrelations__
+
+/**
+ * \file BinCorrelations.hh
+ *
+ * Bin-to-bin correlations across systematics universes.
+ */
+
+#include <vector>
+
+class TGraph;
+class TH1D;
+class TH2D;
+
+namespace util {
+
+/**
+ * \class BinCorrelations
+ * \brief Universe-by-bin matrix serving bin pair scatter data
+ *
+ * Stores the universe contents of each bin once, as contiguous per-bin
+ * columns. Scatter graphs of bin i vs. bin j across universes are built
+ * only for the pairs requested, and summary statistics for all pairs are
+ * computed in a single sweep over the columns.
+ */
+class BinCorrelations {
+public:
+  /**
+   * Constructor from universe histograms.
+   *
+   * \param syst Spectra for each systematic universe (same binning)
+   */
+  BinCorrelations(const std::vector<TH1D*>& syst);
+
+  /**
+   * Constructor from bin-major universe sums.
+   *
+   * \param sums Universe sums, sums[bin * nuni + universe]
+   * \param nbins Number of bins
+   * \param nuni Number of universes
+   */
+  BinCorrelations(const std::vector<double>& sums, size_t nbins, size_t nuni);
+
+  /** Number of bins. */
+  size_t GetNbins() const { return nbins; }
+
+  /** Number of universes. */
+  size_t GetNuniverses() const { return nuni; }
+
+  /**
+   * Universe contents of one bin.
+   *
+   * \param i Bin index (0-based)
+   * \returns Pointer to nuni values
+   */
+  const double* Column(size_t i) const { return data.data() + i * nuni; }
+
+  /**
+   * Scatter of bin i vs. bin j contents across universes.
+   *
+   * \param i First bin index (0-based, x axis)
+   * \param j Second bin index (0-based, y axis)
+   * \returns A new graph, owned by the caller
+   */
+  TGraph* Scatter(size_t i, size_t j) const;
+
+  /**
+   * Pearson correlation coefficients for all bin pairs.
+   *
+   * \param name Name of the output histogram
+   * \returns A new nbins x nbins histogram, owned by the caller
+   */
+  TH2D* Pearson(const char* name="pearson") const;
+
+  /**
+   * Spearman rank correlation coefficients for all bin pairs.
+   *
+   * \param name Name of the output histogram
+   * \returns A new nbins x nbins histogram, owned by the caller
+   */
+  TH2D* Spearman(const char* name="spearman") const;
+
+protected:
+  /**
+   * Correlation of all column pairs, after standardizing each column.
+   *
+   * \param cols Bin-major columns
+   * \param name Name of the output histogram
+   * \returns A new nbins x nbins histogram
+   */
+  TH2D* Correlate(const std::vector<double>& cols, const char* name) const;
+
+  size_t nbins;  //!< Number of bins
+  size_t nuni;  //!< Number of universes
+  std::vector<double> data;  //!< Bin-major universe contents
+};
+
+}  // namespace util
+
+#endif  // __ts_BinCorrelations__
+
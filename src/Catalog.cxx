@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+#include <TTree.h>
+#include "Catalog.hh"
+
+namespace core {
+
+void Catalog::Scan(const std::vector<std::string>& filenames,
+                   size_t nthreads) {
+  if (nthreads == 0) {
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  nthreads = std::min(nthreads, std::max((size_t) 1, filenames.size()));
+
+  ROOT::EnableThreadSafety();
+
+  files.assign(filenames.size(), File());
+
+  // Files are taken one at a time, so a few large files do not hold up
+  // the rest
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i=next++; i<filenames.size(); i=next++) {
+      files[i] = ScanFile(filenames[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i=0; i<nthreads; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+
+Catalog::File Catalog::ScanFile(const std::string& path) {
+  File c;
+  c.path = path;
+
+  TFile* f = TFile::Open(path.c_str());
+  if (!f || f->IsZombie()) {
+    std::cerr << "Catalog: Unable to open " << path << std::endl;
+    delete f;
+    return c;
+  }
+
+  c.bytes = f->GetSize();
+
+  TTree* events = (TTree*) f->Get("Events");
+  if (!events) {
+    std::cerr << "Catalog: No Events tree in " << path << std::endl;
+  }
+  else {
+    c.entries = events->GetEntries();
+
+    // Product branches are named <class>_<label>_<instance>_<process>.
+    TObjArray* branches = events->GetListOfBranches();
+    for (int i=0; i<branches->GetEntriesFast(); i++) {
+      std::string name = branches->At(i)->GetName();
+      if (std::count(name.begin(), name.end(), '_') < 3) {
+        continue;
+      }
+      if (!name.empty() && name.back() == '.') {
+        name.pop_back();
+      }
+      c.products.push_back(name);
+    }
+  }
+
+  TTree* subruns = (TTree*) f->Get("SubRuns");
+  const char* run = "SubRunAuxiliary.id_.run_.run_";
+  const char* subrun = "SubRunAuxiliary.id_.subRun_";
+  if (subruns && subruns->GetEntries() > 0 &&
+      subruns->GetLeaf(run) && subruns->GetLeaf(subrun)) {
+    c.run_min = subruns->GetMinimum(run);
+    c.run_max = subruns->GetMaximum(run);
+    c.subrun_min = subruns->GetMinimum(subrun);
+    c.subrun_max = subruns->GetMaximum(subrun);
+  }
+
+  f->Close();
+  delete f;
+
+  return c;
+}
+
+
+bool Catalog::Write(const std::string& filename) const {
+  std::ofstream out(filename);
+  if (!out) {
+    std::cerr << "Catalog: Unable to write " << filename << std::endl;
+    return false;
+  }
+
+  out << "# path entries bytes run_min run_max subrun_min subrun_max "
+      << "products" << std::endl;
+
+  for (auto const& c : files) {
+    std::string products;
+    for (size_t i=0; i<c.products.size(); i++) {
+      products += (i > 0 ? "," : "") + c.products[i];
+    }
+
+    out << c.path << " " << c.entries << " " << c.bytes << " "
+        << c.run_min << " " << c.run_max << " "
+        << c.subrun_min << " " << c.subrun_max << " "
+        << (products.empty() ? "-" : products) << std::endl;
+  }
+
+  return true;
+}
+
+
+bool Catalog::Read(const std::string& filename) {
+  std::ifstream in(filename);
+  if (!in) {
+    return false;
+  }
+
+  files.clear();
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    File c;
+    std::string products;
+    std::istringstream ss(line);
+    if (!(ss >> c.path >> c.entries >> c.bytes >> c.run_min >> c.run_max
+             >> c.subrun_min >> c.subrun_max >> products)) {
+      std::cerr << "Catalog: Invalid line in " << filename << ": "
+                << line << std::endl;
+      return false;
+    }
+
+    if (products != "-") {
+      std::istringstream ps(products);
+      std::string p;
+      while (std::getline(ps, p, ',')) {
+        c.products.push_back(p);
+      }
+    }
+
+    files.push_back(c);
+  }
+
+  return true;
+}
+
+
+bool Catalog::Matches(const std::vector<std::string>& filenames) const {
+  if (filenames.size() != files.size()) {
+    return false;
+  }
+
+  for (size_t i=0; i<files.size(); i++) {
+    if (files[i].path != filenames[i]) {
+      return false;
+    }
+
+    // A rewritten (e.g. truncated) file changes size; bytes is only known
+    // for files that could be opened
+    struct stat st;
+    if (files[i].bytes > 0 && filenames[i].find("://") == std::string::npos &&
+        (stat(filenames[i].c_str(), &st) != 0 ||
+         (long long) st.st_size != files[i].bytes)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+std::vector<std::vector<size_t> >
+Catalog::Schedule(size_t nworkers, bool by_entries) const {
+  assert(nworkers > 0);
+
+  auto cost = [&](size_t i) {
+    return by_entries ? (double) files[i].entries : (double) files[i].bytes;
+  };
+
+  std::vector<size_t> order;
+  for (size_t i=0; i<files.size(); i++) {
+    if (files[i].IsReadable()) {
+      order.push_back(i);
+    }
+  }
+
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return cost(a) > cost(b); });
+
+  // Least loaded worker first
+  typedef std::pair<double, size_t> Load;
+  std::priority_queue<Load, std::vector<Load>, std::greater<Load> > loads;
+  for (size_t i=0; i<nworkers; i++) {
+    loads.push({ 0, i });
+  }
+
+  std::vector<std::vector<size_t> > assignments(nworkers);
+  for (size_t i : order) {
+    Load l = loads.top();
+    loads.pop();
+    assignments[l.second].push_back(i);
+    l.first += cost(i);
+    loads.push(l);
+  }
+
+  for (auto& a : assignments) {
+    std::sort(a.begin(), a.end());
+  }
+
+  return assignments;
+}
+
+
+std::string Catalog::CatalogName(const std::string& list) {
+  std::string suffix = ".list";
+  if (list.size() >= suffix.size() &&
+      std::equal(suffix.rbegin(), suffix.rend(), list.rbegin())) {
+    return list.substr(0, list.size() - suffix.size()) + ".catalog";
+  }
+  return list + ".catalog";
+}
+
+}  // namespace core
@@ -0,0 +1,125 @@
+#ifndef __ts_core_Catalog__
+#define __ts_core_Catalog__
+
+/**
+ * \file Catalog.hh
+ *
+ * Pre-scanned summaries of input file lists.
+ */
+
+#include <string>
+#include <vector>
+
+namespace core {
+
+/**
+ * \class core::Catalog
+ * \brief Entry counts, sizes, products and run ranges of input files
+ *
+ * A catalog is built once per file list (in parallel, see Scan) and kept
+ * next to it, so jobs can balance work and drop unreadable files without
+ * opening every input first.
+ *
+ * The catalog file is plain text, one file per line:
+ *
+ *   path entries bytes run_min run_max subrun_min subrun_max products
+ *
+ * where products is a comma-separated list of the art product branches in
+ * the Events tree (class_label_instance_process), or "-" if none, and
+ * unreadable files have entries = -1.
+ */
+class Catalog {
+public:
+  /**
+   * \struct Catalog::File
+   * \brief The summary of one input file
+   */
+  struct File {
+    File() : entries(-1), bytes(0), run_min(-1), run_max(-1),
+             subrun_min(-1), subrun_max(-1) {}
+
+    /** True if the file could be read. */
+    bool IsReadable() const { return entries >= 0; }
+
+    std::string path;  //!< File path
+    long entries;  //!< Number of events (-1 if unreadable)
+    long long bytes;  //!< File size
+    int run_min;  //!< First run
+    int run_max;  //!< Last run
+    int subrun_min;  //!< Lowest subrun
+    int subrun_max;  //!< Highest subrun
+    std::vector<std::string> products;  //!< Product branch names
+  };
+
+  /**
+   * Scan a list of files.
+   *
+   * \param filenames The file paths
+   * \param nthreads Number of threads (0 for the number of cores)
+   */
+  void Scan(const std::vector<std::string>& filenames, size_t nthreads=0);
+
+  /**
+   * Scan a single file.
+   *
+   * \param path The file path
+   * \returns The summary
+   */
+  static File ScanFile(const std::string& path);
+
+  /**
+   * Write the catalog file.
+   *
+   * \param filename The output path
+   * \returns True on success
+   */
+  bool Write(const std::string& filename) const;
+
+  /**
+   * Read a catalog file.
+   *
+   * \param filename The catalog path
+   * \returns True on success
+   */
+  bool Read(const std::string& filename);
+
+  /**
+   * Check that the catalog describes a list of files, in order.
+   *
+   * Local files that were opened when scanned must also still have the
+   * recorded size, so files rewritten since the scan are caught. Remote
+   * (URL) paths are compared by path only.
+   *
+   * \param filenames The file paths
+   * \returns True if the paths (and sizes) match
+   */
+  bool Matches(const std::vector<std::string>& filenames) const;
+
+  /**
+   * Assign the readable files to workers, longest processing time first.
+   *
+   * Files are taken in decreasing order of cost and each is given to the
+   * least loaded worker, which keeps the most loaded worker within 4/3 of
+   * the optimum. Within a worker, files keep their catalog order.
+   *
+   * \param nworkers The number of workers
+   * \param by_entries Use event counts as the cost, rather than bytes
+   * \returns The catalog indices of the files for each worker
+   */
+  std::vector<std::vector<size_t> > Schedule(size_t nworkers,
+                                             bool by_entries=false) const;
+
+  /**
+   * The catalog path for a file list (x.list to x.catalog).
+   *
+   * \param list The file list path
+   * \returns The catalog path
+   */
+  static std::string CatalogName(const std::string& list);
+
+  std::vector<File> files;  //!< File summaries, in list order
+};
+
+}  // namespace core
+
+#endif  // __ts_core_Catalog__
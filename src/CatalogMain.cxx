@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <Catalog.hh>
+
+int main(int argc, char* argv[]) {
+  size_t nthreads = 0;
+  size_t njobs = 0;
+  bool by_entries = false;
+
+  int c;
+  while ((c=getopt(argc, argv, "j:n:e")) != -1) {
+    switch (c) {
+      case 'j':
+        nthreads = strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        njobs = strtoul(optarg, NULL, 10);
+        break;
+      case 'e':
+        by_entries = true;
+        break;
+      default:
+        return 1;
+    }
+  }
+
+  if (argc - optind != 1) {
+    std::cout << "Usage: " << argv[0] << " [-j NTHREADS] [-n NJOBS [-e]] "
+              << "INPUT.list" << std::endl;
+    return 1;
+  }
+
+  std::string list = argv[optind];
+  std::ifstream infile(list);
+  if (!infile) {
+    std::cerr << "Unable to read " << list << std::endl;
+    return 2;
+  }
+
+  std::vector<std::string> filenames;
+  std::string filename;
+  while (infile >> filename) {
+    filenames.push_back(filename);
+  }
+
+  // Scan the files
+  core::Catalog catalog;
+  catalog.Scan(filenames, nthreads);
+
+  std::string name = core::Catalog::CatalogName(list);
+  if (!catalog.Write(name)) {
+    return 3;
+  }
+
+  size_t nbad = 0;
+  long entries = 0;
+  long long bytes = 0;
+  for (auto const& f : catalog.files) {
+    if (!f.IsReadable()) {
+      nbad++;
+      continue;
+    }
+    entries += f.entries;
+    bytes += f.bytes;
+  }
+
+  std::cout << "Wrote " << name << ": " << filenames.size() << " files ("
+            << nbad << " unreadable), " << entries << " events, "
+            << bytes / 1e9 << " GB" << std::endl;
+
+  // Split into balanced job lists
+  if (njobs > 0) {
+    std::string base = name.substr(0, name.size() - 8);  // Strip .catalog
+    std::vector<std::vector<size_t> > jobs = \
+      catalog.Schedule(njobs, by_entries);
+
+    double max_load = 0, total_load = 0;
+    for (size_t i=0; i<jobs.size(); i++) {
+      std::string jobname = base + "_" + std::to_string(i) + ".list";
+      std::ofstream out(jobname);
+
+      double load = 0;
+      for (size_t k : jobs[i]) {
+        out << catalog.files[k].path << std::endl;
+        load += by_entries ? catalog.files[k].entries : catalog.files[k].bytes;
+      }
+      max_load = std::max(max_load, load);
+      total_load += load;
+    }
+
+    std::cout << "Wrote " << njobs << " job lists " << base << "_*.list, "
+              << "largest/mean " << (by_entries ? "events" : "size") << " = "
+              << (total_load > 0 ? max_load * njobs / total_load : 0)
+              << std::endl;
+  }
+
+  return 0;
+}
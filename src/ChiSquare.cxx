@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "TH1D.h"
+#include "TH2D.h"
+#include "ChiSquare.hh"
+
+namespace util {
+
+ChiSquare::ChiSquare(const std::vector<double>& _data,
+                     const std::vector<double>& _cov,
+                     const std::vector<double>& _stat)
+    : n(_data.size()), valid(false), data(_data), syst(_cov), stat(_stat) {
+  assert(syst.size() == n * n);
+  if (stat.empty()) {
+    stat.resize(n, 0);
+  }
+  assert(stat.size() == n);
+
+  valid = Factorize();
+}
+
+
+ChiSquare::ChiSquare(const TH1D* cv, const TH2D* cov)
+    : n(cv->GetNbinsX()), valid(false) {
+  assert(cov->GetNbinsX() == (int) n && cov->GetNbinsY() == (int) n);
+
+  data.resize(n);
+  stat.resize(n);
+  syst.resize(n * n);
+  for (size_t i=0; i<n; i++) {
+    data[i] = cv->GetBinContent(i + 1);
+    stat[i] = data[i];
+    for (size_t j=0; j<n; j++) {
+      syst[i * n + j] = cov->GetBinContent(i + 1, j + 1);
+    }
+  }
+
+  valid = Factorize();
+}
+
+
+bool ChiSquare::Factorize() {
+  fL.assign(n * n, 0);
+
+  for (size_t j=0; j<n; j++) {
+    double* lj = fL.data() + j * n;
+
+    double d = syst[j * n + j] + stat[j];
+    for (size_t k=0; k<j; k++) {
+      d -= lj[k] * lj[k];
+    }
+    if (d <= 0) {
+      std::cerr << "ChiSquare: Covariance is not positive definite "
+                << "(bin " << j << ")" << std::endl;
+      return false;
+    }
+    lj[j] = sqrt(d);
+
+    for (size_t i=j+1; i<n; i++) {
+      double* li = fL.data() + i * n;
+      double s = syst[i * n + j];
+      for (size_t k=0; k<j; k++) {
+        s -= li[k] * lj[k];
+      }
+      li[j] = s / lj[j];
+    }
+  }
+
+  return true;
+}
+
+
+bool ChiSquare::UpdateDiagonal(size_t j, double delta) {
+  if (delta == 0) {
+    return true;
+  }
+
+  // V +/- x x^T with x = sqrt(|delta|) e_j; x is zero above bin j
+  double sign = (delta > 0 ? 1 : -1);
+  std::vector<double> x(n, 0);
+  x[j] = sqrt(std::abs(delta));
+
+  for (size_t k=j; k<n; k++) {
+    double lkk = fL[k * n + k];
+    double r2 = lkk * lkk + sign * x[k] * x[k];
+    if (r2 <= 0) {
+      return false;
+    }
+    double r = sqrt(r2);
+    double c = r / lkk;
+    double s = x[k] / lkk;
+    fL[k * n + k] = r;
+
+    for (size_t i=k+1; i<n; i++) {
+      double& lik = fL[i * n + k];
+      lik = (lik + sign * s * x[i]) / c;
+      x[i] = c * x[i] - s * lik;
+    }
+  }
+
+  return true;
+}
+
+
+void ChiSquare::SetData(const std::vector<double>& _data) {
+  assert(_data.size() == n);
+  data = _data;
+}
+
+
+void ChiSquare::SetStat(const std::vector<double>& _stat) {
+  assert(_stat.size() == n);
+
+  std::vector<size_t> changed;
+  for (size_t i=0; i<n; i++) {
+    if (_stat[i] != stat[i]) {
+      changed.push_back(i);
+    }
+  }
+
+  // Each update is O((N - j)^2), a refactorization O(N^3 / 3)
+  bool refactor = !valid || changed.size() > n / 3;
+
+  for (size_t k=0; !refactor && k<changed.size(); k++) {
+    size_t j = changed[k];
+    if (!UpdateDiagonal(j, _stat[j] - stat[j])) {
+      refactor = true;
+    }
+  }
+
+  stat = _stat;
+
+  if (refactor) {
+    valid = Factorize();
+  }
+}
+
+
+double ChiSquare::Evaluate(const double* pred) const {
+  double chi2 = 0;
+  Evaluate(pred, 1, &chi2);
+  return chi2;
+}
+
+
+void ChiSquare::Evaluate(const double* preds, size_t npred,
+                         double* chi2) const {
+  assert(valid);
+
+  // Solve L Y = R for blocks of predictions, with R stored bin-major so
+  // the inner loops run contiguously over predictions
+  const size_t kBlock = 64;
+  std::vector<double> y(n * kBlock);
+
+  for (size_t p0=0; p0<npred; p0+=kBlock) {
+    const size_t m = std::min(kBlock, npred - p0);
+
+    for (size_t p=0; p<m; p++) {
+      const double* pred = preds + (p0 + p) * n;
+      for (size_t i=0; i<n; i++) {
+        y[i * m + p] = pred[i] - data[i];
+      }
+    }
+
+    for (size_t i=0; i<n; i++) {
+      const double* li = fL.data() + i * n;
+      double* yi = y.data() + i * m;
+      for (size_t k=0; k<i; k++) {
+        const double lik = li[k];
+        const double* yk = y.data() + k * m;
+        for (size_t p=0; p<m; p++) {
+          yi[p] -= lik * yk[p];
+        }
+      }
+      const double inv = 1.0 / li[i];
+      for (size_t p=0; p<m; p++) {
+        yi[p] *= inv;
+      }
+    }
+
+    double* out = chi2 + p0;
+    std::fill(out, out + m, 0.0);
+    for (size_t i=0; i<n; i++) {
+      const double* yi = y.data() + i * m;
+      for (size_t p=0; p<m; p++) {
+        out[p] += yi[p] * yi[p];
+      }
+    }
+  }
+}
+
+}  // namespace util
+
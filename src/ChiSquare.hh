@@ -0,0 +1,122 @@
+#ifndef __ts_ChiSquare__
+#define __ts_ChiSquare__
+
+/**
+ * \file ChiSquare.hh
+ *
+ * Chi-square evaluation against a fixed covariance matrix.
+ */
+
+#include <vector>
+
+class TH1D;
+class TH2D;
+
+namespace util {
+
+/**
+ * \class ChiSquare
+ * \brief Chi-square with a once-factorized covariance
+ *
+ * Computes chi2 = (p - d)^T V^-1 (p - d) for many prediction vectors p,
+ * where V = V_syst + diag(stat). V is Cholesky factorized once (V = L L^T)
+ * and each evaluation is a triangular solve, chi2 = |L^-1 (p - d)|^2.
+ * Batches of predictions are solved together, with the innermost loop
+ * running over predictions.
+ *
+ * The diagonal statistical term can be changed with rank-one updates of
+ * the factor, costing O(N^2) per changed bin instead of a refactorization.
+ */
+class ChiSquare {
+public:
+  /**
+   * Constructor.
+   *
+   * \param _data The reference spectrum d (N values)
+   * \param _cov The systematic covariance V_syst (N x N, row-major)
+   * \param _stat Diagonal statistical term (N values, or empty for none)
+   */
+  ChiSquare(const std::vector<double>& _data, const std::vector<double>& _cov,
+            const std::vector<double>& _stat=std::vector<double>());
+
+  /**
+   * Constructor from Covariance output, with the nominal spectrum as
+   * reference and Poisson statistical errors (stat_i = d_i).
+   *
+   * \param cv The nominal spectrum (e.g. hg)
+   * \param cov The systematic covariance matrix (e.g. the joint cov)
+   */
+  ChiSquare(const TH1D* cv, const TH2D* cov);
+
+  /** Number of bins. */
+  size_t GetN() const { return n; }
+
+  /** True if the covariance was successfully factorized. */
+  bool IsValid() const { return valid; }
+
+  /**
+   * Set the reference spectrum.
+   *
+   * \param _data The reference spectrum (N values)
+   */
+  void SetData(const std::vector<double>& _data);
+
+  /**
+   * Set the diagonal statistical term.
+   *
+   * Bins whose value changes are applied as rank-one updates (or
+   * downdates) of the factor; if most bins change, or a downdate fails,
+   * the matrix is refactorized.
+   *
+   * \param _stat The statistical variances (N values)
+   */
+  void SetStat(const std::vector<double>& _stat);
+
+  /**
+   * Evaluate the chi-square for one prediction.
+   *
+   * \param pred The prediction (N values)
+   * \returns The chi-square
+   */
+  double Evaluate(const double* pred) const;
+
+  /**
+   * Evaluate the chi-square for a batch of predictions.
+   *
+   * Thread safe: the factorization is only read.
+   *
+   * \param preds Predictions, one after another (npred x N values)
+   * \param npred Number of predictions
+   * \param chi2 Output chi-square values (npred values)
+   */
+  void Evaluate(const double* preds, size_t npred, double* chi2) const;
+
+protected:
+  /**
+   * Cholesky factorize V_syst + diag(stat) into fL.
+   *
+   * \returns True if the matrix is positive definite
+   */
+  bool Factorize();
+
+  /**
+   * Rank-one update of the factor for V -> V + delta e_j e_j^T.
+   *
+   * \param j The bin
+   * \param delta Change in the diagonal element
+   * \returns False if a downdate would lose positive definiteness
+   */
+  bool UpdateDiagonal(size_t j, double delta);
+
+  size_t n;  //!< Number of bins
+  bool valid;  //!< Factorization succeeded
+  std::vector<double> data;  //!< Reference spectrum
+  std::vector<double> syst;  //!< Systematic covariance, row-major
+  std::vector<double> stat;  //!< Diagonal statistical term
+  std::vector<double> fL;  //!< Lower Cholesky factor, row-major
+};
+
+}  // namespace util
+
+#endif  // __ts_ChiSquare__
+
@@ -0,0 +1,95 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <ChiSquare.hh>
+
+/**
+ * Time chi-square evaluations for a given block size.
+ *
+ * \param chi2 The chi-square calculator
+ * \param npred Number of predictions to evaluate
+ */
+void Bench(const util::ChiSquare& chi2, size_t npred) {
+  const size_t n = chi2.GetN();
+
+  std::mt19937 rng(1);
+  std::normal_distribution<double> gaus(100, 10);
+  std::vector<double> preds(npred * n);
+  for (auto& p : preds) {
+    p = gaus(rng);
+  }
+  std::vector<double> out(npred);
+
+  // One at a time
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i=0; i<npred; i++) {
+    out[i] = chi2.Evaluate(preds.data() + i * n);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  // Batched
+  chi2.Evaluate(preds.data(), npred, out.data());
+  auto t2 = std::chrono::steady_clock::now();
+
+  double ts = std::chrono::duration<double>(t1 - t0).count();
+  double tb = std::chrono::duration<double>(t2 - t1).count();
+
+  std::cout << "ChiSquareBench: " << n << " bins: "
+            << npred / ts << " evals/s single, "
+            << npred / tb << " evals/s batched" << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  size_t npred = 1000000;
+
+  if (argc > 1) {
+    // Use the joint matrix from a covariance output file
+    TFile f(argv[1]);
+    TH1D* hg = (TH1D*) f.Get("hg");
+    TH2D* cov = (TH2D*) f.Get("cov");
+    if (!hg || !cov) {
+      std::cerr << "No hg/cov in " << argv[1] << std::endl;
+      return 1;
+    }
+    util::ChiSquare chi2(hg, cov);
+    if (!chi2.IsValid()) {
+      return 1;
+    }
+    Bench(chi2, npred);
+    return 0;
+  }
+
+  // Synthetic positive definite matrices at the size of one sample (nue or
+  // numu, 25 bins each) and of the joint nue+numu matrix
+  size_t sizes[] = { 25, 50 };
+  for (size_t n : sizes) {
+    std::mt19937 rng(n);
+    std::uniform_real_distribution<double> uni(-1, 1);
+
+    std::vector<double> a(n * n);
+    for (auto& v : a) {
+      v = uni(rng);
+    }
+    std::vector<double> cov(n * n, 0);
+    for (size_t i=0; i<n; i++) {
+      for (size_t j=0; j<n; j++) {
+        for (size_t k=0; k<n; k++) {
+          cov[i * n + j] += a[i * n + k] * a[j * n + k];
+        }
+      }
+    }
+    std::vector<double> data(n, 100);
+
+    util::ChiSquare chi2(data, cov, data);
+    Bench(chi2, npred);
+  }
+
+  return 0;
+}
+
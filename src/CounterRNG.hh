@@ -0,0 +1,139 @@
+#ifndef __ts_CounterRNG__
+#define __ts_CounterRNG__
+
+/**
+ * \file CounterRNG.hh
+ *
+ * A counter-based random number generator.
+ */
+
+#include <cmath>
+#include <cstdint>
+
+namespace util {
+
+/**
+ * \class CounterRNG
+ * \brief Counter-based random numbers keyed by a seed and a stream ID
+ *
+ * The n-th draw of a stream is a pure function of (seed, stream, n): a
+ * SplitMix64 finalizer applied to a key-dependent counter. Streams can be
+ * keyed by e.g. a toy index or an event ID, so results do not depend on
+ * how work is divided among threads or jobs. Streams are cheap to create
+ * and need no shared state.
+ */
+class CounterRNG {
+public:
+  /**
+   * Constructor.
+   *
+   * \param seed The global seed
+   * \param stream The stream ID
+   */
+  CounterRNG(uint64_t seed, uint64_t stream)
+      : key(Mix(Mix(seed) ^ (stream + 0x632be59bd9b4e019ULL))), counter(0),
+        has_gaus(false), gaus(0) {}
+
+  /**
+   * Constructor for a stream keyed by several IDs.
+   *
+   * \param seed The global seed
+   * \param a First stream ID (e.g. run)
+   * \param b Second stream ID (e.g. subrun)
+   * \param c Third stream ID (e.g. event)
+   * \param d Fourth stream ID (e.g. particle)
+   */
+  CounterRNG(uint64_t seed, uint64_t a, uint64_t b, uint64_t c, uint64_t d=0)
+      : CounterRNG(seed, Mix(Mix(Mix(a) ^ b) ^ c) ^ d) {}
+
+  /** SplitMix64 finalizer. */
+  static uint64_t Mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  /** Next 64 random bits. */
+  uint64_t Next() {
+    return Mix(key + (++counter) * 0x9e3779b97f4a7c15ULL);
+  }
+
+  /** Uniform deviate in the open interval (0, 1). */
+  double Uniform() {
+    return ((Next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+  }
+
+  /** Standard normal deviate (Box-Muller). */
+  double Gaus() {
+    if (has_gaus) {
+      has_gaus = false;
+      return gaus;
+    }
+    double r = sqrt(-2 * log(Uniform()));
+    double phi = 2 * M_PI * Uniform();
+    gaus = r * sin(phi);
+    has_gaus = true;
+    return r * cos(phi);
+  }
+
+  /**
+   * Poisson deviate.
+   *
+   * Uses multiplication of uniforms for small means and the PTRS
+   * transformed rejection method (Hormann 1993) otherwise.
+   *
+   * \param mu The mean
+   * \returns The deviate
+   */
+  unsigned long Poisson(double mu) {
+    if (mu <= 0) {
+      return 0;
+    }
+
+    if (mu < 10) {
+      double l = exp(-mu);
+      double p = Uniform();
+      unsigned long k = 0;
+      while (p > l) {
+        p *= Uniform();
+        k++;
+      }
+      return k;
+    }
+
+    double smu = sqrt(mu);
+    double b = 0.931 + 2.53 * smu;
+    double a = -0.059 + 0.02483 * b;
+    double inv_alpha = 1.1239 + 1.1328 / (b - 3.4);
+    double vr = 0.9277 - 3.6224 / (b - 2);
+    double log_mu = log(mu);
+
+    while (true) {
+      double u = Uniform() - 0.5;
+      double v = Uniform();
+      double us = 0.5 - std::abs(u);
+      double k = floor((2 * a / us + b) * u + mu + 0.43);
+      if (us >= 0.07 && v <= vr) {
+        return k;
+      }
+      if (k < 0 || (us < 0.013 && v > us)) {
+        continue;
+      }
+      if (log(v) + log(inv_alpha) - log(a / (us * us) + b) <=
+          -mu + k * log_mu - lgamma(k + 1)) {
+        return k;
+      }
+    }
+  }
+
+protected:
+  uint64_t key;  //!< Stream key
+  uint64_t counter;  //!< Draw counter
+  bool has_gaus;  //!< A cached normal deviate is available
+  double gaus;  //!< Cached normal deviate
+};
+
+}  // namespace util
+
+#endif  // __ts_CounterRNG__
+
@@ -1,50 +1,37 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <numeric>
 #include <set>
 #include <string>
 #include <vector>
 #include "TCanvas.h"
 #include "TFile.h"
+#include "TGraph.h"
 #include "TGraphErrors.h"
 #include "TH1D.h"
 #include "TH2D.h"
+#include "TNamed.h"
+#include "TParameter.h"
 #include "TPaveText.h"
 #include "TTree.h"
 #include "TStyle.h"
+#include "TVectorD.h"
+#include "json/json.h"
+#include "BinCorrelations.hh"
 #include "Covariance.hh"
+#include "CovarianceModes.hh"
+#include "ToyGenerator.hh"
+#include "CounterRNG.hh"
 #include "Event.hh"
 
 namespace util {
 
-std::vector<std::vector<TGraph*> > BinCorrelations(
-    TH1D* enu, std::vector<TH1D*> enu_syst) {
-  size_t nbins = enu->GetNbinsX();
-  size_t nuni = enu_syst.size();
-
-  std::vector<std::vector<TGraph*> > v(nbins);
-  for (size_t i=0; i<nbins; i++) {
-    v[i] = std::vector<TGraph*>(nbins);
-    for (size_t j=0; j<nbins; j++) {
-      v[i][j] = new TGraph(nuni);
-    }
-  }
-
-  for (size_t i=0; i<nbins; i++) {
-    for (size_t j=0; j<nbins; j++) {
-      for (size_t k=0; k<nuni; k++) {
-        v[i][j]->SetPoint(k, enu_syst[k]->GetBinContent(i),
-                             enu_syst[k]->GetBinContent(j));
-      }
-    }
-  }
-
-  return v;
-}
-
-
 /******************************************************************************
  ** Covariance::EventSample implementation                                 **
  *****************************************************************************/
@@ -53,7 +40,7 @@ Covariance::EventSample::EventSample(std::string _name,
                                        size_t nbins,
                                        double elo, double ehi,
                                        size_t nweights)
-    : name(_name), enu(nullptr), cov(nullptr) {
+    : name(_name), enu(nullptr), nreplicas(0), cov(nullptr) {
   enu = new TH1D(("enu_" + name).c_str(),
                  ";#nu Energy [MeV];Entries per bin",
                  nbins, elo, ehi);
@@ -63,7 +50,24 @@ Covariance::EventSample::EventSample(std::string _name,
 }
 
 
+Covariance::EventSample::EventSample(std::string _name,
+                                     const std::vector<double>& edges,
+                                     size_t nweights)
+    : name(_name), enu(nullptr), nreplicas(0), cov(nullptr) {
+  assert(edges.size() > 1);
+  enu = new TH1D(("enu_" + name).c_str(),
+                 ";#nu Energy [MeV];Entries per bin",
+                 edges.size() - 1, edges.data());
+  enu->Sumw2();
+
+  Resize(nweights);
+}
+
+
 Covariance::EventSample::~EventSample() {
+  for (auto h : enu_syst) {
+    delete h;
+  }
   delete cov;
   delete enu;
 }
@@ -83,10 +87,10 @@ TGraphErrors* Covariance::EventSample::EnuCollapsed() {
   double ye[nbins];
 
   for (size_t i=0; i<nbins; i++) {
-    xv[i] = enu->GetBinCenter(i);
-    xe[i] = enu->GetBinWidth(i) / 2;
-    yv[i] = enu->GetBinContent(i);
-    ye[i] = sqrt(cov->GetBinContent(i, i));
+    xv[i] = enu->GetBinCenter(i + 1);
+    xe[i] = enu->GetBinWidth(i + 1) / 2;
+    yv[i] = enu->GetBinContent(i + 1);
+    ye[i] = sqrt(cov->GetBinContent(i + 1, i + 1));
   }
 
   return new TGraphErrors(nbins, xv, yv, xe, ye);
@@ -94,6 +98,9 @@ TGraphErrors* Covariance::EventSample::EnuCollapsed() {
 
 
 void Covariance::EventSample::Resize(size_t nweights) {
+  for (auto h : enu_syst) {
+    delete h;
+  }
   enu_syst.clear();
   for (size_t i=0; i<nweights; i++) {
     std::string hname = Form("enu_%s_%zu", name.c_str(), i);
@@ -104,6 +111,94 @@ void Covariance::EventSample::Resize(size_t nweights) {
 }
 
 
+Covariance::EventSample* Covariance::EventSample::Rebin(
+    const std::vector<double>& edges) const {
+  const int nbase = enu->GetNbinsX();
+  const int nbins = edges.size() - 1;
+  assert(nbins > 0);
+
+  // Map each base bin (including under/overflow) to a new bin, checking
+  // that no base bin straddles a new edge
+  std::vector<int> bmap(nbase + 2);
+  for (int b=0; b<nbase+2; b++) {
+    double lo = (b == 0 ? -1e300 : enu->GetXaxis()->GetBinLowEdge(b));
+    double hi = (b == nbase + 1 ? 1e300 : enu->GetXaxis()->GetBinUpEdge(b));
+    int ilo = std::upper_bound(edges.begin(), edges.end(), lo) - edges.begin();
+    int ihi = std::lower_bound(edges.begin(), edges.end(), hi) - edges.begin();
+    if (ilo != ihi) {
+      std::cerr << "Covariance: Edges for " << name << " are not aligned "
+                << "with the base binning at " << lo << std::endl;
+      return nullptr;
+    }
+    bmap[b] = ilo;
+  }
+
+  EventSample* r = new EventSample(name, edges, enu_syst.size());
+  r->observable = observable;
+  r->axes = axes;
+
+  std::vector<double> err2(nbins + 2, 0);
+  for (int b=0; b<nbase+2; b++) {
+    int j = bmap[b];
+    r->enu->AddBinContent(j, enu->GetBinContent(b));
+    err2[j] += enu->GetBinError(b) * enu->GetBinError(b);
+    for (size_t k=0; k<enu_syst.size(); k++) {
+      r->enu_syst[k]->AddBinContent(j, enu_syst[k]->GetBinContent(b));
+    }
+  }
+  for (int j=0; j<nbins+2; j++) {
+    r->enu->SetBinError(j, sqrt(err2[j]));
+  }
+
+  // Per-function sums cover in-range bins only
+  r->fn_names = fn_names;
+  r->fn_nuniverses = fn_nuniverses;
+  r->fn_sums.resize(fn_sums.size());
+  for (size_t f=0; f<fn_sums.size(); f++) {
+    const size_t n = fn_nuniverses[f];
+    r->fn_sums[f].resize(nbins * n, 0);
+    for (int b=1; b<nbase+1; b++) {
+      int j = bmap[b];
+      if (j < 1 || j > nbins) {
+        continue;
+      }
+      const double* src = fn_sums[f].data() + (b - 1) * n;
+      double* dst = r->fn_sums[f].data() + (j - 1) * n;
+      for (size_t k=0; k<n; k++) {
+        dst[k] += src[k];
+      }
+    }
+  }
+
+  // Bootstrap replicas, also in-range bins only
+  const size_t nb = nreplicas;
+  const size_t nu = enu_syst.size();
+  r->nreplicas = nb;
+  if (nb > 0) {
+    r->bs_cv.resize(nbins * nb, 0);
+    r->bs_sums.resize(bs_sums.empty() ? 0 : nbins * nb * nu, 0);
+    for (int b=1; b<nbase+1; b++) {
+      int j = bmap[b];
+      if (j < 1 || j > nbins) {
+        continue;
+      }
+      for (size_t k=0; k<nb; k++) {
+        r->bs_cv[(j - 1) * nb + k] += bs_cv[(b - 1) * nb + k];
+      }
+      if (!bs_sums.empty()) {
+        const double* src = bs_sums.data() + (b - 1) * nb * nu;
+        double* dst = r->bs_sums.data() + (j - 1) * nb * nu;
+        for (size_t k=0; k<nb*nu; k++) {
+          dst[k] += src[k];
+        }
+      }
+    }
+  }
+
+  return r;
+}
+
+
 TH2D* Covariance::EventSample::CovarianceMatrix(
     TH1D* nom, std::vector<TH1D*> syst) {
   int nbins = nom->GetNbinsX();
@@ -126,6 +221,188 @@ TH2D* Covariance::EventSample::CovarianceMatrix(
 }
 
 
+TH2D* Covariance::EventSample::CovarianceMatrix(
+    TH1D* nom, const std::vector<double>& sums, size_t n) {
+  int nbins = nom->GetNbinsX();
+
+  TH2D* _cov = new TH2D("cov", "", nbins, 0, nbins, nbins, 0, nbins);
+
+  if (n == 0) {
+    return _cov;
+  }
+
+  // Deviations from nominal, bin-major, so each element is a dot product
+  // over contiguous universe rows
+  std::vector<double> d(sums.size());
+  for (int i=0; i<nbins; i++) {
+    double cv = nom->GetBinContent(i + 1);
+    for (size_t k=0; k<n; k++) {
+      d[i * n + k] = cv - sums[i * n + k];
+    }
+  }
+
+  for (int i=0; i<nbins; i++) {
+    const double* di = d.data() + i * n;
+    for (int j=i; j<nbins; j++) {
+      const double* dj = d.data() + j * n;
+      double vij = 0;
+      for (size_t k=0; k<n; k++) {
+        vij += di[k] * dj[k];
+      }
+      vij /= n;
+      _cov->SetBinContent(i + 1, j + 1, vij);
+      _cov->SetBinContent(j + 1, i + 1, vij);
+    }
+  }
+
+  return _cov;
+}
+
+
+size_t Covariance::EventSample::ConvergedUniverses(
+    TH1D* nom, const std::vector<double>& sums, size_t n, double tol,
+    size_t window) {
+  const size_t nbins = nom->GetNbinsX();
+  if (n == 0 || sums.size() != nbins * n) {
+    return n;
+  }
+
+  // Running sums of squared deviations, and the error estimates for the
+  // last window + 1 universe counts (ring buffer)
+  std::vector<double> ss(nbins, 0);
+  std::vector<double> hist((window + 1) * nbins, 0);
+
+  for (size_t m=1; m<=n; m++) {
+    double* cur = hist.data() + (m % (window + 1)) * nbins;
+    for (size_t i=0; i<nbins; i++) {
+      double d = nom->GetBinContent(i + 1) - sums[i * n + m - 1];
+      ss[i] += d * d;
+      cur[i] = sqrt(ss[i] / m);
+    }
+
+    if (m <= window) {
+      continue;
+    }
+
+    const double* old = hist.data() + ((m - window) % (window + 1)) * nbins;
+    bool converged = true;
+    for (size_t i=0; i<nbins && converged; i++) {
+      if (cur[i] > 0 && std::abs(cur[i] - old[i]) > tol * cur[i]) {
+        converged = false;
+      }
+    }
+
+    if (converged) {
+      return m;
+    }
+  }
+
+  return n;
+}
+
+
+TH2D* Covariance::EventSample::FunctionCovarianceMatrix(size_t ifn) {
+  assert(ifn < fn_names.size());
+  TH2D* _cov = CovarianceMatrix(enu, fn_sums[ifn], fn_nuniverses[ifn]);
+  _cov->SetName(("cov_" + name + "_" + fn_names[ifn]).c_str());
+  return _cov;
+}
+
+
+TH2D* Covariance::EventSample::FractionalErrors() {
+  if (!cov) {
+    CovarianceMatrix();
+  }
+
+  int nbins = enu->GetNbinsX();
+  int nfn = fn_names.size();
+
+  TH2D* h = new TH2D(("fracerr_" + name).c_str(),
+                     ";Bin;;Fractional error",
+                     nbins, 0, nbins, nfn + 1, 0, nfn + 1);
+
+  for (int f=0; f<nfn+1; f++) {
+    TH2D* c = (f < nfn ? FunctionCovarianceMatrix(f) : cov);
+    h->GetYaxis()->SetBinLabel(f + 1,
+                               (f < nfn ? fn_names[f].c_str() : "total"));
+    for (int i=1; i<nbins+1; i++) {
+      double cv = enu->GetBinContent(i);
+      if (cv > 0) {
+        h->SetBinContent(i, f + 1, sqrt(c->GetBinContent(i, i)) / cv);
+      }
+    }
+    if (c != cov) {
+      delete c;
+    }
+  }
+
+  return h;
+}
+
+
+std::pair<TH2D*, TH2D*> Covariance::EventSample::BootstrapErrors() {
+  const int nbins = enu->GetNbinsX();
+  const size_t nb = nreplicas;
+  const size_t nu = enu_syst.size();
+  if (nb < 2) {
+    return { nullptr, nullptr };
+  }
+
+  TH2D* coverr = new TH2D(("coverr_" + name).c_str(), "",
+                          nbins, 0, nbins, nbins, 0, nbins);
+  TH2D* corerr = new TH2D(("corerr_" + name).c_str(), "",
+                          nbins, 0, nbins, nbins, 0, nbins);
+
+  // Running moments of each element over the replicas
+  std::vector<double> cov1(nbins * nbins, 0), cov2(nbins * nbins, 0);
+  std::vector<double> cor1(nbins * nbins, 0), cor2(nbins * nbins, 0);
+
+  TH1D* nom = (TH1D*) enu->Clone("bs_nom");
+  nom->SetDirectory(NULL);
+  std::vector<double> sums(nbins * nu, 0);
+
+  for (size_t r=0; r<nb; r++) {
+    for (int i=0; i<nbins; i++) {
+      nom->SetBinContent(i + 1, bs_cv[i * nb + r]);
+      if (!bs_sums.empty()) {
+        std::copy(bs_sums.begin() + (i * nb + r) * nu,
+                  bs_sums.begin() + (i * nb + r + 1) * nu,
+                  sums.begin() + i * nu);
+      }
+    }
+
+    TH2D* c = CovarianceMatrix(nom, sums, bs_sums.empty() ? 0 : nu);
+    TH2D* cr = CorrelationMatrix(c);
+    for (int i=0; i<nbins; i++) {
+      for (int j=0; j<nbins; j++) {
+        double vc = c->GetBinContent(i + 1, j + 1);
+        double vr = cr->GetBinContent(i + 1, j + 1);
+        cov1[i * nbins + j] += vc;
+        cov2[i * nbins + j] += vc * vc;
+        cor1[i * nbins + j] += vr;
+        cor2[i * nbins + j] += vr * vr;
+      }
+    }
+    delete c;
+    delete cr;
+  }
+
+  delete nom;
+
+  for (int i=0; i<nbins; i++) {
+    for (int j=0; j<nbins; j++) {
+      size_t ij = i * nbins + j;
+      double vc = (cov2[ij] - cov1[ij] * cov1[ij] / nb) / (nb - 1);
+      double vr = (cor2[ij] - cor1[ij] * cor1[ij] / nb) / (nb - 1);
+      coverr->SetBinContent(i + 1, j + 1, sqrt(std::max(vc, 0.0)));
+      corerr->SetBinContent(i + 1, j + 1, sqrt(std::max(vr, 0.0)));
+    }
+  }
+
+  return { coverr, corerr };
+}
+
+
 TH2D* Covariance::EventSample::CovarianceMatrix() {
   delete cov;
   cov = CovarianceMatrix(enu, enu_syst);
@@ -164,192 +441,1684 @@ TH2D* Covariance::EventSample::CorrelationMatrix() {
 
 
 /******************************************************************************
- ** Covariance implementation                                              **
+ ** Covariance::WeightPlan implementation                                  **
  *****************************************************************************/
 
-Covariance::Covariance() {}
+void Covariance::WeightPlan::Resolve(
+    const std::map<std::string, std::vector<double> >& w,
+    const std::set<std::string>& use,
+    const std::string& source) {
+  positions.clear();
+  names.clear();
+  counts.clear();
+  slots.clear();
+  missing.clear();
+  nkeys = w.size();
+  nuniverses = 0;
+
+  bool all = (use.find("*") != use.end());
+
+  size_t nmin = 0;
+  size_t nmax = 0;
+  size_t ipos = 0;
+  for (auto const& it : w) {
+    if (all || use.find(it.first) != use.end()) {
+      positions.push_back(ipos);
+      names.push_back(it.first);
+      size_t n = it.second.size();
+      counts.push_back(n);
+      nmin = (names.size() == 1 ? n : std::min(nmin, n));
+      nmax = std::max(nmax, n);
+    }
+    ipos++;
+  }
+
+  nuniverses = nmin;
 
+  // Report requested functions that are missing from this file
+  for (auto const& name : use) {
+    if (name != "*" && w.find(name) == w.end()) {
+      missing.push_back(name);
+      std::cerr << "Covariance: Weight function " << name
+                << " not found in " << source << std::endl;
+    }
+  }
 
-void Covariance::AddWeight(std::string w) {
-  use_weights.insert(w);
+  // Report mismatched universe counts, truncating to the smallest
+  if (nmin != nmax) {
+    std::cerr << "Covariance: Mismatched universe counts in " << source
+              << ", using " << nmin << " universes:";
+    for (size_t i=0; i<names.size(); i++) {
+      std::cerr << " " << names[i] << "(" << counts[i] << ")";
+    }
+    std::cerr << std::endl;
+  }
 }
 
 
-void Covariance::init() {
-  assert(!fInputFiles.empty());
+bool Covariance::WeightPlan::Apply(
+    const std::map<std::string, std::vector<double> >& w,
+    std::vector<double>& weights,
+    std::vector<const double*>* fns) const {
+  if (w.size() != nkeys) {
+    return false;
+  }
 
-  fFile = TFile::Open(fOutputFile.c_str(), "recreate");
-  assert(fFile);
+  // A function missing when resolved must still be missing
+  for (auto const& name : missing) {
+    if (w.find(name) != w.end()) {
+      return false;
+    }
+  }
 
-  /////////////////////////////////////////////////////////////////////////////
-  // FIXME: Sample definitions for matrix blocks
-  samples.push_back(new EventSample("nue"));
-  samples.push_back(new EventSample("numu"));
-  /////////////////////////////////////////////////////////////////////////////
+  weights.resize(nuniverses);
+  if (fns) {
+    fns->resize(positions.size());
+  }
+  std::fill(weights.begin(), weights.end(), 1.0);
 
-  std::cout << "Covariance: Initialized. Weights: ";
-  for (auto it : use_weights) {
-    std::cout << it << " ";
+  double* out = weights.data();
+  const size_t n = nuniverses;
+
+  // Positions are ascending, so one forward walk of the map suffices
+  auto it = w.begin();
+  size_t ipos = 0;
+  for (size_t k=0; k<positions.size(); k++) {
+    std::advance(it, positions[k] - ipos);
+    ipos = positions[k];
+
+    // Same position, but a different function or fewer universes
+    if (it->first != names[k] || it->second.size() < counts[k]) {
+      return false;
+    }
+
+    const double* wk = it->second.data();
+    if (fns) {
+      (*fns)[k] = wk;
+    }
+
+    for (size_t i=0; i<n; i++) {
+      out[i] *= wk[i];
+    }
   }
-  std::cout << std::endl;
 
-  std::cout << "Covariance: Writing output to " << fOutputFile << std::endl;
+  return true;
 }
 
 
-void Covariance::analyze() {
+/******************************************************************************
+ ** Covariance::Selection implementation                                   **
+ *****************************************************************************/
 
-  for (size_t ii=0; ii<fInputFiles.size(); ii++) {
-    TFile f(fInputFiles[ii].c_str());
-    TTree* _tree = (TTree*) f.Get("tsana");
-    assert(_tree && _tree->GetEntries() > 0);
+Covariance::Selection::Selection(const Json::Value& config) : ccnc(-1) {
+  for (auto const& pdg : config["NuPDG"]) {
+    nupdg.push_back(pdg.asInt());
+  }
 
-    Event* event = new Event;
-    double reco_e;
-    _tree->SetBranchAddress("events", &event);
-    _tree->SetBranchAddress("reco_e", &reco_e);
+  ccnc = config.get("CCNC", -1).asInt();
 
-    // Event loop
-    for (long k=0; k<_tree->GetEntries(); k++) {
-      _tree->GetEntry(k);
+  for (auto const& ex : config["Exclude"]) {
+    exclude.push_back(Selection(ex));
+  }
+}
 
-      if (event->ninteractions == 0) {
-        continue;
-      }
 
-      Event::Interaction& interaction = event->interactions[0];
+bool Covariance::Selection::Pass(const Event& ev) const {
+  const Event::Neutrino& nu = ev.interactions[0].neutrino;
 
-      // Iterate through all the weighting functions to compute a set of
-      // total weights for this event. mcWeight is a mapping from reweighting
-      // function name to a vector of weights for each "universe."
-      std::vector<double> weights;
-      size_t wmin = 100000;
-      for (auto const& it : interaction.weights) {
-        if (use_weights.find(it.first) == use_weights.end()) { continue; }
-        if (it.second.size() < wmin) {
-          wmin = it.second.size();
-        }
+  if (!nupdg.empty() &&
+      std::find(nupdg.begin(), nupdg.end(), nu.pdg) == nupdg.end()) {
+    return false;
+  }
 
-        assert(wmin < 1000000);
-        weights.resize(wmin, 1.0);
+  if (ccnc >= 0 && (int) nu.ccnc != ccnc) {
+    return false;
+  }
 
-        // Compute universe-wise product of all requsted weights
-        if (use_weights.find("*") != use_weights.end() ||
-            use_weights.find(it.first) != use_weights.end()) {
-          std::cout << it.first << " " << it.second[0] << std::endl;
-          for (size_t i=0; i<weights.size(); i++) {
-            weights[i] *= it.second[i];
-          }
-        }
-      }
+  for (auto const& ex : exclude) {
+    if (ex.Pass(ev)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+/******************************************************************************
+ ** Covariance::Input implementation                                       **
+ *****************************************************************************/
+
+Covariance::Input::~Input() {
+  delete enu;
+}
+
+
+void Covariance::Input::Fill(double x, const std::vector<double>& weights,
+                             const WeightPlan* plan,
+                             const std::vector<const double*>* fns,
+                             const std::vector<double>* replicas) {
+  enu->Fill(x);
+  nevents++;
 
-      // The observable
-      double nuEnergy = reco_e; // interaction.neutrino.energy * 1000;
+  // Universe sums cover in-range bins only, like the covariance matrix
+  int bin = enu->FindBin(x);
+  if (bin < 1 || bin > enu->GetNbinsX()) {
+    return;
+  }
+
+  // The first event with weights sizes the universes. Events filled before
+  // it (excluding this one) count at the nominal weight, as for the
+  // per-function sums below.
+  const size_t nbins = enu->GetNbinsX();
+  if (sums.empty() && !weights.empty()) {
+    nuniverses = weights.size();
+    if (maxuniverses > 0) {
+      nuniverses = std::min(nuniverses, maxuniverses);
+    }
+    sums.resize(nbins * nuniverses, 0);
+    for (size_t j=0; j<nbins; j++) {
+      double cv = enu->GetBinContent(j + 1) - ((int) j + 1 == bin ? 1 : 0);
+      std::fill(sums.begin() + j * nuniverses,
+                sums.begin() + (j + 1) * nuniverses, cv);
+    }
+  }
 
-      /////////////////////////////////////////////////////////////////////////
-      // FIXME: Determine which sample this event belongs to
-      EventSample* sample = nullptr;
-      double fs = 1.0;  // Scale factor
+  // Universes the event has no weights for count at the nominal weight
+  const size_t n = std::min(nuniverses, weights.size());
+  const double* w = weights.data();
+  if (!sums.empty()) {
+    double* row = sums.data() + (bin - 1) * nuniverses;
+    for (size_t i=0; i<n; i++) {
+      row[i] += w[i];
+    }
+    for (size_t i=n; i<nuniverses; i++) {
+      row[i] += 1;
+    }
+  }
 
-      // Scale for CCnue or inclusive sample
-      // 1e1p in nue sample
-      if (ii == 0) {
-        fs = 6.6e20 / 5.0315296e+22;
-        sample = samples[0];
+  // Bootstrap replicas: the same universe row, scaled by each replica's
+  // weight for this event
+  if (replicas && !replicas->empty()) {
+    const size_t nb = replicas->size();
+    if (bs_cv.empty()) {
+      nreplicas = nb;
+      bs_cv.resize(nbins * nb, 0);
+    }
+    assert(nb == nreplicas);
+
+    // Sized with the universes; earlier events are at the nominal weight
+    // in every universe, which is their replica spectrum (not yet
+    // including this event)
+    if (bs_sums.empty() && !sums.empty()) {
+      bs_sums.resize(nbins * nb * nuniverses, 0);
+      for (size_t j=0; j<nbins*nb; j++) {
+        std::fill(bs_sums.begin() + j * nuniverses,
+                  bs_sums.begin() + (j + 1) * nuniverses, bs_cv[j]);
       }
-      // 1m1p in bnb sample
-      else if (ii == 1) {
-        if (abs(interaction.neutrino.pdg) == 12 && interaction.neutrino.ccnc == 0) {
-          // Just throw out tiny CCnue(bar) from the inclusive sample
-          continue;
-        }
-        fs = 6.6e20 / 1.72072967e+21;
-        sample = samples[1];
+    }
+
+    for (size_t r=0; r<nb; r++) {
+      const double wr = (*replicas)[r];
+      if (wr == 0) {
+        continue;
       }
-      // 1e1p in bnb sample
-      else if (ii == 2) {
-        if (abs(interaction.neutrino.pdg) == 12 && interaction.neutrino.ccnc == 0) {
-          // Just throw out tiny CCnue(bar) from the inclusive sample
-          continue;
-        }
-        fs = 6.6e20 / 1.72072967e+21;
-        sample = samples[0];
+      bs_cv[(bin - 1) * nb + r] += wr;
+      if (bs_sums.empty()) {
+        continue;
       }
-      /////////////////////////////////////////////////////////////////////////
-
-      // Fill histograms for this event sample
-      if (sample->enu_syst.empty()) {
-        sample->Resize(weights.size());
+      double* brow = bs_sums.data() + ((bin - 1) * nb + r) * nuniverses;
+      for (size_t i=0; i<n; i++) {
+        brow[i] += wr * w[i];
       }
-      else {
-        assert(sample->enu_syst.size() == weights.size());
+      for (size_t i=n; i<nuniverses; i++) {
+        brow[i] += wr;
       }
+    }
+  }
+
+  if (!plan || !fns) {
+    return;
+  }
+
+  // Each function's own universes, sharing the bin lookup above. Events
+  // without a function's weights count at the nominal weight in its
+  // universes, so it is not biased by events it does not cover.
+  for (size_t k=0; k<plan->slots.size(); k++) {
+    size_t slot = plan->slots[k];
+    if (slot >= fn_sums.size()) {
+      fn_sums.resize(slot + 1);
+      fn_nuniverses.resize(slot + 1, 0);
+    }
+    if (fn_last.size() < fn_sums.size()) {
+      fn_last.resize(fn_sums.size(), 0);
+    }
 
-      // CV histogram
-      sample->enu->Fill(nuEnergy, fs);
+    if (fn_sums[slot].empty()) {
+      fn_nuniverses[slot] = plan->counts[k];
+      if (slot < fn_maxuniverses.size() && fn_maxuniverses[slot] > 0) {
+        fn_nuniverses[slot] = std::min(fn_nuniverses[slot],
+                                       fn_maxuniverses[slot]);
+      }
+      fn_sums[slot].resize(nbins * fn_nuniverses[slot], 0);
 
-      // Systematics histograms with weights
-      for (size_t i=0; i<weights.size(); i++) {
-        sample->enu_syst[i]->Fill(nuEnergy, weights[i] * fs);
+      // Events filled before the function was seen (excluding this one)
+      for (size_t j=0; j<nbins; j++) {
+        double cv = enu->GetBinContent(j + 1) - ((int) j + 1 == bin ? 1 : 0);
+        std::fill(fn_sums[slot].begin() + j * fn_nuniverses[slot],
+                  fn_sums[slot].begin() + (j + 1) * fn_nuniverses[slot], cv);
       }
     }
+
+    const size_t nu = fn_nuniverses[slot];
+    const size_t nf = std::min(nu, plan->counts[k]);
+    double* frow = fn_sums[slot].data() + (bin - 1) * nu;
+    const double* fw = (*fns)[k];
+    for (size_t i=0; i<nf; i++) {
+      frow[i] += fw[i];
+    }
+    for (size_t i=nf; i<nu; i++) {
+      frow[i] += 1;
+    }
+    fn_last[slot] = nevents;
   }
 
-  /////////////////////////////////////////////////////////
-  // Output
-  size_t total_bins = 0;
+  // Functions seen in earlier events but not in this one
+  for (size_t slot=0; slot<fn_sums.size(); slot++) {
+    if (fn_sums[slot].empty() ||
+        (slot < fn_last.size() && fn_last[slot] == nevents)) {
+      continue;
+    }
+    const size_t nu = fn_nuniverses[slot];
+    double* frow = fn_sums[slot].data() + (bin - 1) * nu;
+    for (size_t i=0; i<nu; i++) {
+      frow[i] += 1;
+    }
+  }
+}
 
-  fFile->cd();
 
-  // Write out sample=-wise distributions
-  for (size_t i=0; i<samples.size(); i++) {
-    samples[i]->enu->Write();
-    total_bins += samples[i]->enu->GetNbinsX();
+void Covariance::Input::Truncate(size_t n, const std::vector<size_t>& fn_n) {
+  const size_t nbins = enu->GetNbinsX();
 
-    TH2D* cov = samples[i]->CovarianceMatrix();
-    cov->Write();
+  // Re-pack rows of universe sums with a smaller stride
+  auto shrink = [](std::vector<double>& v, size_t rows, size_t& nu,
+                   size_t m) {
+    if (v.empty() || m == 0 || m >= nu) {
+      return;
+    }
+    for (size_t j=0; j<rows; j++) {
+      std::copy(v.begin() + j * nu, v.begin() + j * nu + m,
+                v.begin() + j * m);
+    }
+    v.resize(rows * m);
+    nu = m;
+  };
+
+  maxuniverses = n;
+  size_t nu = nuniverses;
+  shrink(bs_sums, nbins * nreplicas, nu, n);
+  shrink(sums, nbins, nuniverses, n);
+
+  fn_maxuniverses = fn_n;
+  for (size_t slot=0; slot<fn_sums.size() && slot<fn_n.size(); slot++) {
+    shrink(fn_sums[slot], nbins, fn_nuniverses[slot], fn_n[slot]);
+  }
+}
 
-    TH2D* cor = samples[i]->CorrelationMatrix();
-    cor->Write();
 
-    TGraphErrors* g = samples[i]->EnuCollapsed();
-    g->SetName(("err_" + samples[i]->name).c_str());
-    g->Write();
+/******************************************************************************
+ ** Covariance::FlatBinning implementation                                 **
+ *****************************************************************************/
+
+void Covariance::FlatBinning::AddAxis(const std::string& name,
+                                      ObservableFn fn,
+                                      const std::vector<double>& _edges) {
+  assert(fn && _edges.size() > 1);
+
+  names.push_back(name);
+  fns.push_back(fn);
+  edges.push_back(_edges);
+  lo.push_back(_edges.front());
+
+  // Use arithmetic binning if the edges are uniform
+  size_t n = _edges.size() - 1;
+  double w = (_edges.back() - _edges.front()) / n;
+  bool uniform = true;
+  for (size_t i=0; i<n+1 && uniform; i++) {
+    double d = _edges[i] - (_edges.front() + i * w);
+    uniform = std::abs(d) <= 1e-9 * std::abs(w);
   }
+  inv_width.push_back(uniform ? 1.0 / w : 0);
 
-  // Global (sample-to-sample) distributions
-  // Build glued-together energy spectra for the nominal and each systematics
-  // universe, and feed into the correlation matrix calculator.
-  total_bins -= samples.size();
-  TH1D hg("hg", ";E_{#nu};Entries per bin", total_bins, 0, total_bins);
-  hg.Sumw2();
-  std::vector<TH1D*> hgsys;
-  for (size_t i=0; i<samples[0]->enu_syst.size(); i++) {
-    hgsys.push_back(new TH1D(Form("hg%zu", i), "", total_bins, 0, total_bins));
-    hgsys[i]->Sumw2();
-  }
-  size_t ibin = 0;
-  for (size_t i=0; i<samples.size(); i++) {
-    for(int j=1; j<samples[i]->enu->GetNbinsX()+1; j++) {
-      hg.SetBinContent(ibin, samples[i]->enu->GetBinContent(j));
-      hg.SetBinError(ibin, samples[i]->enu->GetBinError(j));
-      if (hgsys.size() != samples[i]->enu_syst.size()) {
-        continue;
-      }
-      for (size_t k=0; k<hgsys.size(); k++) {
-        hgsys[k]->SetBinContent(ibin, samples[i]->enu_syst[k]->GetBinContent(j));
-      }
-      ibin++;
+  // Last axis fastest
+  strides.push_back(1);
+  for (size_t k=0; k<strides.size()-1; k++) {
+    strides[k] *= n;
+  }
+}
+
+
+double Covariance::FlatBinning::Evaluate(const Event& ev,
+                                         double reco_e) const {
+  size_t index = 0;
+
+  for (size_t k=0; k<fns.size(); k++) {
+    const std::vector<double>& e = edges[k];
+    const size_t n = e.size() - 1;
+    double x = fns[k](ev, reco_e);
+
+    if (!(x >= e.front() && x < e.back())) {
+      return -1;
+    }
+
+    size_t i;
+    if (inv_width[k] > 0) {
+      i = std::min<size_t>((x - lo[k]) * inv_width[k], n - 1);
     }
+    else {
+      i = std::upper_bound(e.begin(), e.end(), x) - e.begin() - 1;
+    }
+
+    index += i * strides[k];
   }
 
-  hg.Write();
+  return index + 0.5;
+}
 
-  TH2D* gcov = EventSample::CovarianceMatrix(&hg, hgsys);
-  gcov->Write();
 
-  TH2D* gcor = EventSample::CorrelationMatrix(gcov);
-  gcor->Write();
+size_t Covariance::FlatBinning::GetNbins() const {
+  size_t n = 1;
+  for (auto const& e : edges) {
+    n *= e.size() - 1;
+  }
+  return n;
+}
+
+
+void Covariance::FlatBinning::Write(const std::string& sample) const {
+  std::string list;
+  for (size_t k=0; k<names.size(); k++) {
+    list += (k > 0 ? ";" : "") + names[k];
+  }
+  TNamed axes(("axes_" + sample).c_str(), list.c_str());
+  axes.Write();
+
+  for (size_t k=0; k<edges.size(); k++) {
+    TVectorD e(edges[k].size(), edges[k].data());
+    e.Write(Form("edges_%s_%zu", sample.c_str(), k));
+  }
+}
+
+
+/******************************************************************************
+ ** Observables                                                            **
+ *****************************************************************************/
+
+double ObservableRecoE(const Event& ev, double reco_e) {
+  return reco_e;
+}
+
+
+double ObservableNuEnergy(const Event& ev, double reco_e) {
+  return ev.interactions[0].neutrino.energy * 1000;
+}
+
+
+double ObservableLeptonEnergy(const Event& ev, double reco_e) {
+  return ev.interactions[0].lepton.energy * 1000;
+}
+
+
+double ObservableQ2(const Event& ev, double reco_e) {
+  return ev.interactions[0].neutrino.q2;
+}
+
+
+double ObservableLeptonCosTheta(const Event& ev, double reco_e) {
+  return ev.interactions[0].lepton.momentum.CosTheta();
+}
+
+
+Covariance::ObservableFn Covariance::GetObservable(std::string name) {
+  if (name == "reco_e") return ObservableRecoE;
+  if (name == "nu_energy") return ObservableNuEnergy;
+  if (name == "lepton_energy") return ObservableLeptonEnergy;
+  if (name == "q2") return ObservableQ2;
+  if (name == "lepton_costheta") return ObservableLeptonCosTheta;
+  return nullptr;
+}
+
+
+/******************************************************************************
+ ** Covariance implementation                                              **
+ *****************************************************************************/
+
+Covariance::Covariance()
+    : fShard(0), fNShards(1), fDecompose(true), fRankCorrelations(false),
+      fModeFraction(0.99), fToyCount(0), fToyPoisson(true), fToyThreads(0),
+      fConvergenceTolerance(0), fConvergenceWindow(20), fConvergencePilot(0),
+      fPilotNext(0), fNFilled(0), fTruncated(false), fBootstrap(0), fFile(nullptr),
+      fOwnFile(false), fExposure(0), fSeed(0) {}
+
+
+Covariance::~Covariance() {
+  for (auto it : inputs) {
+    delete it;
+  }
+  for (auto it : samples) {
+    delete it;
+  }
+  if (fFile && fOwnFile) {
+    fFile->Close();
+    delete fFile;
+  }
+}
+
+
+void Covariance::AddWeight(std::string w) {
+  use_weights.insert(w);
+}
+
+
+void Covariance::Configure(Json::Value* config) {
+  assert(config);
+
+  fOutputFile = config->get("OutputFile", fOutputFile).asString();
+  fExposure = config->get("ExposurePOT", 0.0).asDouble();
+  fSeed = config->get("Seed", 0).asInt();
+  fDecompose = config->get("Decompose", true).asBool();
+  fRankCorrelations = config->get("RankCorrelations", false).asBool();
+  fModeFraction = config->get("ModeVarianceFraction", 0.99).asDouble();
+
+  const Json::Value& toys = (*config)["Toys"];
+  fToyCount = toys.get("Count", 0).asUInt64();
+  fToyFile = toys.get("File", "toys.root").asString();
+  fToyPoisson = toys.get("Poisson", true).asBool();
+  fToyThreads = toys.get("Threads", 0).asUInt();
+
+  fBootstrap = (*config)["Bootstrap"].get("Replicas", 0).asUInt();
+
+  const Json::Value& convergence = (*config)["Convergence"];
+  fConvergenceTolerance = convergence.get("Tolerance", 0.0).asDouble();
+  fConvergenceWindow = convergence.get("Window", 20).asUInt();
+  fConvergencePilot = convergence.get("PilotEvents", 0).asUInt64();
+  fPilotNext = fConvergencePilot;
+  if (fConvergencePilot > 0 && fConvergenceTolerance <= 0) {
+    std::cerr << "Covariance: Convergence PilotEvents requires a Tolerance"
+              << std::endl;
+    fConvergencePilot = 0;
+  }
+  fPartialFile = config->get("PartialFile", fPartialFile).asString();
+
+  // Hash everything that defines the result, i.e. not the input file lists,
+  // output paths or output-only options, so shards of the same job can be
+  // merged
+  Json::Value hashed = *config;
+  hashed.removeMember("OutputFile");
+  hashed.removeMember("PartialFile");
+  hashed.removeMember("RankCorrelations");
+  hashed.removeMember("ModeVarianceFraction");
+  hashed.removeMember("Toys");
+  // The seed only affects the output toys, unless it keys the bootstrap
+  // replicas accumulated in the sums
+  if (fBootstrap == 0) {
+    hashed.removeMember("Seed");
+  }
+  for (auto& sc : hashed["Samples"]) {
+    sc.removeMember("ScatterPairs");
+    for (auto& ic : sc["Inputs"]) {
+      ic.removeMember("Files");
+    }
+    // With a base binning, the output binning is applied after the fact
+    if (sc.isMember("BaseBinning")) {
+      sc.removeMember("Binning");
+    }
+  }
+  Json::FastWriter writer;
+  fConfigHash = HashString(writer.write(hashed));
+
+  for (auto const& w : (*config)["Weights"]) {
+    AddWeight(w.asString());
+  }
+
+  for (auto const& sc : (*config)["Samples"]) {
+    std::string name = sc["Name"].asString();
+
+    // Multi-dimensional samples list an observable and binning per axis
+    if (sc["Observable"].isArray()) {
+      const Json::Value& obs = sc["Observable"];
+      const Json::Value& binning = sc["Binning"];
+      if (!binning.isArray() || binning.size() != obs.size() ||
+          sc.isMember("BaseBinning")) {
+        std::cerr << "Covariance: Sample " << name << " needs one Binning "
+                  << "per Observable, and no BaseBinning" << std::endl;
+        assert(false);
+      }
+
+      FlatBinning axes;
+      std::string label;
+      for (Json::ArrayIndex k=0; k<obs.size(); k++) {
+        std::string oname = obs[k].asString();
+        ObservableFn fn = GetObservable(oname);
+        if (!fn) {
+          std::cerr << "Covariance: Unknown observable \"" << oname << "\" "
+                    << "for sample " << name << std::endl;
+          assert(false);
+        }
+        axes.AddAxis(oname, fn, ParseBinning(binning[k]));
+        label += (k > 0 ? "x" : "") + oname;
+      }
+
+      EventSample* sample = \
+        new EventSample(name, axes.GetNbins(), 0, axes.GetNbins());
+      sample->enu->GetXaxis()->SetTitle(("Bin (" + label + ")").c_str());
+      sample->observable = label;
+      sample->axes = axes;
+      samples.push_back(sample);
+      AddInputs(sample, sc, nullptr);
+      continue;
+    }
+
+    std::string obs = sc.get("Observable", "reco_e").asString();
+
+    ObservableFn fn = GetObservable(obs);
+    if (!fn) {
+      std::cerr << "Covariance: Unknown observable \"" << obs << "\" "
+                << "for sample " << name << std::endl;
+      assert(false);
+    }
+
+    // Accumulate in the base binning if given, and rebin for output
+    const Json::Value& binning = sc["Binning"];
+    EventSample* sample = nullptr;
+    if (sc.isMember("BaseBinning")) {
+      sample = new EventSample(name, ParseBinning(sc["BaseBinning"]));
+      sample->binning = ParseBinning(binning);
+    }
+    else {
+      sample = new EventSample(name, ParseBinning(binning));
+    }
+    sample->observable = obs;
+    samples.push_back(sample);
+    AddInputs(sample, sc, fn);
+  }
+}
+
+
+void Covariance::AddInputs(EventSample* sample, const Json::Value& sc,
+                           ObservableFn fn) {
+  const std::string& name = sample->name;
+
+  for (auto const& p : sc["ScatterPairs"]) {
+    fScatterPairs[name].push_back({ p[0].asUInt(), p[1].asUInt() });
+  }
+
+  for (auto const& ic : sc["Inputs"]) {
+    Input* input = new Input;
+    input->sample = sample;
+    input->pot = ic.get("POT", 0.0).asDouble();
+    input->autopot = !ic.isMember("POT");
+    input->selection = ic.get("Selection", "").asString();
+    input->cut = Selection(ic["Cut"]);
+    input->observable = fn;
+    input->axes = (sample->axes.GetNAxes() > 0 ? &sample->axes : nullptr);
+    for (auto const& f : ic["Files"]) {
+      input->files.push_back(f.asString());
+    }
+
+    input->enu = (TH1D*) sample->enu->Clone(
+      Form("enu_%s_input%zu", name.c_str(), inputs.size()));
+    input->enu->SetDirectory(NULL);
+    input->enu->Reset();
+
+    inputs.push_back(input);
+  }
+}
+
+
+void Covariance::init() {
+  init(TFile::Open(fOutputFile.c_str(), "recreate"));
+  fOwnFile = true;
+}
+
+
+void Covariance::init(TFile* file) {
+  assert(!samples.empty() && !inputs.empty());
+
+  fFile = file;
+  fOwnFile = false;
+  assert(fFile);
+  fOutputFile = fFile->GetName();
+
+  std::cout << "Covariance: Initialized. Samples: ";
+  for (auto it : samples) {
+    std::cout << it->name << "(" << it->observable << ") ";
+  }
+  std::cout << std::endl;
+
+  std::cout << "Covariance: Weights: ";
+  for (auto it : use_weights) {
+    std::cout << it << " ";
+  }
+  std::cout << std::endl;
+
+  std::cout << "Covariance: Writing output to " << fOutputFile << std::endl;
+}
+
+
+void Covariance::analyze() {
+  // Group inputs by file, so each file is read exactly once
+  std::vector<std::string> files;
+  std::map<std::string, std::vector<Input*> > consumers;
+  for (auto input : inputs) {
+    for (auto const& f : input->files) {
+      if (consumers.find(f) == consumers.end()) {
+        files.push_back(f);
+      }
+      consumers[f].push_back(input);
+    }
+  }
+
+  for (size_t ii=0; ii<files.size(); ii++) {
+    if (ii % fNShards != fShard) {
+      continue;
+    }
+
+    const std::vector<Input*>& targets = consumers[files[ii]];
+
+    TFile f(files[ii].c_str());
+    TTree* _tree = (TTree*) f.Get("tsana");
+    assert(_tree && _tree->GetEntries() > 0);
+
+    // Exposure recorded by the selection
+    TParameter<double>* pot = (TParameter<double>*) f.Get("pot");
+    for (auto input : targets) {
+      if (!input->autopot) {
+        continue;
+      }
+      if (pot) {
+        input->pot += pot->GetVal();
+      }
+      else {
+        std::cerr << "Covariance: No POT metadata in " << files[ii]
+                  << std::endl;
+      }
+    }
+
+    Source source;
+    source.name = files[ii];
+    source.targets = targets;
+    InitSource(source);
+
+    Event* event = new Event;
+    double reco_e;
+    _tree->SetBranchAddress("events", &event);
+    _tree->SetBranchAddress("reco_e", &reco_e);
+
+    // Event loop
+    for (long k=0; k<_tree->GetEntries(); k++) {
+      _tree->GetEntry(k);
+      FillEvent(source, *event, reco_e, k);
+    }
+
+    delete event;
+  }
+
+  Finish();
+}
+
+
+void Covariance::Finish() {
+  if (!fPartialFile.empty()) {
+    WritePartial(fPartialFile);
+  }
+
+  Write();
+}
+
+
+void Covariance::InitSource(Source& source) {
+  source.key = strtoull(HashString(source.name).c_str(), nullptr, 16);
+  source.replicas.resize(fBootstrap);
+  source.warned = false;
+}
+
+
+void Covariance::FillEvent(Source& source, const Event& event,
+                           double reco_e, uint64_t entry) {
+  if (event.ninteractions == 0) {
+    return;
+  }
+
+  const Event::Interaction& interaction = event.interactions[0];
+
+  // Compute the universe-wise product of all requested weights.
+  // mcWeight is a mapping from reweighting function name to a vector
+  // of weights for each "universe." Weight functions are resolved once per
+  // source, keyed by the number of functions in the map in case some
+  // events carry a different layout (e.g. no weights at all). A plan that
+  // does not match the event's keys is resolved again.
+  std::vector<double>& weights = source.weights;
+  std::vector<const double*>* fns = fDecompose ? &source.fns : nullptr;
+  auto ip = source.plans.find(interaction.weights.size());
+  bool resolved = (ip != source.plans.end());
+  if (!resolved) {
+    ip = source.plans.insert({interaction.weights.size(), WeightPlan()}).first;
+  }
+  WeightPlan& plan = ip->second;
+  if (!resolved || !plan.Apply(interaction.weights, weights, fns)) {
+    plan.Resolve(interaction.weights, use_weights, source.name);
+    for (auto const& name : plan.names) {
+      plan.slots.push_back(FunctionSlot(name));
+    }
+    bool valid = plan.Apply(interaction.weights, weights, fns);
+    assert(valid);
+    (void) valid;
+  }
+
+  // Replica weights depend only on the seed, source and entry, so they
+  // are the same however the files are sharded
+  if (fBootstrap > 0) {
+    CounterRNG rng(fSeed, source.key, entry, 0);
+    for (size_t r=0; r<fBootstrap; r++) {
+      source.replicas[r] = rng.Poisson(1.0);
+    }
+  }
+
+  // Fill every input that reads this source and accepts the event
+  for (auto input : source.targets) {
+    if (!input->cut.Pass(event)) {
+      continue;
+    }
+
+    size_t nuni = weights.size();
+    if (input->maxuniverses > 0) {
+      nuni = std::min(nuni, input->maxuniverses);
+    }
+
+    // Input::Fill counts missing universes at the nominal weight and
+    // ignores extra ones; report that once per source
+    if (!input->sums.empty() && input->nuniverses != nuni &&
+        !source.warned) {
+      std::cerr << "Covariance: Universe count " << nuni
+                << " in " << source.name << " does not match "
+                << input->nuniverses << " for sample "
+                << input->sample->name << ", "
+                << (nuni < input->nuniverses ?
+                    "using nominal weights for the rest" :
+                    "ignoring the extra universes") << std::endl;
+      source.warned = true;
+    }
+
+    double x = (input->axes ? input->axes->Evaluate(event, reco_e) :
+                input->observable(event, reco_e));
+    input->Fill(x, weights,
+                fDecompose ? &plan : nullptr, &source.fns,
+                fBootstrap > 0 ? &source.replicas : nullptr);
+    fNFilled++;
+  }
+
+  // Without universes yet, try again after another pilot's worth
+  if (fConvergencePilot > 0 && !fTruncated && fNFilled >= fPilotNext) {
+    if (!TruncateUniverses()) {
+      fPilotNext = fNFilled + fConvergencePilot;
+    }
+  }
+}
+
+
+void Covariance::Fill(const std::string& selection, const std::string& file,
+                      const Event& event, double reco_e, uint64_t entry) {
+  auto it = fSources.find(selection);
+  if (it == fSources.end()) {
+    Source& source = fSources[selection];
+    source.name = selection;
+    for (auto input : inputs) {
+      if (input->selection == selection) {
+        source.targets.push_back(input);
+      }
+    }
+    InitSource(source);
+    it = fSources.find(selection);
+  }
+
+  // Key the bootstrap streams by the file, as for event tree inputs
+  Source& source = it->second;
+  if (source.file != file) {
+    source.file = file;
+    source.key = strtoull(HashString(file).c_str(), nullptr, 16);
+    source.warned = false;
+  }
+
+  FillEvent(source, event, reco_e, entry);
+}
+
+
+void Covariance::AddPOT(const std::string& selection, double pot) {
+  for (auto input : inputs) {
+    if (input->selection == selection && input->autopot) {
+      input->pot += pot;
+    }
+  }
+}
+
+
+void Covariance::Write() {
+  Combine();
+
+  /////////////////////////////////////////////////////////
+  // Output
+  fFile->cd();
+
+  TNamed hash("config_hash", fConfigHash.c_str());
+  hash.Write();
+
+  // Rebin from the base binning where an output binning is set
+  std::vector<EventSample*> out;
+  for (auto sample : samples) {
+    EventSample* r = nullptr;
+    if (!sample->binning.empty()) {
+      r = sample->Rebin(sample->binning);
+      assert(r);
+    }
+    out.push_back(r ? r : sample);
+  }
+
+  // Write out sample-wise distributions
+  for (size_t i=0; i<out.size(); i++) {
+    out[i]->enu->Write();
+
+    if (out[i]->axes.GetNAxes() > 0) {
+      out[i]->axes.Write(out[i]->name);
+    }
+
+    TH2D* cov = out[i]->CovarianceMatrix();
+    cov->Write();
+
+    CovarianceModes modes(cov);
+    modes.Write(out[i]->name, fModeFraction);
+
+    TH2D* cor = out[i]->CorrelationMatrix();
+    cor->Write();
+
+    TGraphErrors* g = out[i]->EnuCollapsed();
+    g->SetName(("err_" + out[i]->name).c_str());
+    g->Write();
+
+    // Bin-to-bin universe scatters, only for the requested pairs
+    const std::vector<std::pair<size_t, size_t> >& pairs = \
+      fScatterPairs[out[i]->name];
+    if (fRankCorrelations || !pairs.empty()) {
+      BinCorrelations bc(out[i]->enu_syst);
+
+      if (fRankCorrelations) {
+        TH2D* spearman = bc.Spearman(("spearman_" + out[i]->name).c_str());
+        spearman->Write();
+      }
+
+      for (auto const& p : pairs) {
+        if (p.first >= bc.GetNbins() || p.second >= bc.GetNbins()) {
+          std::cerr << "Covariance: Scatter pair out of range for "
+                    << out[i]->name << std::endl;
+          continue;
+        }
+        TGraph* sg = bc.Scatter(p.first, p.second);
+        sg->SetName(Form("scatter_%s_%zu_%zu",
+                         out[i]->name.c_str(), p.first, p.second));
+        sg->Write();
+        delete sg;
+      }
+    }
+
+    // Per-systematic decomposition
+    if (fDecompose) {
+      for (size_t j=0; j<out[i]->fn_names.size(); j++) {
+        TH2D* fcov = out[i]->FunctionCovarianceMatrix(j);
+        fcov->Write();
+        delete fcov;
+      }
+
+      TH2D* fracerr = out[i]->FractionalErrors();
+      fracerr->Write();
+
+      PrintBreakdown(out[i]);
+    }
+
+    if (fConvergenceTolerance > 0) {
+      PrintConvergence(out[i]);
+    }
+
+    // MC statistical errors on the matrix elements
+    if (out[i]->nreplicas > 0) {
+      std::pair<TH2D*, TH2D*> bserr = out[i]->BootstrapErrors();
+      if (bserr.first) {
+        bserr.first->Write();
+        bserr.second->Write();
+        delete bserr.first;
+        delete bserr.second;
+      }
+    }
+  }
+
+  // Global (sample-to-sample) distributions
+  // Concatenate the sample blocks for the nominal and each systematics
+  // universe, and feed into the covariance matrix calculator. Samples with
+  // no universes (e.g. no selected events) contribute their nominal.
+  size_t total_bins = 0;
+  size_t nuni = 0;
+  bool consistent = true;
+  for (auto sample : out) {
+    total_bins += sample->enu->GetNbinsX();
+    if (!sample->enu_syst.empty()) {
+      if (nuni > 0 && sample->enu_syst.size() != nuni) {
+        std::cerr << "Covariance: Sample " << sample->name << " has "
+                  << sample->enu_syst.size() << " universes, expected "
+                  << nuni << "; skipping joint covariance" << std::endl;
+        consistent = false;
+      }
+      nuni = sample->enu_syst.size();
+    }
+  }
+
+  if (consistent) {
+    WriteJoint(out, total_bins, nuni);
+  }
+
+  for (size_t i=0; i<out.size(); i++) {
+    if (out[i] != samples[i]) {
+      delete out[i];
+    }
+  }
+}
+
+
+void Covariance::WriteJoint(const std::vector<EventSample*>& out,
+                            size_t total_bins, size_t nuni) {
+
+  TH1D hg("hg", ";Bin;Entries per bin", total_bins, 0, total_bins);
+  hg.Sumw2();
+  std::vector<TH1D*> hgsys(nuni);
+  for (size_t k=0; k<nuni; k++) {
+    hgsys[k] = new TH1D(Form("hg%zu", k), "", total_bins, 0, total_bins);
+    hgsys[k]->SetDirectory(NULL);
+  }
+
+  size_t ibin = 1;
+  for (auto sample : out) {
+    for (int j=1; j<sample->enu->GetNbinsX()+1; j++, ibin++) {
+      hg.SetBinContent(ibin, sample->enu->GetBinContent(j));
+      hg.SetBinError(ibin, sample->enu->GetBinError(j));
+      for (size_t k=0; k<nuni; k++) {
+        double v = (sample->enu_syst.empty() ?
+                    sample->enu->GetBinContent(j) :
+                    sample->enu_syst[k]->GetBinContent(j));
+        hgsys[k]->SetBinContent(ibin, v);
+      }
+    }
+  }
+
+  hg.Write();
+
+  TH2D* gcov = EventSample::CovarianceMatrix(&hg, hgsys);
+  gcov->Write();
+
+  CovarianceModes modes(gcov);
+  modes.Write("joint", fModeFraction);
+
+  TH2D* gcor = EventSample::CorrelationMatrix(gcov);
+  gcor->Write();
+
+  for (auto h : hgsys) {
+    delete h;
+  }
+
+  // Pseudo-experiments from the joint matrix
+  if (fToyCount > 0) {
+    ToyGenerator toys(&hg, gcov, fSeed);
+    toys.SetPoisson(fToyPoisson);
+    toys.Write(fToyFile, fToyCount, fToyThreads);
+    fFile->cd();
+  }
+}
+
+
+void Covariance::WritePartial(std::string _f) {
+  TFile f(_f.c_str(), "recreate");
+  assert(!f.IsZombie());
+
+  TNamed hash("config_hash", fConfigHash.c_str());
+  hash.Write();
+
+  std::string fnlist;
+  for (size_t i=0; i<fFunctions.size(); i++) {
+    fnlist += (i > 0 ? ";" : "") + fFunctions[i];
+  }
+  TNamed functions("functions", fnlist.c_str());
+  functions.Write();
+
+  for (size_t i=0; i<inputs.size(); i++) {
+    Input* input = inputs[i];
+
+    input->enu->Write(Form("enu_input%zu", i));
+
+    // Event count, exposure and universe count
+    TVectorD meta(3);
+    meta[0] = input->nevents;
+    meta[1] = input->pot;
+    meta[2] = input->nuniverses;
+    meta.Write(Form("meta_input%zu", i));
+
+    if (!input->sums.empty()) {
+      TVectorD sums(input->sums.size(), input->sums.data());
+      sums.Write(Form("sums_input%zu", i));
+    }
+
+    for (size_t slot=0; slot<input->fn_sums.size(); slot++) {
+      if (input->fn_sums[slot].empty()) {
+        continue;
+      }
+      TVectorD fsums(input->fn_sums[slot].size(), input->fn_sums[slot].data());
+      fsums.Write(Form("fnsums_input%zu_%s", i, fFunctions[slot].c_str()));
+    }
+
+    if (!input->bs_cv.empty()) {
+      TVectorD bscv(input->bs_cv.size(), input->bs_cv.data());
+      bscv.Write(Form("bscv_input%zu", i));
+    }
+
+    if (!input->bs_sums.empty()) {
+      TVectorD bssums(input->bs_sums.size(), input->bs_sums.data());
+      bssums.Write(Form("bssums_input%zu", i));
+    }
+  }
+
+  f.Close();
+
+  std::cout << "Covariance: Wrote partial result to " << _f << std::endl;
+}
+
+
+bool Covariance::Merge(std::string _f) {
+  TFile f(_f.c_str());
+  if (f.IsZombie()) {
+    std::cerr << "Covariance: Unable to open partial " << _f << std::endl;
+    return false;
+  }
+
+  TNamed* hash = (TNamed*) f.Get("config_hash");
+  if (!hash || fConfigHash != hash->GetTitle()) {
+    std::cerr << "Covariance: Configuration hash mismatch in " << _f
+              << std::endl;
+    return false;
+  }
+
+  TNamed* functions = (TNamed*) f.Get("functions");
+  if (!functions) {
+    std::cerr << "Covariance: No function list in " << _f << std::endl;
+    return false;
+  }
+  std::vector<std::string> fnames;
+  std::string fnlist = functions->GetTitle();
+  for (size_t pos=0; !fnlist.empty() && pos != std::string::npos; ) {
+    size_t next = fnlist.find(';', pos);
+    fnames.push_back(fnlist.substr(pos, next - pos));
+    pos = (next == std::string::npos ? next : next + 1);
+  }
+
+  const bool truncate = (fConvergencePilot > 0);
+
+  // Validate all inputs before touching any accumulators, so a bad
+  // partial leaves them unchanged
+  for (size_t i=0; i<inputs.size(); i++) {
+    Input* input = inputs[i];
+    TVectorD* meta = (TVectorD*) f.Get(Form("meta_input%zu", i));
+    TH1D* penu = (TH1D*) f.Get(Form("enu_input%zu", i));
+    if (!meta || !penu || meta->GetNrows() < 3) {
+      std::cerr << "Covariance: Missing input " << i << " in " << _f
+                << std::endl;
+      return false;
+    }
+
+    const size_t nbins = input->enu->GetNbinsX();
+    if ((size_t) penu->GetNbinsX() != nbins) {
+      std::cerr << "Covariance: Binning mismatch for input " << i
+                << " in " << _f << std::endl;
+      return false;
+    }
+
+    // Truncated jobs may stop at different counts; the common universes
+    // are kept (see below)
+    size_t nuni = (*meta)[2];
+    if (!truncate && !input->sums.empty() && nuni > 0 &&
+        nuni != input->nuniverses) {
+      std::cerr << "Covariance: Universe count mismatch for input " << i
+                << " in " << _f << std::endl;
+      return false;
+    }
+
+    // Expected vector lengths, where present
+    auto check = [&](const char* name, size_t expected, size_t have) {
+      TVectorD* v = (TVectorD*) f.Get(Form("%s_input%zu", name, i));
+      if (!v || v->GetNrows() == 0) {
+        return true;
+      }
+      size_t n = v->GetNrows();
+      if (n != expected || (have > 0 && n != have)) {
+        std::cerr << "Covariance: Bad " << name << " length " << n
+                  << " for input " << i << " in " << _f << std::endl;
+        return false;
+      }
+      return true;
+    };
+
+    if (!check("sums", nbins * nuni, truncate ? 0 : input->sums.size()) ||
+        !check("bscv", nbins * fBootstrap, input->bs_cv.size()) ||
+        !check("bssums", nbins * fBootstrap * nuni,
+               truncate ? 0 : input->bs_sums.size())) {
+      return false;
+    }
+
+    for (auto const& name : fnames) {
+      TVectorD* fsums = \
+        (TVectorD*) f.Get(Form("fnsums_input%zu_%s", i, name.c_str()));
+      if (!fsums) {
+        continue;
+      }
+
+      size_t n = fsums->GetNrows();
+      auto it = std::find(fFunctions.begin(), fFunctions.end(), name);
+      size_t slot = it - fFunctions.begin();
+      bool have = (it != fFunctions.end() && slot < input->fn_sums.size() &&
+                   !input->fn_sums[slot].empty());
+      if (n == 0 || n % nbins != 0 ||
+          (!truncate && have && n != input->fn_sums[slot].size())) {
+        std::cerr << "Covariance: Bad " << name << " sums length " << n
+                  << " for input " << i << " in " << _f << std::endl;
+        return false;
+      }
+    }
+  }
+
+  // With truncation, keep the universes common to every job: the smallest
+  // nonzero count on either side, for all inputs, as in TruncateUniverses
+  if (truncate) {
+    size_t n = 0;
+    std::map<std::string, size_t> fn_n;
+    auto keep = [](size_t& m, size_t c) {
+      if (c > 0 && (m == 0 || c < m)) {
+        m = c;
+      }
+    };
+
+    for (size_t i=0; i<inputs.size(); i++) {
+      Input* input = inputs[i];
+      const size_t nbins = input->enu->GetNbinsX();
+      TVectorD* meta = (TVectorD*) f.Get(Form("meta_input%zu", i));
+      TVectorD* sums = (TVectorD*) f.Get(Form("sums_input%zu", i));
+      if (!input->sums.empty()) {
+        keep(n, input->nuniverses);
+      }
+      if (sums && sums->GetNrows() > 0) {
+        keep(n, (*meta)[2]);
+      }
+
+      for (size_t slot=0; slot<input->fn_sums.size(); slot++) {
+        if (!input->fn_sums[slot].empty()) {
+          keep(fn_n[fFunctions[slot]], input->fn_nuniverses[slot]);
+        }
+      }
+      for (auto const& name : fnames) {
+        TVectorD* fsums = \
+          (TVectorD*) f.Get(Form("fnsums_input%zu_%s", i, name.c_str()));
+        if (fsums) {
+          keep(fn_n[name], fsums->GetNrows() / nbins);
+        }
+      }
+    }
+
+    if (n > 0) {
+      std::vector<size_t> fn_max;
+      for (auto const& it : fn_n) {
+        size_t slot = FunctionSlot(it.first);
+        fn_max.resize(std::max(fn_max.size(), slot + 1), 0);
+        fn_max[slot] = it.second;
+      }
+      for (auto input : inputs) {
+        input->Truncate(n, fn_max);
+      }
+      fTruncated = true;
+    }
+  }
+
+  // Add rows of a partial's sums (stride snu) to rows of stride dnu <= snu
+  auto add_rows = [](std::vector<double>& dst, size_t dnu,
+                     const TVectorD& src, size_t snu) {
+    const size_t rows = (dnu > 0 ? dst.size() / dnu : 0);
+    for (size_t r=0; r<rows; r++) {
+      for (size_t k=0; k<dnu; k++) {
+        dst[r * dnu + k] += src[r * snu + k];
+      }
+    }
+  };
+
+  for (size_t i=0; i<inputs.size(); i++) {
+    Input* input = inputs[i];
+
+    TVectorD* meta = (TVectorD*) f.Get(Form("meta_input%zu", i));
+    input->nevents += (*meta)[0];
+    if (input->autopot) {
+      input->pot += (*meta)[1];
+    }
+
+    TH1D* penu = (TH1D*) f.Get(Form("enu_input%zu", i));
+    input->enu->Add(penu);
+    const int nbins = input->enu->GetNbinsX();
+
+    // Events without universe sums on either side count at nominal weight
+    TVectorD* sums = (TVectorD*) f.Get(Form("sums_input%zu", i));
+    const size_t pnu = (*meta)[2];
+    if (sums && sums->GetNrows() > 0) {
+      if (input->sums.empty()) {
+        size_t nu = pnu;
+        if (input->maxuniverses > 0) {
+          nu = std::min(nu, input->maxuniverses);
+        }
+        input->nuniverses = nu;
+        input->sums.resize(nbins * nu, 0);
+        for (int j=0; j<nbins; j++) {
+          double cv = (input->enu->GetBinContent(j + 1) -
+                       penu->GetBinContent(j + 1));
+          std::fill(input->sums.begin() + j * nu,
+                    input->sums.begin() + (j + 1) * nu, cv);
+        }
+      }
+      add_rows(input->sums, input->nuniverses, *sums, pnu);
+    }
+    else if (!input->sums.empty()) {
+      const size_t nu = input->nuniverses;
+      for (int j=0; j<nbins; j++) {
+        for (size_t k=0; k<nu; k++) {
+          input->sums[j * nu + k] += penu->GetBinContent(j + 1);
+        }
+      }
+    }
+
+    // Bootstrap replicas; the replica count is part of the configuration
+    TVectorD* bscv = (TVectorD*) f.Get(Form("bscv_input%zu", i));
+    if (bscv && bscv->GetNrows() > 0) {
+      if (input->bs_cv.empty()) {
+        input->nreplicas = fBootstrap;
+        input->bs_cv.resize(bscv->GetNrows(), 0);
+      }
+      for (size_t k=0; k<input->bs_cv.size(); k++) {
+        input->bs_cv[k] += (*bscv)[k];
+      }
+    }
+
+    TVectorD* bssums = (TVectorD*) f.Get(Form("bssums_input%zu", i));
+    if (bssums && bssums->GetNrows() > 0) {
+      if (input->bs_sums.empty()) {
+        input->bs_sums.resize(nbins * fBootstrap * input->nuniverses, 0);
+      }
+      add_rows(input->bs_sums, input->nuniverses, *bssums, pnu);
+    }
+
+    // Events on either side without a function count at nominal weight
+    std::vector<bool> merged(input->fn_sums.size(), false);
+    for (auto const& name : fnames) {
+      TVectorD* fsums = \
+        (TVectorD*) f.Get(Form("fnsums_input%zu_%s", i, name.c_str()));
+      if (!fsums) {
+        continue;
+      }
+
+      size_t slot = FunctionSlot(name);
+      if (slot >= input->fn_sums.size()) {
+        input->fn_sums.resize(slot + 1);
+        input->fn_nuniverses.resize(slot + 1, 0);
+        merged.resize(slot + 1, false);
+      }
+
+      std::vector<double>& fsum = input->fn_sums[slot];
+      const size_t pnf = fsums->GetNrows() / nbins;
+      if (fsum.empty()) {
+        size_t nf = pnf;
+        if (slot < input->fn_maxuniverses.size() &&
+            input->fn_maxuniverses[slot] > 0) {
+          nf = std::min(nf, input->fn_maxuniverses[slot]);
+        }
+        input->fn_nuniverses[slot] = nf;
+        fsum.resize(nbins * nf, 0);
+        for (int j=0; j<nbins; j++) {
+          double cv = (input->enu->GetBinContent(j + 1) -
+                       penu->GetBinContent(j + 1));
+          std::fill(fsum.begin() + j * nf, fsum.begin() + (j + 1) * nf, cv);
+        }
+      }
+      add_rows(fsum, input->fn_nuniverses[slot], *fsums, pnf);
+      merged[slot] = true;
+    }
+
+    for (size_t slot=0; slot<input->fn_sums.size(); slot++) {
+      if (merged[slot] || input->fn_sums[slot].empty()) {
+        continue;
+      }
+      const size_t nf = input->fn_nuniverses[slot];
+      for (int j=0; j<nbins; j++) {
+        double cv = penu->GetBinContent(j + 1);
+        for (size_t k=0; k<nf; k++) {
+          input->fn_sums[slot][j * nf + k] += cv;
+        }
+      }
+    }
+  }
+
+  std::cout << "Covariance: Merged " << _f << std::endl;
+
+  return true;
+}
+
+
+void Covariance::Combine() {
+  for (auto sample : samples) {
+    sample->enu->Reset();
+
+    // Inputs with different universe counts (e.g. files made with
+    // different weight sets) are combined over the universes they share
+    size_t nuni = 0;
+    for (auto input : inputs) {
+      if (input->sample == sample && !input->sums.empty() &&
+          (nuni == 0 || input->nuniverses < nuni)) {
+        nuni = input->nuniverses;
+      }
+    }
+    sample->Resize(nuni);
+
+    const int nbins = sample->enu->GetNbinsX();
+    for (auto input : inputs) {
+      if (input->sample != sample) {
+        continue;
+      }
+
+      double fs = (fExposure > 0 && input->pot > 0 ?
+                   fExposure / input->pot : 1.0);
+
+      sample->enu->Add(input->enu, fs);
+
+      // Inputs without universe weights are nominal in every universe, as
+      // for the per-function sums below
+      if (input->sums.empty()) {
+        for (int j=0; j<nbins; j++) {
+          double cv = fs * input->enu->GetBinContent(j + 1);
+          for (size_t k=0; k<nuni; k++) {
+            sample->enu_syst[k]->AddBinContent(j + 1, cv);
+          }
+        }
+        continue;
+      }
+
+      for (int j=0; j<nbins; j++) {
+        const double* row = input->sums.data() + j * input->nuniverses;
+        for (size_t k=0; k<nuni; k++) {
+          sample->enu_syst[k]->AddBinContent(j + 1, fs * row[k]);
+        }
+      }
+    }
+
+    // Per-function sums, in global function order
+    sample->fn_names.clear();
+    sample->fn_nuniverses.clear();
+    sample->fn_sums.clear();
+
+    for (size_t slot=0; slot<fFunctions.size(); slot++) {
+      size_t nf = 0;
+      for (auto input : inputs) {
+        if (input->sample == sample && slot < input->fn_sums.size() &&
+            !input->fn_sums[slot].empty()) {
+          size_t n = input->fn_nuniverses[slot];
+          nf = (nf == 0 ? n : std::min(nf, n));
+        }
+      }
+
+      if (nf == 0) {
+        continue;
+      }
+
+      // Universes start at nominal so inputs without this function's
+      // weights contribute no variation
+      std::vector<double> fsum(nbins * nf);
+      for (auto input : inputs) {
+        if (input->sample != sample) {
+          continue;
+        }
+
+        double fs = (fExposure > 0 && input->pot > 0 ?
+                     fExposure / input->pot : 1.0);
+
+        bool has = (slot < input->fn_sums.size() &&
+                    !input->fn_sums[slot].empty());
+        for (int j=0; j<nbins; j++) {
+          double* row = fsum.data() + j * nf;
+          if (has) {
+            const double* irow = input->fn_sums[slot].data() +
+                                 j * input->fn_nuniverses[slot];
+            for (size_t k=0; k<nf; k++) {
+              row[k] += fs * irow[k];
+            }
+          }
+          else {
+            double cv = fs * input->enu->GetBinContent(j + 1);
+            for (size_t k=0; k<nf; k++) {
+              row[k] += cv;
+            }
+          }
+        }
+      }
+
+      sample->fn_names.push_back(fFunctions[slot]);
+      sample->fn_nuniverses.push_back(nf);
+      sample->fn_sums.push_back(fsum);
+    }
+
+    // Bootstrap replicas, scaled like the main sums
+    sample->nreplicas = 0;
+    sample->bs_cv.clear();
+    sample->bs_sums.clear();
+
+    for (auto input : inputs) {
+      if (input->sample != sample || input->bs_cv.empty()) {
+        continue;
+      }
+
+      const size_t nb = input->nreplicas;
+      if (sample->nreplicas == 0) {
+        sample->nreplicas = nb;
+        sample->bs_cv.resize(nbins * nb, 0);
+        sample->bs_sums.resize(nbins * nb * nuni, 0);
+      }
+      assert(nb == sample->nreplicas);
+
+      double fs = (fExposure > 0 && input->pot > 0 ?
+                   fExposure / input->pot : 1.0);
+
+      for (size_t k=0; k<sample->bs_cv.size(); k++) {
+        sample->bs_cv[k] += fs * input->bs_cv[k];
+      }
+
+      if (input->bs_sums.empty()) {
+        // Nominal replica spectra in every universe
+        for (size_t k=0; k<sample->bs_cv.size(); k++) {
+          for (size_t u=0; u<nuni; u++) {
+            sample->bs_sums[k * nuni + u] += fs * input->bs_cv[k];
+          }
+        }
+        continue;
+      }
+
+      const size_t inu = input->nuniverses;
+      for (size_t k=0; k<sample->bs_cv.size(); k++) {
+        for (size_t u=0; u<nuni; u++) {
+          sample->bs_sums[k * nuni + u] += fs * input->bs_sums[k * inu + u];
+        }
+      }
+    }
+  }
+}
+
+
+std::vector<double> Covariance::ParseBinning(const Json::Value& binning) {
+  std::vector<double> edges;
+
+  if (binning.isMember("Edges")) {
+    for (auto const& e : binning["Edges"]) {
+      edges.push_back(e.asDouble());
+    }
+  }
+  else {
+    size_t nbins = binning.get("Bins", 25).asUInt();
+    double lo = binning.get("Min", 0.0).asDouble();
+    double hi = binning.get("Max", 3000.0).asDouble();
+    for (size_t i=0; i<nbins+1; i++) {
+      edges.push_back(lo + (hi - lo) * i / nbins);
+    }
+  }
+
+  assert(edges.size() > 1);
+  return edges;
+}
+
+
+Covariance::EventSample* Covariance::GetSample(std::string name) {
+  Combine();
+
+  for (auto sample : samples) {
+    if (sample->name == name) {
+      return sample;
+    }
+  }
+
+  return nullptr;
+}
+
+
+std::string Covariance::HashString(const std::string& s) {
+  // 64-bit FNV-1a, stable across platforms and builds
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i=0; i<s.size(); i++) {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211ULL;
+  }
+  return Form("%016llx", h);
+}
+
+
+size_t Covariance::FunctionSlot(const std::string& name) {
+  for (size_t i=0; i<fFunctions.size(); i++) {
+    if (fFunctions[i] == name) {
+      return i;
+    }
+  }
+  fFunctions.push_back(name);
+  return fFunctions.size() - 1;
+}
+
+
+bool Covariance::TruncateUniverses() {
+  // One count for all samples, so the joint matrix has the same universes
+  // in every block
+  size_t n = 0;
+  std::vector<size_t> fn_n(fFunctions.size(), 0);
+
+  for (auto input : inputs) {
+    n = std::max(n, EventSample::ConvergedUniverses(
+      input->enu, input->sums, input->nuniverses,
+      fConvergenceTolerance, fConvergenceWindow));
+
+    for (size_t slot=0; slot<input->fn_sums.size(); slot++) {
+      fn_n[slot] = std::max(fn_n[slot], EventSample::ConvergedUniverses(
+        input->enu, input->fn_sums[slot], input->fn_nuniverses[slot],
+        fConvergenceTolerance, fConvergenceWindow));
+    }
+  }
+
+  // Nothing to measure convergence on yet
+  if (n == 0) {
+    return false;
+  }
+
+  std::cout << "Covariance: Truncating to " << n << " universes after "
+            << fNFilled << " events" << std::endl;
+
+  for (auto input : inputs) {
+    input->Truncate(n, fn_n);
+  }
+
+  fTruncated = true;
+  return true;
+}
+
+
+void Covariance::PrintConvergence(EventSample* sample) {
+  std::cout << "Covariance: Universes needed for convergence in "
+            << sample->name << " (tolerance " << fConvergenceTolerance
+            << ", window " << fConvergenceWindow << ")" << std::endl;
+
+  size_t n = sample->enu_syst.size();
+  std::vector<double> sums(sample->enu->GetNbinsX() * n);
+  for (size_t k=0; k<n; k++) {
+    for (int j=0; j<sample->enu->GetNbinsX(); j++) {
+      sums[j * n + k] = sample->enu_syst[k]->GetBinContent(j + 1);
+    }
+  }
+
+  size_t m = EventSample::ConvergedUniverses(
+    sample->enu, sums, n, fConvergenceTolerance, fConvergenceWindow);
+  std::cout << Form("  %-48s %6zu / %zu", "total", m, n) << std::endl;
+
+  for (size_t f=0; f<sample->fn_names.size(); f++) {
+    size_t nf = sample->fn_nuniverses[f];
+    size_t mf = EventSample::ConvergedUniverses(
+      sample->enu, sample->fn_sums[f], nf,
+      fConvergenceTolerance, fConvergenceWindow);
+    std::cout << Form("  %-48s %6zu / %zu",
+                      sample->fn_names[f].c_str(), mf, nf)
+              << std::endl;
+  }
+}
+
+
+void Covariance::PrintBreakdown(EventSample* sample) {
+  // Fractional error on the total rate: sqrt(Sum(E_ij))/Sum(N^cv_i)
+  double total = 0;
+  for (int i=1; i<sample->enu->GetNbinsX()+1; i++) {
+    total += sample->enu->GetBinContent(i);
+  }
+
+  std::cout << "Covariance: Fractional rate error breakdown for "
+            << sample->name << std::endl;
+
+  for (size_t f=0; f<sample->fn_names.size()+1; f++) {
+    bool istotal = (f == sample->fn_names.size());
+    TH2D* c = (istotal ? sample->CovarianceMatrix() :
+                         sample->FunctionCovarianceMatrix(f));
+
+    double var = 0;
+    for (int i=1; i<c->GetNbinsX()+1; i++) {
+      for (int j=1; j<c->GetNbinsY()+1; j++) {
+        var += c->GetBinContent(i, j);
+      }
+    }
+
+    std::cout << Form("  %-48s %8.4f",
+                      istotal ? "total" : sample->fn_names[f].c_str(),
+                      total > 0 ? sqrt(std::max(var, 0.0)) / total : 0)
+              << std::endl;
+
+    if (!istotal) {
+      delete c;
+    }
+  }
 }
 
 }  // namespace util
@@ -8,16 +8,23 @@
  *
  * Author: A. Mastbaum <mastbaum@uchicago.edu>, 2018/02/05
  */
+#include <cstdint>
 #include <fstream>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
 
+class Event;
 class TFile;
 class TGraphErrors;
 class TH1D;
 class TH2D;
 
+namespace Json {
+  class Value;
+}
+
 namespace util {
 
 /**
@@ -26,18 +33,39 @@ namespace util {
  *
  * Populates event samples from selected event trees, iterating through
  * event weights (multisims) to compute a covariance correlation matrices.
+ *
+ * Samples are defined in a JSON configuration (see Configure). Each sample
+ * has an observable, a binning, and one or more inputs, where an input is
+ * a set of selected event files with an exposure and a membership cut. All
+ * inputs are filled in a single read of each file, and the joint covariance
+ * is built from the concatenated sample blocks.
  */
 class Covariance {
 public:
+  class EventSample;
+
   Covariance();
-  virtual ~Covariance() {}
+  virtual ~Covariance();
+
+  /**
+   * Function computing an observable from an event.
+   *
+   * The second argument is the reconstructed energy from the selection.
+   */
+  typedef double (*ObservableFn)(const Event&, double);
 
   /**
-   * Add an input file for processing
+   * Look up an observable by name.
    *
-   * \param _f The path to the file
+   * Available observables are reco_e (selection reconstructed energy),
+   * nu_energy and lepton_energy (true energies in MeV), q2 (true Q^2 in
+   * GeV^2) and lepton_costheta (true lepton angle to the beam). Samples
+   * may bin several observables at once (see FlatBinning).
+   *
+   * \param name The observable name
+   * \returns The observable function, or nullptr if unknown
    */
-  void AddInputFile(std::string _f) { fInputFiles.push_back(_f); }
+  static ObservableFn GetObservable(std::string name);
 
   /**
    * Set the output file path.
@@ -53,12 +81,297 @@ public:
    */
   void AddWeight(std::string w);
 
+  /**
+   * Configure samples, weights and exposure.
+   *
+   * Example:
+   *
+   *     {
+   *       "OutputFile": "cov.root",
+   *       "ExposurePOT": 6.6e20,
+   *       "Weights": ["expskin_FluxUnisim", "horncurrent_FluxUnisim"],
+   *       "Samples": [{
+   *         "Name": "nue",
+   *         "Observable": "reco_e",
+   *         "Binning": { "Bins": 25, "Min": 0, "Max": 3000 },
+   *         "Inputs": [
+   *           { "Files": ["nue_1e1p.root"], "POT": 5.0315296e22 },
+   *           { "Files": ["bnb_1e1p.root"], "POT": 1.72072967e21,
+   *             "Cut": { "Exclude": [{ "NuPDG": [12, -12], "CCNC": 0 }] } }
+   *         ]
+   *       }]
+   *     }
+   *
+   * A binning may instead be given as a list of bin "Edges". Inputs are
+   * scaled by ExposurePOT / POT. If POT is absent, it is summed from the
+   * "pot" metadata that the selection writes into each file; if there is
+   * no exposure either way, the scale is 1.
+   *
+   * A sample may also set a fine "BaseBinning" (same format), which is
+   * used for accumulation and stored in partials; outputs are rebinned to
+   * "Binning", whose edges must lie on base edges. Since the base binning
+   * alone defines the accumulated sums, partials can then be merged with
+   * any aligned output binning.
+   *
+   * For a multi-dimensional sample, "Observable" is a list of observables
+   * and "Binning" a list of binnings, one per axis, e.g.
+   * ["lepton_energy", "lepton_costheta"]. The sample is accumulated and
+   * written unrolled over the flat bin index, with the axis metadata
+   * alongside (see FlatBinning). BaseBinning is 1D only.
+   *
+   * Unless "Decompose" is false, a covariance matrix for each individual
+   * weight function is built alongside the total. If "PartialFile" is set,
+   * the accumulated sums are also written there for a later Merge().
+   *
+   * For inspecting bin-to-bin correlations, a sample may list
+   * "ScatterPairs" ([[i, j], ...], 0-based output bins) to write graphs of
+   * bin i vs. bin j across universes, and "RankCorrelations": true writes
+   * Spearman correlation matrices for all samples.
+   *
+   * Each sample and the joint matrix are also written as eigenvalues,
+   * principal-component modes retaining "ModeVarianceFraction" (default
+   * 0.99) of the variance, packed symmetric storage and, when positive
+   * definite, a Cholesky factor (see CovarianceModes).
+   *
+   * Pseudo-experiments from the joint matrix are written with
+   * "Toys": { "Count": N, "File": "toys.root", "Poisson": true,
+   * "Threads": 0 }, seeded by "Seed" (see ToyGenerator).
+   *
+   * "Convergence": { "Tolerance": 0.01, "Window": 20 } reports how many
+   * universes each sample and weight function needs for its diagonal
+   * errors to converge (see EventSample::ConvergedUniverses). Adding
+   * "PilotEvents": N truncates the universes to those counts after the
+   * first N accumulated events, saving memory and time for the rest of the
+   * pass. One count is used for all samples (and one per function). The
+   * counts depend on the data seen, so when partials from truncated jobs
+   * are merged, only the universes common to all of them are kept.
+   *
+   * "Bootstrap": { "Replicas": B } accumulates B Poisson(1)-weighted
+   * replicas of every sample alongside the main sums, with each event's
+   * replica weights drawn from a stream keyed by "Seed", its file and its
+   * entry, so with replicas the seed is part of the configuration hash.
+   * The spread of the replica matrices gives the MC statistical error on
+   * each covariance and correlation element (see
+   * EventSample::BootstrapErrors).
+   *
+   * \param config The configuration as a JSON object
+   */
+  void Configure(Json::Value* config);
+
+  /**
+   * Set the path for a partial-result file, written after analyze().
+   *
+   * \param _f The file path (empty for none)
+   */
+  void SetPartialFile(std::string _f) { fPartialFile = _f; }
+
+  /**
+   * Process only a subset of the input files.
+   *
+   * Files are assigned round-robin, so shard i of n reads every n-th file
+   * starting at i.
+   *
+   * \param i Shard index
+   * \param n Number of shards
+   */
+  void SetShard(size_t i, size_t n) { fShard = i; fNShards = n; }
+
   /** Initialize the covariance calculator. */
   void init();
 
-  /** Run the covariance calculator. */
+  /**
+   * Initialize, writing output to an existing file instead of OutputFile.
+   *
+   * \param file The output file (not owned)
+   */
+  void init(TFile* file);
+
+  /** Run the covariance calculator over the input files, then Finish. */
   void analyze();
 
+  /** Write the partial result (if PartialFile is set) and the output. */
+  void Finish();
+
+  /**
+   * Accumulate one selected event in process, without an event tree.
+   *
+   * The event fills the inputs configured with this "Selection" instead of
+   * "Files". Bootstrap replicas are keyed by the source file path and
+   * entry, so they do not depend on how the files are split between jobs.
+   *
+   * \param selection The selection name
+   * \param file The path of the event's source file
+   * \param event The event
+   * \param reco_e The reconstructed energy from the selection
+   * \param entry The event's entry in its source file
+   */
+  void Fill(const std::string& selection, const std::string& file,
+            const Event& event, double reco_e, uint64_t entry);
+
+  /**
+   * Add exposure to the in-process inputs of a selection that have no
+   * configured POT.
+   *
+   * \param selection The selection name
+   * \param pot The exposure
+   */
+  void AddPOT(const std::string& selection, double pot);
+
+  /**
+   * Add the accumulated sums from a partial-result file.
+   *
+   * The partial must come from a configuration with the same hash (all
+   * settings except file lists and output paths).
+   *
+   * \param _f The partial-result file path
+   * \returns True if the partial was merged
+   */
+  bool Merge(std::string _f);
+
+  /** Compute the matrices from the accumulated sums and write output. */
+  void Write();
+
+  /**
+   * Write the accumulated (unscaled) per-input sums, event counts, POT and
+   * configuration hash, which may be combined with Merge().
+   *
+   * \param _f The file path
+   */
+  void WritePartial(std::string _f);
+
+  /**
+   * Get a sample, with inputs combined into its spectra.
+   *
+   * Intended for interactive use after analyze() or Merge(), e.g. to
+   * Rebin() and inspect matrices for different binnings.
+   *
+   * \param name The sample name
+   * \returns The sample (owned by this object), or nullptr if not found
+   */
+  EventSample* GetSample(std::string name);
+
+  /**
+   * Bin edges from a JSON binning definition.
+   *
+   * \param binning Either {"Edges": [...]} or {"Bins", "Min", "Max"}
+   * \returns The bin edges
+   */
+  static std::vector<double> ParseBinning(const Json::Value& binning);
+
+  /** Get the configuration hash. */
+  std::string GetConfigHash() const { return fConfigHash; }
+
+  /**
+   * \class Covariance::WeightPlan
+   * \brief Requested weight functions resolved against a file's weight map
+   *
+   * The set of weight functions in the MCEventWeight map is fixed within an
+   * input file, so the requested names are resolved once into positions in
+   * the map's (sorted) iteration order. Per event, the map is then walked
+   * once and the universe-wise product is a flat loop into a reused buffer.
+   * A plan is valid for any map with the same set of keys; Apply checks
+   * the planned names and vector lengths as it walks the map, so a plan
+   * reused for a different layout is detected rather than misapplied.
+   *
+   * The plan also exposes each function's own universe weights, so that
+   * per-function (single systematic) spectra can be filled in the same pass.
+   */
+  class WeightPlan {
+    public:
+      /** Constructor. */
+      WeightPlan() : nkeys(0), nuniverses(0) {}
+
+      /**
+       * Resolve the requested weight names against a weight map.
+       *
+       * If the requested functions have different numbers of universes,
+       * the plan is truncated to the smallest count. Inconsistencies are
+       * reported once, here, rather than per event.
+       *
+       * \param w The event weight map (function name to universe weights)
+       * \param use The requested weight function names ("*" for all)
+       * \param source A label for diagnostic messages, e.g. the file name
+       */
+      void Resolve(const std::map<std::string, std::vector<double> >& w,
+                   const std::set<std::string>& use,
+                   const std::string& source="");
+
+      /**
+       * Compute the universe-wise product of the planned weight functions.
+       *
+       * \param w The event weight map
+       * \param weights Output buffer, resized to the number of universes
+       * \param fns If not null, filled with pointers to each planned
+       *            function's universe weights (counts[k] values each)
+       * \returns False if the map does not have the layout the plan was
+       *          resolved for (the outputs are then not valid)
+       */
+      bool Apply(const std::map<std::string, std::vector<double> >& w,
+                 std::vector<double>& weights,
+                 std::vector<const double*>* fns=nullptr) const;
+
+      std::vector<size_t> positions;  //!< Map positions of used functions
+      std::vector<std::string> names;  //!< Names of used functions
+      std::vector<size_t> counts;  //!< Universe count of each function
+      std::vector<size_t> slots;  //!< Global index of each function
+      std::vector<std::string> missing;  //!< Requested functions not found
+      size_t nkeys;  //!< Number of keys in the resolved weight map
+      size_t nuniverses;  //!< Number of universes in the product
+  };
+
+  /**
+   * A multi-dimensional binning, flattened to a linear bin index.
+   *
+   * Each axis has an observable and bin edges. The flat index is
+   * sum_k i_k * stride_k with the last axis varying fastest, so samples of
+   * any dimension share the 1D accumulators, with one unit-width bin per
+   * cell. Uniform axes are binned arithmetically, others by binary search.
+   */
+  class FlatBinning {
+    public:
+      /**
+       * Add an axis.
+       *
+       * \param name The observable name
+       * \param fn The observable function
+       * \param edges Bin edges
+       */
+      void AddAxis(const std::string& name, ObservableFn fn,
+                   const std::vector<double>& edges);
+
+      /**
+       * Compute the flat coordinate of an event.
+       *
+       * \param ev The event
+       * \param reco_e The reconstructed energy from the selection
+       * \returns The flat bin index plus 0.5, or -1 if the event is
+       *          outside the range of any axis
+       */
+      double Evaluate(const Event& ev, double reco_e) const;
+
+      /** Total number of (flat) bins. */
+      size_t GetNbins() const;
+
+      /** Number of axes. */
+      size_t GetNAxes() const { return names.size(); }
+
+      /**
+       * Write the axis metadata to the current directory, as a TNamed
+       * axes_<sample> listing the observables (";"-separated) and TVectorD
+       * edges_<sample>_<k> for each axis.
+       *
+       * \param sample The sample name
+       */
+      void Write(const std::string& sample) const;
+
+      std::vector<std::string> names;  //!< Observable names
+      std::vector<ObservableFn> fns;  //!< Observable functions
+      std::vector<std::vector<double> > edges;  //!< Bin edges per axis
+      std::vector<size_t> strides;  //!< Flat index stride per axis
+      std::vector<double> lo;  //!< Lower edge per axis
+      std::vector<double> inv_width;  //!< Inverse bin width (0: variable)
+  };
+
   /**
    * Container for an event sample, e.g. nue/numu/etc.
    */
@@ -80,6 +393,16 @@ public:
       EventSample(std::string _name="sample", size_t nbins=25,
                   double elo=0, double ehi=3000, size_t nweights=0);
 
+      /**
+       * Constructor with variable-width bins.
+       *
+       * \param _name String name for the event sample
+       * \param edges Bin edges (nbins + 1 values)
+       * \param nweights Number of systematics universes
+       */
+      EventSample(std::string _name, const std::vector<double>& edges,
+                  size_t nweights=0);
+
       /** Destructor. */
       ~EventSample();
 
@@ -92,6 +415,20 @@ public:
       /** Set the number of universes. */
       void Resize(size_t nweights);
 
+      /**
+       * Derive a sample with a coarser binning from this one.
+       *
+       * The nominal spectrum, universes and per-function sums are summed
+       * into the new bins, so any covariance, correlation or collapsed
+       * spectrum can be computed without re-reading inputs. Every new edge
+       * must coincide with an edge of this sample's binning.
+       *
+       * \param edges New bin edges
+       * \returns A new sample (caller takes ownership), or nullptr if the
+       *          edges are not aligned with the current binning
+       */
+      EventSample* Rebin(const std::vector<double>& edges) const;
+
       /**
        * Covariance Matrix
        *
@@ -115,23 +452,320 @@ public:
       /** Correlation matrix using internal histograms */
       TH2D* CorrelationMatrix();
 
+      /**
+       * Covariance matrix from bin-major universe sums.
+       *
+       * Same definition as above, with N^syst_i,m = sums[(i-1) * n + m].
+       *
+       * \param nom The nominal spectrum
+       * \param sums Universe sums, bin-major
+       * \param n Number of universes
+       */
+      static TH2D* CovarianceMatrix(TH1D* nom, const std::vector<double>& sums,
+                                    size_t n);
+
+      /**
+       * Number of universes needed for the diagonal errors to converge.
+       *
+       * Universes are added one at a time to running estimates of
+       * sqrt(Cov[ii]). The result is the first count m at which every
+       * nonzero estimate changed by less than a relative tolerance over the
+       * last window universes, or n if that never happens.
+       *
+       * \param nom The nominal spectrum
+       * \param sums Universe sums, bin-major
+       * \param n Number of universes
+       * \param tol Relative tolerance
+       * \param window Number of universes over which changes are measured
+       * \returns The number of universes needed
+       */
+      static size_t ConvergedUniverses(TH1D* nom,
+                                       const std::vector<double>& sums,
+                                       size_t n, double tol, size_t window);
+
+      /**
+       * Covariance matrix for a single weight function.
+       *
+       * \param ifn Index into fn_names
+       */
+      TH2D* FunctionCovarianceMatrix(size_t ifn);
+
+      /**
+       * Fractional error breakdown: sqrt(Cov[ii])/N^cv_i per bin (x) for
+       * each weight function and the total (y).
+       */
+      TH2D* FractionalErrors();
+
+      /**
+       * Bootstrap standard errors of the covariance and correlation matrix
+       * elements: the standard deviation of each element over the
+       * replicas.
+       *
+       * \returns The errors, as (coverr_<name>, corerr_<name>), or nulls
+       *          if there are no replicas
+       */
+      std::pair<TH2D*, TH2D*> BootstrapErrors();
+
       std::string name;  //!< String name for this event sample
+      std::string observable;  //!< Name of the binned observable
       TH1D* enu;  //!< "Nominal" energy spectrum
       std::vector<TH1D*> enu_syst;  //!< Spectra for each systematic universe
 
+      std::vector<double> binning;  //!< Output bin edges (empty: as enu)
+      FlatBinning axes;  //!< Multi-dimensional binning (empty for 1D)
+
+      std::vector<std::string> fn_names;  //!< Individual weight functions
+      std::vector<size_t> fn_nuniverses;  //!< Universes per function
+      std::vector<std::vector<double> > fn_sums;  //!< Per-function sums
+
+      size_t nreplicas;  //!< Number of bootstrap replicas
+      std::vector<double> bs_cv;  //!< Replica spectra, [bin][replica]
+      std::vector<double> bs_sums;  //!< Replica sums, [bin][replica][universe]
+
     protected:
       TH2D* cov;  //!< Cached covariance matrix
   };
 
+  /**
+   * \class Covariance::Selection
+   * \brief Sample membership cut on the primary interaction
+   *
+   * Empty requirements accept everything. An event passes if it satisfies
+   * all requirements and matches none of the exclusions.
+   */
+  class Selection {
+    public:
+      /** Constructor. */
+      Selection() : ccnc(-1) {}
+
+      /**
+       * Build from a JSON object with optional keys NuPDG (list of
+       * allowed neutrino PDG codes), CCNC (0 for CC, 1 for NC) and
+       * Exclude (list of nested selections to reject).
+       *
+       * \param config The configuration as a JSON object
+       */
+      explicit Selection(const Json::Value& config);
+
+      /**
+       * Apply the cut.
+       *
+       * \param ev The event
+       * \returns True if the event belongs to the sample
+       */
+      bool Pass(const Event& ev) const;
+
+      std::vector<int> nupdg;  //!< Allowed neutrino PDG codes (any if empty)
+      int ccnc;  //!< Required CC (0) or NC (1), or -1 for either
+      std::vector<Selection> exclude;  //!< Vetoed subsets
+  };
+
+  /**
+   * \class Covariance::Input
+   * \brief One contribution to an event sample
+   *
+   * Holds the unscaled accumulated spectra for a set of input files, so
+   * that the exposure scaling is applied once when samples are combined.
+   * Universe sums are stored bin-major (sums[bin * nuniverses + u]) so the
+   * per-event fill is a contiguous loop over universes.
+   */
+  class Input {
+    public:
+      /** Constructor. */
+      Input()
+          : sample(nullptr), pot(0), autopot(false), observable(nullptr),
+            axes(nullptr),
+            enu(nullptr),
+            nevents(0), nuniverses(0), maxuniverses(0), nreplicas(0) {}
+
+      /** Destructor. */
+      ~Input();
+
+      /**
+       * Accumulate one event.
+       *
+       * \param x The observable value
+       * \param weights Universe weights for the event
+       * \param plan If not null, also fill per-function sums for the
+       *             functions in this plan
+       * \param fns Per-function weights, as returned by WeightPlan::Apply
+       * \param replicas If not null, bootstrap replica weights for the event
+       */
+      void Fill(double x, const std::vector<double>& weights,
+                const WeightPlan* plan=nullptr,
+                const std::vector<const double*>* fns=nullptr,
+                const std::vector<double>* replicas=nullptr);
+
+      /**
+       * Stop accumulating universes beyond a given count.
+       *
+       * Existing sums are truncated, and the limits also apply to sums
+       * allocated later.
+       *
+       * \param n Maximum universes in the combined product
+       * \param fn_n Maximum universes per function slot (0 for no limit)
+       */
+      void Truncate(size_t n, const std::vector<size_t>& fn_n);
+
+      EventSample* sample;  //!< The sample this input contributes to
+      std::vector<std::string> files;  //!< Input file paths
+      std::string selection;  //!< In-process selection name (see Fill)
+      double pot;  //!< Exposure of the input files (0 if unknown)
+      bool autopot;  //!< Exposure is summed from the file metadata
+      Selection cut;  //!< Membership cut
+      ObservableFn observable;  //!< Observable function
+      const FlatBinning* axes;  //!< Multi-dimensional binning, or null
+      TH1D* enu;  //!< Unscaled nominal spectrum
+      size_t nevents;  //!< Number of events accumulated
+      size_t nuniverses;  //!< Number of universes accumulated
+      size_t maxuniverses;  //!< Universe limit (0 for none)
+      std::vector<size_t> fn_maxuniverses;  //!< Limits per function slot
+      std::vector<double> sums;  //!< Unscaled universe sums, bin-major
+      std::vector<size_t> fn_nuniverses;  //!< Universes per function slot
+      std::vector<std::vector<double> > fn_sums;  //!< Per-function sums
+      std::vector<size_t> fn_last;  //!< Event count at each slot's last fill
+      size_t nreplicas;  //!< Number of bootstrap replicas
+      std::vector<double> bs_cv;  //!< Replica spectra, [bin][replica]
+      std::vector<double> bs_sums;  //!< Replica sums, [bin][replica][universe]
+  };
+
 private:
-  std::vector<std::string> fInputFiles;  //!< Input files
+  /**
+   * A source of events (an input file or an in-process selection), with
+   * the inputs it feeds and the state reused between its events.
+   */
+  struct Source {
+    std::string name;  //!< File path or selection name
+    uint64_t key;  //!< Hash of the name (or file), for bootstrap streams
+    std::string file;  //!< Current source file of a selection
+    std::vector<Input*> targets;  //!< Inputs filled from this source
+    std::map<size_t, WeightPlan> plans;  //!< Weight plans by map size
+    std::vector<double> weights;  //!< Universe weight buffer
+    std::vector<const double*> fns;  //!< Per-function weight buffer
+    std::vector<double> replicas;  //!< Bootstrap replica weights
+    bool warned;  //!< A universe count mismatch was reported
+  };
+
+  /**
+   * Prepare a source for filling.
+   *
+   * \param source The source, with name and targets set
+   */
+  void InitSource(Source& source);
+
+  /**
+   * Fill every target of a source that accepts an event.
+   *
+   * \param source The source
+   * \param event The event
+   * \param reco_e The reconstructed energy from the selection
+   * \param entry The index of the event in the source
+   */
+  void FillEvent(Source& source, const Event& event, double reco_e,
+                 uint64_t entry);
+
+  /**
+   * Create the inputs for a sample from its configuration.
+   *
+   * \param sample The sample
+   * \param sc The sample configuration
+   * \param fn The observable function (null for multi-dimensional samples)
+   */
+  void AddInputs(EventSample* sample, const Json::Value& sc,
+                 ObservableFn fn);
+
+  /**
+   * Combine the scaled inputs into the sample spectra.
+   *
+   * Inputs of a sample with different universe counts are combined over
+   * the smallest count (per function, for the per-function sums); inputs
+   * without universe weights are nominal in every universe.
+   */
+  void Combine();
+
+  /**
+   * Write the joint covariance of the concatenated sample blocks.
+   *
+   * \param out The samples, in output binning
+   * \param total_bins Total number of bins over all samples
+   * \param nuni Number of universes
+   */
+  void WriteJoint(const std::vector<EventSample*>& out, size_t total_bins,
+                  size_t nuni);
+
+  /**
+   * Stable hash of a string (64-bit FNV-1a), as hex.
+   *
+   * \param s The string
+   * \returns The hash as 16 hex digits
+   */
+  static std::string HashString(const std::string& s);
+
+  /**
+   * Global index of a weight function, registering it if new.
+   *
+   * \param name The weight function name
+   * \returns The index into fFunctions
+   */
+  size_t FunctionSlot(const std::string& name);
+
+  /**
+   * Truncate universes once the pilot events have been accumulated.
+   *
+   * The number of universes needed for convergence is found for the
+   * combined product and each function, from each input's sums, and the
+   * largest over all inputs of all samples is kept everywhere, so the
+   * joint matrix can be built. Functions not seen yet are not limited.
+   *
+   * \returns False if no input has universe sums yet (nothing is changed)
+   */
+  bool TruncateUniverses();
+
+  /**
+   * Print the number of universes needed for convergence, for the
+   * combined product and each weight function.
+   *
+   * \param sample The event sample
+   */
+  void PrintConvergence(EventSample* sample);
+
+  /**
+   * Print the fractional error on the total rate for each weight function.
+   *
+   * \param sample The event sample
+   */
+  void PrintBreakdown(EventSample* sample);
+
   std::string fOutputFile;  //!< Output file
+  std::string fPartialFile;  //!< Partial-result output file
+  std::string fConfigHash;  //!< Hash of the result-defining configuration
+  size_t fShard;  //!< Shard index
+  size_t fNShards;  //!< Number of shards
   std::set<std::string> use_weights;  //!< Weight functions to use
   std::vector<EventSample*> samples;  //!< Event samples
+  std::vector<Input*> inputs;  //!< Sample inputs
+  std::vector<std::string> fFunctions;  //!< Weight functions seen
+  bool fDecompose;  //!< Build per-function covariance matrices
+  bool fRankCorrelations;  //!< Write Spearman bin correlation matrices
+  double fModeFraction;  //!< Variance fraction kept in written modes
+  size_t fToyCount;  //!< Number of pseudo-experiments to throw
+  std::string fToyFile;  //!< Output file for pseudo-experiments
+  bool fToyPoisson;  //!< Poisson-fluctuate pseudo-experiments
+  size_t fToyThreads;  //!< Threads for pseudo-experiments (0: all cores)
+  double fConvergenceTolerance;  //!< Relative tolerance (0: no monitoring)
+  size_t fConvergenceWindow;  //!< Universes over which changes are measured
+  size_t fConvergencePilot;  //!< Events before truncating (0: no truncation)
+  size_t fPilotNext;  //!< Events at the next truncation attempt
+  size_t fNFilled;  //!< Events filled so far, over all inputs
+  bool fTruncated;  //!< Universes have been truncated
+  size_t fBootstrap;  //!< Number of bootstrap replicas (0: none)
+  /** Bin pairs (0-based) to write universe scatters for, by sample name */
+  std::map<std::string, std::vector<std::pair<size_t, size_t> > > fScatterPairs;
   TFile* fFile;  //!< File for output
-  double fScaleFactorE;  //!< POT scaling, etc.
-  double fScaleFactorMu;  //!< POT scaling, etc.
-  int fSeed;  //!< Random seed for ROOT
+  bool fOwnFile;  //!< The output file is owned (opened by init)
+  std::map<std::string, Source> fSources;  //!< In-process sources
+  double fExposure;  //!< Target exposure (POT) for scaling, 0 for none
+  int fSeed;  //!< Random seed for pseudo-experiments
 };
 
 }  // namespace util
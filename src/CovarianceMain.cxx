@@ -1,37 +1,72 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
+#include <unistd.h>
+#include <json/json.h>
 #include <Covariance.hh>
 
 int main(int argc, char* argv[]) {
   util::Covariance cov;
 
-  if (argc != 4) {
+  // Parse command line arguments
+  std::string partial;
+  size_t shard = 0;
+  size_t nshards = 1;
+
+  int c;
+  while ((c=getopt(argc, argv, "p:s:")) != -1) {
+    switch (c) {
+      case 'p':
+        partial = optarg;
+        break;
+      case 's':
+        if (sscanf(optarg, "%zu/%zu", &shard, &nshards) != 2 ||
+            nshards == 0 || shard >= nshards) {
+          fprintf(stderr, "Invalid shard `%s', expected i/N.\n", optarg);
+          return 1;
+        }
+        break;
+      case '?':
+        if (optopt == 'p' || optopt == 's')
+          fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+        else
+          fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        return 1;
+      default:
+        abort();
+    }
+  }
+
+  if (argc - optind < 1 || argc - optind > 2) {
     std::cout << "Usage: " << argv[0]
-              << " output.root nue.root numu.root"
+              << " [-p partial.root] [-s i/N] config.json [output.root]"
               << std::endl;
     return 1;
   }
 
-  // Input/output files
-  cov.SetOutputFile(argv[1]);
-  cov.AddInputFile(argv[2]);
-  cov.AddInputFile(argv[3]);
-
-  // Weights
-  cov.AddWeight("kminus_PrimaryHadronNormalization");
-  cov.AddWeight("kplus_PrimaryHadronFeynmanScaling");
-  cov.AddWeight("kzero_PrimaryHadronSanfordWang");
-  cov.AddWeight("nucleoninexsec_FluxUnisim");
-  cov.AddWeight("nucleonqexsec_FluxUnisim");
-  cov.AddWeight("nucleontotxsec_FluxUnisim");
-  cov.AddWeight("piminus_PrimaryHadronSWCentralSplineVariation");
-  cov.AddWeight("pioninexsec_FluxUnisim");
-  cov.AddWeight("pionqexsec_FluxUnisim");
-  cov.AddWeight("piontotxsec_FluxUnisim");
-  cov.AddWeight("piplus_PrimaryHadronSWCentralSplineVariation");
-  cov.AddWeight("expskin_FluxUnisim");
-  cov.AddWeight("horncurrent_FluxUnisim");
+  // Load the sample configuration
+  Json::Value config;
+  std::ifstream configstream(argv[optind], std::ifstream::binary);
+  Json::Reader reader;
+  if (!reader.parse(configstream, config)) {
+    std::cerr << "Error parsing configuration file " << argv[optind]
+              << std::endl;
+    return 2;
+  }
+
+  cov.Configure(&config);
+
+  // Command line options override the configuration
+  if (argc - optind == 2) {
+    cov.SetOutputFile(argv[optind + 1]);
+  }
+  if (!partial.empty()) {
+    cov.SetPartialFile(partial);
+  }
+  cov.SetShard(shard, nshards);
 
   cov.init();
   cov.analyze();
@@ -0,0 +1,41 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <json/json.h>
+#include <Covariance.hh>
+
+int main(int argc, char* argv[]) {
+  util::Covariance cov;
+
+  if (argc < 4) {
+    std::cout << "Usage: " << argv[0]
+              << " config.json output.root partial.root [partial.root ...]"
+              << std::endl;
+    return 1;
+  }
+
+  // Load the sample configuration, which must match the partials
+  Json::Value config;
+  std::ifstream configstream(argv[1], std::ifstream::binary);
+  Json::Reader reader;
+  if (!reader.parse(configstream, config)) {
+    std::cerr << "Error parsing configuration file " << argv[1] << std::endl;
+    return 2;
+  }
+
+  cov.Configure(&config);
+  cov.SetOutputFile(argv[2]);
+  cov.init();
+
+  for (int i=3; i<argc; i++) {
+    if (!cov.Merge(argv[i])) {
+      return 3;
+    }
+  }
+
+  cov.Write();
+
+  return 0;
+}
+
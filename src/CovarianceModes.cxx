@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "TDecompChol.h"
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TMatrixDSym.h"
+#include "TMatrixDSymEigen.h"
+#include "TVectorD.h"
+#include "CovarianceModes.hh"
+
+namespace util {
+
+CovarianceModes::CovarianceModes(const TH2D* cov, double rtol)
+    : fCov(ToMatrix(cov)), fTolerance(rtol), fRank(0),
+      fPositiveDefinite(false) {
+  Decompose();
+}
+
+
+CovarianceModes::CovarianceModes(const TMatrixDSym& cov, double rtol)
+    : fCov(cov), fTolerance(rtol), fRank(0), fPositiveDefinite(false) {
+  Decompose();
+}
+
+
+TMatrixDSym CovarianceModes::ToMatrix(const TH2D* cov) {
+  const int n = cov->GetNbinsX();
+  TMatrixDSym m(n);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) {
+      m(i, j) = cov->GetBinContent(i + 1, j + 1);
+    }
+  }
+  return m;
+}
+
+
+void CovarianceModes::Decompose() {
+  const int n = fCov.GetNrows();
+
+  // Eigenvalues come back in decreasing order
+  TMatrixDSymEigen eigen(fCov);
+  fEigenvalues.ResizeTo(n);
+  fEigenvalues = eigen.GetEigenValues();
+  fEigenvectors.ResizeTo(n, n);
+  fEigenvectors = eigen.GetEigenVectors();
+
+  double lmax = (n > 0 ? std::abs(fEigenvalues[0]) : 0);
+  fRank = 0;
+  for (int k=0; k<n; k++) {
+    if (fEigenvalues[k] > fTolerance * lmax) {
+      fRank++;
+    }
+  }
+
+  TDecompChol chol(fCov);
+  fPositiveDefinite = (fRank == (size_t) n && chol.Decompose());
+  if (fPositiveDefinite) {
+    fCholesky.ResizeTo(n, n);
+    fCholesky = chol.GetU();
+  }
+}
+
+
+double CovarianceModes::GetConditionNumber() const {
+  if (fRank < GetN() || fRank == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return fEigenvalues[0] / fEigenvalues[GetN() - 1];
+}
+
+
+size_t CovarianceModes::NModes(double fraction) const {
+  double trace = 0;
+  for (size_t k=0; k<fRank; k++) {
+    trace += fEigenvalues[k];
+  }
+
+  double sum = 0;
+  for (size_t k=0; k<fRank; k++) {
+    sum += fEigenvalues[k];
+    if (sum >= fraction * trace) {
+      return k + 1;
+    }
+  }
+
+  return fRank;
+}
+
+
+TMatrixD CovarianceModes::Modes(size_t n) const {
+  const size_t nrows = GetN();
+  n = std::min(n, fRank);
+
+  TMatrixD m(nrows, n);
+  for (size_t k=0; k<n; k++) {
+    double s = sqrt(fEigenvalues[k]);
+    for (size_t i=0; i<nrows; i++) {
+      m(i, k) = s * fEigenvectors(i, k);
+    }
+  }
+
+  return m;
+}
+
+
+std::vector<double> CovarianceModes::Packed() const {
+  const size_t n = GetN();
+  std::vector<double> p;
+  p.reserve(n * (n + 1) / 2);
+  for (size_t i=0; i<n; i++) {
+    for (size_t j=i; j<n; j++) {
+      p.push_back(fCov(i, j));
+    }
+  }
+  return p;
+}
+
+
+void CovarianceModes::Write(std::string name, double fraction) const {
+  fEigenvalues.Write(("eigval_" + name).c_str());
+
+  TMatrixD modes = Modes(NModes(fraction));
+  modes.Write(("modes_" + name).c_str());
+
+  std::vector<double> p = Packed();
+  TVectorD packed(p.size(), p.data());
+  packed.Write(("packed_" + name).c_str());
+
+  if (fPositiveDefinite) {
+    fCholesky.Write(("chol_" + name).c_str());
+  }
+
+  std::cout << "Covariance: " << name << ": rank " << fRank << "/" << GetN()
+            << ", condition number " << GetConditionNumber()
+            << ", " << modes.GetNcols() << " modes for "
+            << fraction * 100 << "% of variance"
+            << (fPositiveDefinite ? "" : ", not positive definite")
+            << std::endl;
+}
+
+}  // namespace util
+
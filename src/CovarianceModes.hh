@@ -0,0 +1,132 @@
+#ifndef __ts_CovarianceModes__
+#define __ts_CovarianceModes__
+
+/**
+ * \file CovarianceModes.hh
+ *
+ * Eigendecomposition and compressed forms of covariance matrices.
+ */
+
+#include <string>
+#include <vector>
+#include <TMatrixD.h>
+#include <TMatrixDSym.h>
+#include <TVectorD.h>
+
+class TH2D;
+
+namespace util {
+
+/**
+ * \class CovarianceModes
+ * \brief Symmetric eigendecomposition of a covariance matrix
+ *
+ * Decomposes V = Sum(lambda_k v_k v_k^T, k), with eigenvalues sorted in
+ * decreasing order, and also attempts a Cholesky factorization V = U^T U.
+ * Truncated principal components give a small set of orthogonal modes
+ * (columns sqrt(lambda_k) v_k) that reproduce a requested fraction of the
+ * total variance, for fits and toy generation against the modes rather
+ * than the full dense matrix.
+ */
+class CovarianceModes {
+public:
+  /**
+   * Constructor.
+   *
+   * \param cov The covariance matrix
+   * \param rtol Eigenvalues below rtol times the largest are treated as
+   *             zero when computing the rank and condition number
+   */
+  CovarianceModes(const TH2D* cov, double rtol=1e-12);
+
+  /**
+   * Constructor.
+   *
+   * \param cov The covariance matrix
+   * \param rtol Relative eigenvalue tolerance (see above)
+   */
+  CovarianceModes(const TMatrixDSym& cov, double rtol=1e-12);
+
+  /** Matrix dimension. */
+  size_t GetN() const { return fCov.GetNrows(); }
+
+  /** Eigenvalues, in decreasing order. */
+  const TVectorD& GetEigenvalues() const { return fEigenvalues; }
+
+  /** Eigenvectors, as columns matching GetEigenvalues(). */
+  const TMatrixD& GetEigenvectors() const { return fEigenvectors; }
+
+  /** Numerical rank (number of eigenvalues above tolerance). */
+  size_t GetRank() const { return fRank; }
+
+  /**
+   * Condition number: ratio of the largest to the smallest eigenvalue, or
+   * infinity if the matrix is rank deficient.
+   */
+  double GetConditionNumber() const;
+
+  /** True if the Cholesky factorization succeeded. */
+  bool IsPositiveDefinite() const { return fPositiveDefinite; }
+
+  /** Upper triangular Cholesky factor U (V = U^T U), if positive definite. */
+  const TMatrixD& GetCholesky() const { return fCholesky; }
+
+  /**
+   * Number of leading modes needed to keep a fraction of the variance.
+   *
+   * \param fraction Fraction of the trace to retain (0-1]
+   * \returns Number of modes
+   */
+  size_t NModes(double fraction) const;
+
+  /**
+   * Leading principal component modes.
+   *
+   * \param n Number of modes
+   * \returns An N x n matrix with columns sqrt(lambda_k) v_k
+   */
+  TMatrixD Modes(size_t n) const;
+
+  /**
+   * Packed symmetric storage: the upper triangle, row by row.
+   *
+   * \returns N(N+1)/2 values; element (i, j >= i) is at
+   *          i*N - i*(i-1)/2 + (j-i)
+   */
+  std::vector<double> Packed() const;
+
+  /**
+   * Write the decomposition to the current directory: eigenvalues
+   * (eigval_<name>), truncated modes (modes_<name>), packed matrix
+   * (packed_<name>) and, if available, the Cholesky factor (chol_<name>).
+   *
+   * \param name Suffix for object names
+   * \param fraction Fraction of the variance the written modes retain
+   */
+  void Write(std::string name, double fraction) const;
+
+  /**
+   * Convert a histogram covariance matrix to a symmetric matrix.
+   *
+   * \param cov The covariance matrix histogram
+   * \returns The matrix
+   */
+  static TMatrixDSym ToMatrix(const TH2D* cov);
+
+protected:
+  /** Compute the decompositions. */
+  void Decompose();
+
+  TMatrixDSym fCov;  //!< The covariance matrix
+  double fTolerance;  //!< Relative eigenvalue tolerance
+  TVectorD fEigenvalues;  //!< Eigenvalues, decreasing
+  TMatrixD fEigenvectors;  //!< Eigenvectors, as columns
+  size_t fRank;  //!< Numerical rank
+  bool fPositiveDefinite;  //!< Cholesky factorization succeeded
+  TMatrixD fCholesky;  //!< Upper triangular Cholesky factor
+};
+
+}  // namespace util
+
+#endif  // __ts_CovarianceModes__
+
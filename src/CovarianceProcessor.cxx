@@ -0,0 +1,89 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <TFile.h>
+#include <json/json.h>
+#include "Covariance.hh"
+#include "CovarianceProcessor.hh"
+#include "TruthSelection.hh"
+
+namespace ana {
+  namespace TruthSelection {
+
+CovarianceProcessor::CovarianceProcessor()
+    : ProcessorBase(), fCovariance(nullptr) {}
+
+
+CovarianceProcessor::~CovarianceProcessor() {
+  delete fCovariance;
+}
+
+
+void CovarianceProcessor::AddSelection(TruthSelection* selection) {
+  fSelections.push_back(selection);
+}
+
+
+void CovarianceProcessor::Initialize(Json::Value* config) {
+  assert(config && config->isMember("Covariance"));
+
+  fCovariance = new util::Covariance;
+  fCovariance->Configure(&(*config)["Covariance"]);
+  fCovariance->init(fOutputFile);
+}
+
+
+void CovarianceProcessor::Finalize() {
+  for (auto selection : fSelections) {
+    fCovariance->AddPOT(selection->GetSelectionType(), fPOT);
+  }
+
+  fOutputFile->cd();
+  fCovariance->Finish();
+
+  // Histograms belong to the output file, so release them before the file
+  // is closed
+  delete fCovariance;
+  fCovariance = nullptr;
+}
+
+
+void CovarianceProcessor::Checkpoint() {
+  std::string name = fOutputFilename;
+  std::string suffix = ".root";
+  if (name.size() > suffix.size() &&
+      name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+    name.erase(name.size() - suffix.size());
+  }
+
+  // Inputs without a configured POT use the exposure so far
+  for (auto selection : fSelections) {
+    fCovariance->AddPOT(selection->GetSelectionType(), fPOT);
+  }
+  fCovariance->WritePartial(name + ".partial.root");
+  for (auto selection : fSelections) {
+    fCovariance->AddPOT(selection->GetSelectionType(), -fPOT);
+  }
+
+  ProcessorBase::Checkpoint();
+}
+
+
+bool CovarianceProcessor::ProcessEvent(gallery::Event& ev) {
+  const std::string file = ev.getTFile()->GetName();
+  for (auto selection : fSelections) {
+    if (selection->GetPass()) {
+      fCovariance->Fill(selection->GetSelectionType(), file,
+                        *selection->GetEvent(),
+                        selection->GetRecoEnergy(),
+                        selection->GetSourceEntry());
+    }
+  }
+
+  return false;
+}
+
+  }  // namespace TruthSelection
+}  // namespace ana
+
@@ -0,0 +1,89 @@
+#ifndef __ts_ana_TruthSelection_CovarianceProcessor__
+#define __ts_ana_TruthSelection_CovarianceProcessor__
+
+/**
+ * \file CovarianceProcessor.hh
+ *
+ * In-process covariance accumulation for truth selections.
+ */
+
+#include <vector>
+#include "ProcessorBase.hh"
+
+namespace util {
+  class Covariance;
+}
+
+namespace ana {
+  namespace TruthSelection {
+
+class TruthSelection;
+
+/**
+ * \class CovarianceProcessor
+ * \brief Covariance matrices from selections running in the same block
+ *
+ * Runs after a set of TruthSelection processors in a ProcessorBlock, and
+ * passes each event they accept, with its reconstructed energy and
+ * weights, straight to a util::Covariance. Matrices are written to this
+ * processor's output file at Finalize, so no event trees need to be
+ * written and read back.
+ *
+ * The configuration holds a "Covariance" block in the usual format (see
+ * util::Covariance::Configure), where inputs name a "Selection" (the
+ * SelectionType of a TruthSelection) instead of "Files". Inputs without a
+ * "POT" use the exposure counted by the ProcessorBlock.
+ */
+class CovarianceProcessor : public core::ProcessorBase {
+public:
+  /** Constructor. */
+  CovarianceProcessor();
+
+  /** Destructor. */
+  ~CovarianceProcessor();
+
+  /**
+   * Add an upstream selection.
+   *
+   * The selection must be added to the ProcessorBlock before this
+   * processor, so it has processed each event first.
+   *
+   * \param selection The selection (not owned)
+   */
+  void AddSelection(TruthSelection* selection);
+
+  /**
+   * Initialization.
+   *
+   * \param config A configuration, as a JSON object
+   */
+  void Initialize(Json::Value* config=NULL);
+
+  /** Finalize and write the matrices to the output file. */
+  void Finalize();
+
+  /**
+   * Write the sums so far as a partial result, <output>.partial.root,
+   * since the matrices can only be computed once. The snapshot is turned
+   * into matrices with covariance-merge.
+   */
+  void Checkpoint();
+
+  /**
+   * Process one event.
+   *
+   * \param ev A single event, as a gallery::Event
+   * \return False, since no tree is written for this processor
+   */
+  bool ProcessEvent(gallery::Event& ev);
+
+protected:
+  util::Covariance* fCovariance;  //!< The covariance accumulator
+  std::vector<TruthSelection*> fSelections;  //!< Upstream selections
+};
+
+  }  // namespace TruthSelection
+}  // namespace ana
+
+#endif  // __ts_ana_TruthSelection_CovarianceProcessor__
+
@@ -0,0 +1,81 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <json/json.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <Covariance.hh>
+
+int main(int argc, char* argv[]) {
+  util::Covariance cov;
+
+  if (argc < 3) {
+    std::cout << "Usage: " << argv[0]
+              << " config.json partial.root [partial.root ...]" << std::endl
+              << std::endl
+              << "Then enter binnings as: SAMPLE EDGE0 EDGE1 ... EDGEN"
+              << std::endl;
+    return 1;
+  }
+
+  // Load the sample configuration, which must match the partials
+  Json::Value config;
+  std::ifstream configstream(argv[1], std::ifstream::binary);
+  Json::Reader reader;
+  if (!reader.parse(configstream, config)) {
+    std::cerr << "Error parsing configuration file " << argv[1] << std::endl;
+    return 2;
+  }
+
+  cov.Configure(&config);
+
+  for (int i=2; i<argc; i++) {
+    if (!cov.Merge(argv[i])) {
+      return 3;
+    }
+  }
+
+  // Read binnings from standard input, print the fractional errors
+  std::string line;
+  while (std::cout << "> " << std::flush, std::getline(std::cin, line)) {
+    std::istringstream ss(line);
+    std::string name;
+    if (!(ss >> name) || name == "quit") {
+      break;
+    }
+
+    std::vector<double> edges;
+    double e;
+    while (ss >> e) {
+      edges.push_back(e);
+    }
+
+    util::Covariance::EventSample* sample = cov.GetSample(name);
+    if (!sample || edges.size() < 2) {
+      std::cerr << "Need a sample name and at least two edges" << std::endl;
+      continue;
+    }
+
+    util::Covariance::EventSample* r = sample->Rebin(edges);
+    if (!r) {
+      continue;
+    }
+
+    TH2D* c = r->CovarianceMatrix();
+    for (int i=1; i<r->enu->GetNbinsX()+1; i++) {
+      double cv = r->enu->GetBinContent(i);
+      std::cout << Form("%10g %10g %12g %8.4f",
+                        edges[i - 1], edges[i], cv,
+                        cv > 0 ? sqrt(c->GetBinContent(i, i)) / cv : 0)
+                << std::endl;
+    }
+
+    delete r;
+  }
+
+  return 0;
+}
+
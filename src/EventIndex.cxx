@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <TDirectory.h>
+#include <TNamed.h>
+#include <TTree.h>
+#include "EventIndex.hh"
+
+namespace core {
+
+void EventIndex::Sort() {
+  if (!sorted) {
+    std::stable_sort(records.begin(), records.end());
+    sorted = true;
+  }
+}
+
+
+void EventIndex::Write(TDirectory* dir) {
+  Sort();
+  dir->cd();
+
+  Record r;
+  TTree* tree = new TTree("index", "Event index");
+  tree->Branch("run", &r.run);
+  tree->Branch("subrun", &r.subrun);
+  tree->Branch("event", &r.event);
+  tree->Branch("entry", &r.entry);
+  tree->Branch("file", &r.file);
+  tree->Branch("source_entry", &r.source_entry);
+
+  for (auto const& it : records) {
+    r = it;
+    tree->Fill();
+  }
+
+  tree->Write("index", TObject::kOverwrite);
+  delete tree;
+
+  std::string list;
+  for (size_t i=0; i<sources.size(); i++) {
+    list += (i > 0 ? "\n" : "") + sources[i];
+  }
+  TNamed names("index_sources", list.c_str());
+  names.Write("index_sources", TObject::kOverwrite);
+}
+
+
+bool EventIndex::Read(TDirectory* dir) {
+  TTree* tree = (TTree*) dir->Get("index");
+  if (!tree) {
+    return false;
+  }
+
+  Record r;
+  tree->SetBranchAddress("run", &r.run);
+  tree->SetBranchAddress("subrun", &r.subrun);
+  tree->SetBranchAddress("event", &r.event);
+  tree->SetBranchAddress("entry", &r.entry);
+  tree->SetBranchAddress("file", &r.file);
+  tree->SetBranchAddress("source_entry", &r.source_entry);
+
+  records.clear();
+  records.reserve(tree->GetEntries());
+  for (long i=0; i<tree->GetEntries(); i++) {
+    tree->GetEntry(i);
+    records.push_back(r);
+  }
+  delete tree;
+
+  // Written sorted, but sort anyway in case the index was merged
+  sorted = false;
+  Sort();
+
+  sources.clear();
+  TNamed* names = (TNamed*) dir->Get("index_sources");
+  if (names) {
+    std::string list = names->GetTitle();
+    for (size_t pos=0; !list.empty() && pos != std::string::npos; ) {
+      size_t next = list.find('\n', pos);
+      sources.push_back(list.substr(pos, next - pos));
+      pos = (next == std::string::npos ? next : next + 1);
+    }
+  }
+
+  return true;
+}
+
+
+const EventIndex::Record* EventIndex::Find(int run, int subrun, int event) {
+  Sort();
+
+  Record key;
+  key.run = run;
+  key.subrun = subrun;
+  key.event = event;
+
+  auto it = std::lower_bound(records.begin(), records.end(), key);
+  if (it == records.end() || key < *it) {
+    return nullptr;
+  }
+
+  return &(*it);
+}
+
+
+std::vector<std::pair<long, long> > EventIndex::Join(EventIndex& other) {
+  Sort();
+  other.Sort();
+
+  std::vector<std::pair<long, long> > matches;
+  auto a = records.begin();
+  auto b = other.records.begin();
+  while (a != records.end() && b != other.records.end()) {
+    if (*a < *b) {
+      ++a;
+    }
+    else if (*b < *a) {
+      ++b;
+    }
+    else {
+      matches.push_back({ a->entry, b->entry });
+      ++a;
+      ++b;
+    }
+  }
+
+  return matches;
+}
+
+}  // namespace core
+
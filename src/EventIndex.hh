@@ -0,0 +1,115 @@
+#ifndef __ts_core_EventIndex__
+#define __ts_core_EventIndex__
+
+/**
+ * \file EventIndex.hh
+ *
+ * A sorted (run, subrun, event) index for output trees.
+ */
+
+#include <string>
+#include <vector>
+
+class TDirectory;
+
+namespace core {
+
+/**
+ * \class core::EventIndex
+ * \brief Maps event IDs to output tree entries and their source events
+ *
+ * Entries are added as events are written and sorted by (run, subrun,
+ * event) before writing, so lookups are binary searches and two indices can
+ * be joined with a single merge pass. Each record also holds the index of
+ * the source art file and the entry within it, so the original event can
+ * be re-read directly.
+ *
+ * The index is stored as a TTree "index" with branches run, subrun, event,
+ * entry, file and source_entry, and the source file paths as a TNamed
+ * "index_sources" (newline-separated).
+ */
+class EventIndex {
+public:
+  /**
+   * \struct EventIndex::Record
+   * \brief The location of one event
+   */
+  struct Record {
+    int run;  //!< Run number
+    int subrun;  //!< Subrun number
+    int event;  //!< Event number
+    long entry;  //!< Entry in the output tree
+    int file;  //!< Index of the source file
+    long source_entry;  //!< Entry in the source file
+
+    /** Order by event ID. */
+    bool operator<(const Record& o) const {
+      if (run != o.run) return run < o.run;
+      if (subrun != o.subrun) return subrun < o.subrun;
+      return event < o.event;
+    }
+  };
+
+  /** Constructor. */
+  EventIndex() : sorted(true) {}
+
+  /**
+   * Add an event.
+   *
+   * \param r The record
+   */
+  void Add(const Record& r) { records.push_back(r); sorted = false; }
+
+  /** Set the source file paths. */
+  void SetSources(const std::vector<std::string>& _sources) {
+    sources = _sources;
+  }
+
+  /** Sort the records by event ID. */
+  void Sort();
+
+  /**
+   * Write the index to a directory.
+   *
+   * \param dir The directory (e.g. the output file)
+   */
+  void Write(TDirectory* dir);
+
+  /**
+   * Read an index from a directory.
+   *
+   * \param dir The directory
+   * \returns True if an index was found
+   */
+  bool Read(TDirectory* dir);
+
+  /**
+   * Look up an event.
+   *
+   * \param run Run number
+   * \param subrun Subrun number
+   * \param event Event number
+   * \returns The record, or null if the event is not indexed
+   */
+  const Record* Find(int run, int subrun, int event);
+
+  /**
+   * Join with another index on event ID.
+   *
+   * \param other The other index
+   * \returns Pairs of matching output tree entries (this, other)
+   */
+  std::vector<std::pair<long, long> > Join(EventIndex& other);
+
+  /** Number of records. */
+  size_t size() const { return records.size(); }
+
+  std::vector<Record> records;  //!< Event records
+  std::vector<std::string> sources;  //!< Source file paths
+  bool sorted;  //!< Records are sorted
+};
+
+}  // namespace core
+
+#endif  // __ts_core_EventIndex__
+
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "FileWatcher.hh"
+
+namespace core {
+
+volatile sig_atomic_t FileWatcher::fStop = 0;
+
+
+FileWatcher::FileWatcher(const std::string& path, const std::string& suffix)
+    : fPath(path), fSuffix(suffix), fIsList(false), fStarted(false),
+      fNotify(-1), fListOffset(0) {
+  std::string list_suffix = ".list";
+  fIsList = (path.size() > list_suffix.size() &&
+             std::equal(list_suffix.rbegin(), list_suffix.rend(),
+                        path.rbegin()));
+
+  // Lists are checked for growth at each poll; directories are watched
+  // for files closed after writing or moved in
+#ifdef __linux__
+  if (!fIsList) {
+    fNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fNotify >= 0 &&
+        inotify_add_watch(fNotify, path.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      std::cerr << "FileWatcher: Unable to watch " << path << ": "
+                << strerror(errno) << ", polling instead" << std::endl;
+      close(fNotify);
+      fNotify = -1;
+    }
+  }
+#endif
+}
+
+
+FileWatcher::~FileWatcher() {
+  if (fNotify >= 0) {
+    close(fNotify);
+  }
+}
+
+
+std::vector<std::string> FileWatcher::Poll(int timeout) {
+  std::vector<std::string> files;
+
+  // Report the initial contents without waiting
+  if (!fStarted) {
+    fStarted = true;
+    if (fIsList) {
+      ReadList(files);
+    }
+    else {
+      ScanDirectory(files);
+    }
+    if (!files.empty()) {
+      return files;
+    }
+  }
+
+  if (Stopped()) {
+    return files;
+  }
+
+  if (fNotify < 0) {
+    // Wait (returning early on a signal), then look for changes
+    poll(nullptr, 0, timeout);
+    if (fIsList) {
+      ReadList(files);
+    }
+    else {
+      ScanDirectory(files);
+    }
+    return files;
+  }
+
+#ifdef __linux__
+  struct pollfd pfd = { fNotify, POLLIN, 0 };
+  if (poll(&pfd, 1, timeout) <= 0) {
+    return files;
+  }
+
+  alignas(struct inotify_event) char buffer[4096];
+  ssize_t len;
+  bool overflow = false;
+  while ((len = read(fNotify, buffer, sizeof(buffer))) > 0) {
+    for (char* p=buffer; p<buffer+len; ) {
+      struct inotify_event* event = (struct inotify_event*) p;
+      if (event->mask & IN_Q_OVERFLOW) {
+        overflow = true;
+      }
+      else if (event->len > 0) {
+        std::string path = fPath + "/" + event->name;
+        if (IsNew(path)) {
+          fSeen.insert(path);
+          files.push_back(path);
+        }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  // Events were dropped, so look at the whole directory
+  if (overflow) {
+    ScanDirectory(files);
+  }
+#endif
+
+  return files;
+}
+
+
+bool FileWatcher::IsNew(const std::string& name) const {
+  return (name.size() >= fSuffix.size() &&
+          std::equal(fSuffix.rbegin(), fSuffix.rend(), name.rbegin()) &&
+          fSeen.find(name) == fSeen.end());
+}
+
+
+void FileWatcher::ScanDirectory(std::vector<std::string>& files) {
+  DIR* dir = opendir(fPath.c_str());
+  if (!dir) {
+    std::cerr << "FileWatcher: Unable to read " << fPath << ": "
+              << strerror(errno) << std::endl;
+    return;
+  }
+
+  std::vector<std::string> found;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string path = fPath + "/" + entry->d_name;
+    struct stat st;
+    if (IsNew(path) && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      found.push_back(path);
+    }
+  }
+  closedir(dir);
+
+  std::sort(found.begin(), found.end());
+  for (auto const& path : found) {
+    fSeen.insert(path);
+    files.push_back(path);
+  }
+}
+
+
+void FileWatcher::ReadList(std::vector<std::string>& files) {
+  struct stat st;
+  if (stat(fPath.c_str(), &st) != 0) {
+    return;  // Not created yet
+  }
+
+  // A shorter list was replaced, so read it again (skipping files seen)
+  if (st.st_size < fListOffset) {
+    fListOffset = 0;
+  }
+  if (st.st_size == fListOffset) {
+    return;
+  }
+
+  std::ifstream list(fPath);
+  list.seekg(fListOffset);
+  std::string text((std::istreambuf_iterator<char>(list)),
+                   std::istreambuf_iterator<char>());
+
+  // Only complete lines; the rest is read once its newline is written
+  size_t end = text.rfind('\n');
+  if (end == std::string::npos) {
+    return;
+  }
+  fListOffset += end + 1;
+
+  std::istringstream lines(text.substr(0, end));
+  std::string path;
+  while (lines >> path) {
+    if (fSeen.insert(path).second) {
+      files.push_back(path);
+    }
+  }
+}
+
+}  // namespace core
@@ -0,0 +1,94 @@
+#ifndef __ts_core_FileWatcher__
+#define __ts_core_FileWatcher__
+
+/**
+ * \file FileWatcher.hh
+ *
+ * Discovery of input files as they arrive.
+ */
+
+#include <csignal>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace core {
+
+/**
+ * \class core::FileWatcher
+ * \brief Reports new files in a directory or appended to a file list
+ *
+ * For a directory, files with the given suffix are reported once they are
+ * closed after writing or moved into the directory (using inotify, on
+ * Linux), so producers should write each file in place or move it in
+ * when complete. Elsewhere, the directory is rescanned at each poll.
+ *
+ * For a file list (a path ending in ".list"), complete lines appended to
+ * the list are reported; producers should add a path only once the file
+ * is complete.
+ *
+ * Files present when watching starts are reported by the first poll, in
+ * name (or list) order.
+ */
+class FileWatcher {
+public:
+  /**
+   * Constructor.
+   *
+   * \param path The directory or file list to watch
+   * \param suffix Only report files with this suffix (directories only)
+   */
+  FileWatcher(const std::string& path, const std::string& suffix=".root");
+
+  /** Destructor. */
+  virtual ~FileWatcher();
+
+  /**
+   * Wait for new files.
+   *
+   * \param timeout The maximum time to wait, in milliseconds
+   * \returns The new files, possibly none
+   */
+  std::vector<std::string> Poll(int timeout);
+
+  /** The watched path. */
+  const std::string& GetPath() const { return fPath; }
+
+  /** Request that watching stop; safe to call from a signal handler. */
+  static void Stop() { fStop = 1; }
+
+  /** True if a stop has been requested. */
+  static bool Stopped() { return fStop != 0; }
+
+protected:
+  /**
+   * List the directory, reporting files not yet seen.
+   *
+   * \param files New files are appended here
+   */
+  void ScanDirectory(std::vector<std::string>& files);
+
+  /**
+   * Read complete lines appended to the list since the last read.
+   *
+   * \param files New files are appended here
+   */
+  void ReadList(std::vector<std::string>& files);
+
+  /** True if a file name has the suffix and has not been reported. */
+  bool IsNew(const std::string& name) const;
+
+  std::string fPath;  //!< Directory or file list path
+  std::string fSuffix;  //!< Suffix of reported files
+  bool fIsList;  //!< Watching a file list
+  bool fStarted;  //!< The initial contents were reported
+  int fNotify;  //!< inotify descriptor (-1 if unused)
+  long fListOffset;  //!< Bytes of the list already read
+  std::set<std::string> fSeen;  //!< Files already reported
+
+  static volatile sig_atomic_t fStop;  //!< Stop requested
+};
+
+}  // namespace core
+
+#endif  // __ts_core_FileWatcher__
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TFile.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TTree.h"
+#include "json/json.h"
+#include "ChiSquare.hh"
+#include "Covariance.hh"
+#include "GridScan.hh"
+#include "Event.hh"
+
+namespace util {
+
+GridScan::GridScan()
+    : fOutputFile("scan.root"), fExposure(0), fBaseline(0.47), fThreads(1),
+      fNbins(0) {
+  for (size_t i=0; i<kNParameters; i++) {
+    fNull[i] = 0;
+  }
+}
+
+
+std::vector<double> GridScan::ParseAxis(const Json::Value& axis, double def) {
+  std::vector<double> v;
+
+  if (axis.isNull()) {
+    v.push_back(def);
+  }
+  else if (axis.isMember("Values")) {
+    for (auto const& x : axis["Values"]) {
+      v.push_back(x.asDouble());
+    }
+  }
+  else {
+    size_t n = axis.get("Points", 1).asUInt();
+    double lo = axis.get("Min", def).asDouble();
+    double hi = axis.get("Max", def).asDouble();
+    bool log = axis.get("Log", false).asBool();
+    for (size_t i=0; i<n; i++) {
+      double f = (n > 1 ? 1.0 * i / (n - 1) : 0);
+      v.push_back(log ? lo * pow(hi / lo, f) : lo + (hi - lo) * f);
+    }
+  }
+
+  assert(!v.empty());
+  return v;
+}
+
+
+void GridScan::Configure(Json::Value* config) {
+  assert(config);
+
+  fOutputFile = config->get("OutputFile", fOutputFile).asString();
+  fCovarianceFile = (*config)["CovarianceFile"].asString();
+  fExposure = config->get("ExposurePOT", 0.0).asDouble();
+  fBaseline = config->get("Baseline", fBaseline).asDouble();
+  fThreads = config->get("Threads", 0).asUInt();
+  if (fThreads == 0) {
+    fThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  Json::Value defbins;
+  defbins["Bins"] = 300;
+  defbins["Min"] = 0.0;
+  defbins["Max"] = 3000.0;
+  fTrueEdges = Covariance::ParseBinning(config->get("TrueBinning", defbins));
+
+  fNbins = 0;
+  for (auto const& sc : (*config)["Samples"]) {
+    fSampleNames.push_back(sc["Name"].asString());
+    fRecoEdges.push_back(Covariance::ParseBinning(sc["Binning"]));
+    fOffsets.push_back(fNbins);
+    fNbins += fRecoEdges.back().size() - 1;
+
+    for (auto const& cc : sc["Components"]) {
+      Component c;
+      c.sample = fSampleNames.size() - 1;
+      c.pot = cc.get("POT", 0.0).asDouble();
+      c.cut = Covariance::Selection(cc["Cut"]);
+      c.signal = cc.get("Signal", false).asBool();
+
+      std::string mode = cc.get("Oscillation", "none").asString();
+      if (mode == "disappearance") {
+        c.mode = kDisappearance;
+      }
+      else if (mode == "appearance") {
+        c.mode = kAppearance;
+      }
+      else if (mode == "none") {
+        c.mode = kNone;
+      }
+      else {
+        std::cerr << "GridScan: Unknown oscillation mode \"" << mode << "\""
+                  << std::endl;
+        assert(false);
+      }
+
+      for (auto const& f : cc["Files"]) {
+        c.files.push_back(f.asString());
+      }
+
+      c.response.resize((fTrueEdges.size() - 1) *
+                        (fRecoEdges.back().size() - 1), 0);
+
+      fComponents.push_back(c);
+    }
+  }
+
+  const Json::Value& grid = (*config)["Grid"];
+  fAxes[kSin22Theta] = ParseAxis(grid["Sin22Theta"], 0);
+  fAxes[kDeltaM2] = ParseAxis(grid["DeltaM2"], 0);
+  fAxes[kMu] = ParseAxis(grid["Mu"], 0);
+
+  const Json::Value& null = (*config)["Null"];
+  fNull[kSin22Theta] = null.get("Sin22Theta", 0.0).asDouble();
+  fNull[kDeltaM2] = null.get("DeltaM2", 0.0).asDouble();
+  fNull[kMu] = null.get("Mu", 0.0).asDouble();
+}
+
+
+void GridScan::Fill() {
+  // Group components by file, so each file is read exactly once
+  std::vector<std::string> files;
+  std::map<std::string, std::vector<Component*> > consumers;
+  for (auto& c : fComponents) {
+    for (auto const& f : c.files) {
+      if (consumers.find(f) == consumers.end()) {
+        files.push_back(f);
+      }
+      consumers[f].push_back(&c);
+    }
+  }
+
+  const size_t ntrue = fTrueEdges.size() - 1;
+
+  for (size_t ii=0; ii<files.size(); ii++) {
+    const std::vector<Component*>& targets = consumers[files[ii]];
+
+    TFile f(files[ii].c_str());
+    TTree* _tree = (TTree*) f.Get("tsana");
+    assert(_tree);
+
+    Event* event = new Event;
+    double reco_e;
+    _tree->SetBranchAddress("events", &event);
+    _tree->SetBranchAddress("reco_e", &reco_e);
+
+    for (long k=0; k<_tree->GetEntries(); k++) {
+      _tree->GetEntry(k);
+
+      if (event->ninteractions == 0) {
+        continue;
+      }
+
+      double etrue = event->interactions[0].neutrino.energy * 1000;
+      size_t t = std::upper_bound(fTrueEdges.begin(), fTrueEdges.end(),
+                                  etrue) - fTrueEdges.begin();
+      if (t == 0 || t > ntrue) {
+        continue;
+      }
+
+      for (auto c : targets) {
+        if (!c->cut.Pass(*event)) {
+          continue;
+        }
+
+        const std::vector<double>& edges = fRecoEdges[c->sample];
+        size_t r = std::upper_bound(edges.begin(), edges.end(),
+                                    reco_e) - edges.begin();
+        if (r == 0 || r > edges.size() - 1) {
+          continue;
+        }
+
+        double fs = (fExposure > 0 && c->pot > 0 ? fExposure / c->pot : 1.0);
+        c->response[(t - 1) * (edges.size() - 1) + (r - 1)] += fs;
+      }
+    }
+
+    delete event;
+  }
+}
+
+
+void GridScan::Predict(const double* params, double* pred,
+                       double* prob) const {
+  const size_t ntrue = fTrueEdges.size() - 1;
+
+  // Appearance probability at each true bin center
+  for (size_t t=0; t<ntrue; t++) {
+    double e = 0.5 * (fTrueEdges[t] + fTrueEdges[t + 1]) / 1000;  // GeV
+    double s = sin(1.27 * params[kDeltaM2] * fBaseline / e);
+    prob[t] = params[kSin22Theta] * s * s;
+  }
+
+  std::fill(pred, pred + fNbins, 0.0);
+
+  for (auto const& c : fComponents) {
+    const size_t nreco = fRecoEdges[c.sample].size() - 1;
+    double* out = pred + fOffsets[c.sample];
+    double norm = (c.signal ? params[kMu] : 1.0);
+
+    for (size_t t=0; t<ntrue; t++) {
+      double f = norm;
+      if (c.mode == kDisappearance) {
+        f *= 1 - prob[t];
+      }
+      else if (c.mode == kAppearance) {
+        f *= prob[t];
+      }
+
+      const double* row = c.response.data() + t * nreco;
+      for (size_t r=0; r<nreco; r++) {
+        out[r] += f * row[r];
+      }
+    }
+  }
+}
+
+
+size_t GridScan::GetNpoints() const {
+  size_t n = 1;
+  for (size_t i=0; i<kNParameters; i++) {
+    n *= fAxes[i].size();
+  }
+  return n;
+}
+
+
+void GridScan::GetPoint(size_t i, double* params) const {
+  for (size_t j=0; j<kNParameters; j++) {
+    params[j] = fAxes[j][i % fAxes[j].size()];
+    i /= fAxes[j].size();
+  }
+}
+
+
+bool GridScan::Scan() {
+  // Joint covariance, applied as a fractional matrix
+  TFile f(fCovarianceFile.c_str());
+  TH1D* hg = (TH1D*) f.Get("hg");
+  TH2D* gcov = (TH2D*) f.Get("cov");
+  if (!hg || !gcov || (size_t) hg->GetNbinsX() != fNbins) {
+    std::cerr << "GridScan: No joint covariance with " << fNbins
+              << " bins in " << fCovarianceFile << std::endl;
+    return false;
+  }
+
+  std::vector<double> prob(fTrueEdges.size() - 1);
+  std::vector<double> null(fNbins);
+  Predict(fNull, null.data(), prob.data());
+
+  // Empty bins would give zero rows and columns, so only bins with a
+  // null prediction are fit
+  std::vector<size_t> bins;
+  for (size_t i=0; i<fNbins; i++) {
+    if (null[i] > 0) {
+      bins.push_back(i);
+    }
+  }
+  const size_t nfit = bins.size();
+  if (nfit < fNbins) {
+    std::cout << "GridScan: Skipping " << fNbins - nfit << " of " << fNbins
+              << " bins with no events at the null point" << std::endl;
+  }
+
+  std::vector<double> data(nfit);
+  std::vector<double> cov(nfit * nfit, 0);
+  for (size_t a=0; a<nfit; a++) {
+    size_t i = bins[a];
+    data[a] = null[i];
+    double hi = hg->GetBinContent(i + 1);
+    for (size_t b=0; b<nfit; b++) {
+      size_t j = bins[b];
+      double hj = hg->GetBinContent(j + 1);
+      if (hi > 0 && hj > 0) {
+        double frac = gcov->GetBinContent(i + 1, j + 1) / (hi * hj);
+        cov[a * nfit + b] = frac * null[i] * null[j];
+      }
+    }
+  }
+
+  ChiSquare chi2(data, cov, data);
+  if (nfit == 0 || !chi2.IsValid()) {
+    std::cerr << "GridScan: Unable to factorize the covariance" << std::endl;
+    return false;
+  }
+
+  // Workers take blocks of grid points until none are left
+  const size_t npoints = GetNpoints();
+  const size_t kBlock = 256;
+  fChi2.resize(npoints);
+  std::atomic<size_t> next(0);
+
+  auto worker = [&]() {
+    std::vector<double> pred(fNbins);
+    std::vector<double> preds(kBlock * nfit);
+    std::vector<double> wprob(fTrueEdges.size() - 1);
+    double params[kNParameters];
+
+    for (size_t p0=next.fetch_add(kBlock); p0<npoints;
+         p0=next.fetch_add(kBlock)) {
+      size_t m = std::min(kBlock, npoints - p0);
+      for (size_t p=0; p<m; p++) {
+        GetPoint(p0 + p, params);
+        Predict(params, pred.data(), wprob.data());
+        for (size_t a=0; a<nfit; a++) {
+          preds[p * nfit + a] = pred[bins[a]];
+        }
+      }
+      chi2.Evaluate(preds.data(), m, fChi2.data() + p0);
+    }
+  };
+
+  std::cout << "GridScan: Scanning " << npoints << " points with "
+            << fThreads << " threads" << std::endl;
+
+  std::vector<std::thread> threads;
+  for (size_t i=0; i<fThreads; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  return true;
+}
+
+
+void GridScan::Write() {
+  TFile f(fOutputFile.c_str(), "recreate");
+
+  double params[kNParameters];
+  double chi2;
+  TTree* t = new TTree("scan", "Grid scan");
+  t->Branch("sin22theta", &params[kSin22Theta], "sin22theta/D");
+  t->Branch("dm2", &params[kDeltaM2], "dm2/D");
+  t->Branch("mu", &params[kMu], "mu/D");
+  t->Branch("chi2", &chi2, "chi2/D");
+
+  size_t imin = 0;
+  for (size_t i=0; i<fChi2.size(); i++) {
+    GetPoint(i, params);
+    chi2 = fChi2[i];
+    t->Fill();
+    if (fChi2[i] < fChi2[imin]) {
+      imin = i;
+    }
+  }
+
+  t->Write();
+  f.Close();
+
+  if (!fChi2.empty()) {
+    GetPoint(imin, params);
+    std::cout << "GridScan: Minimum chi2 " << fChi2[imin]
+              << " at sin22theta=" << params[kSin22Theta]
+              << " dm2=" << params[kDeltaM2]
+              << " mu=" << params[kMu] << std::endl;
+  }
+}
+
+}  // namespace util
+
@@ -0,0 +1,174 @@
+#ifndef __ts_GridScan__
+#define __ts_GridScan__
+
+/**
+ * \file GridScan.hh
+ *
+ * Oscillation and signal strength grid scans.
+ */
+
+#include <string>
+#include <vector>
+#include "Covariance.hh"
+
+namespace Json {
+  class Value;
+}
+
+namespace util {
+
+/**
+ * \class GridScan
+ * \brief Parallel chi-square scan over oscillation/signal parameters
+ *
+ * Events from selected trees are read once into per-component response
+ * matrices R[t][r] (true energy bin t to reco bin r, POT scaled). The
+ * prediction at a grid point is then Sum(R[t][r] * f(E_t)) over components,
+ * where f is the oscillation probability at the true bin center, or the
+ * signal strength for signal components. Chi-squares against the (fractional)
+ * covariance from a Covariance output are computed with ChiSquare, with the
+ * grid spread across threads.
+ *
+ * The parameters are sin^2(2 theta), Delta m^2 [eV^2] and the signal
+ * strength mu, for a two-flavor short-baseline approximation:
+ *
+ *   P_dis = 1 - sin^2(2 theta) sin^2(1.27 Delta m^2 L / E)
+ *   P_app = sin^2(2 theta) sin^2(1.27 Delta m^2 L / E)
+ */
+class GridScan {
+public:
+  /** Oscillation treatment of a component. */
+  enum OscillationMode { kNone, kDisappearance, kAppearance };
+
+  /** Parameter indices. */
+  enum Parameter { kSin22Theta, kDeltaM2, kMu, kNParameters };
+
+  /**
+   * \class GridScan::Component
+   * \brief One set of input files contributing to one sample
+   */
+  class Component {
+    public:
+      /** Constructor. */
+      Component() : sample(0), pot(0), mode(kNone), signal(false) {}
+
+      size_t sample;  //!< Sample index
+      std::vector<std::string> files;  //!< Input file paths
+      double pot;  //!< Exposure of the input files (0 if unknown)
+      Covariance::Selection cut;  //!< Membership cut
+      OscillationMode mode;  //!< Oscillation treatment
+      bool signal;  //!< Scaled by the signal strength
+      std::vector<double> response;  //!< Scaled R[t * nreco + r]
+  };
+
+  /** Constructor. */
+  GridScan();
+
+  /**
+   * Configure the scan.
+   *
+   * Example:
+   *
+   *     {
+   *       "OutputFile": "scan.root",
+   *       "CovarianceFile": "cov.root",
+   *       "ExposurePOT": 6.6e20,
+   *       "Baseline": 0.47,
+   *       "Threads": 8,
+   *       "TrueBinning": { "Bins": 300, "Min": 0, "Max": 3000 },
+   *       "Samples": [{
+   *         "Name": "nue",
+   *         "Binning": { "Bins": 25, "Min": 0, "Max": 3000 },
+   *         "Components": [
+   *           { "Files": ["nue_1e1p.root"], "POT": 5.03e22,
+   *             "Oscillation": "disappearance" },
+   *           { "Files": ["signal_1e1p.root"], "POT": 8.81e20,
+   *             "Signal": true }
+   *         ]
+   *       }],
+   *       "Grid": {
+   *         "Sin22Theta": { "Points": 100, "Min": 1e-3, "Max": 1, "Log": true },
+   *         "DeltaM2": { "Points": 100, "Min": 1e-2, "Max": 100, "Log": true },
+   *         "Mu": { "Values": [0] }
+   *       }
+   *     }
+   *
+   * Samples must be in the same order and binning as the joint covariance
+   * (hg/cov) in CovarianceFile, which is applied as a fractional matrix.
+   * Cuts are as for Covariance inputs. The reference spectrum is the
+   * prediction at the "Null" point (default: no oscillation, mu = 0).
+   * Energies are in MeV and the baseline in km.
+   *
+   * \param config The configuration as a JSON object
+   */
+  void Configure(Json::Value* config);
+
+  /** Read the inputs and build the response matrices. */
+  void Fill();
+
+  /**
+   * Compute the chi-square at every grid point.
+   *
+   * Reco bins with no events at the null point carry no statistical or
+   * systematic error, so they are left out of the chi-square.
+   *
+   * \returns False if the covariance cannot be factorized
+   */
+  bool Scan();
+
+  /** Write the scan results as a tree and report the minimum. */
+  void Write();
+
+  /**
+   * Compute the prediction at a parameter point.
+   *
+   * \param params Parameter values (kNParameters)
+   * \param pred Output prediction (total reco bins)
+   * \param prob Scratch space (true bins)
+   */
+  void Predict(const double* params, double* pred, double* prob) const;
+
+  /** Total number of reco bins over all samples. */
+  size_t GetNbins() const { return fNbins; }
+
+  /** Number of grid points. */
+  size_t GetNpoints() const;
+
+  /**
+   * Parameter values at a grid point.
+   *
+   * \param i Grid point index
+   * \param params Output parameter values (kNParameters)
+   */
+  void GetPoint(size_t i, double* params) const;
+
+protected:
+  /**
+   * Parse a grid axis: {"Values": [...]} or {"Points", "Min", "Max", "Log"}.
+   *
+   * \param axis The JSON axis definition
+   * \param def Default value if the axis is absent
+   * \returns The axis values
+   */
+  static std::vector<double> ParseAxis(const Json::Value& axis, double def);
+
+  std::string fOutputFile;  //!< Output file
+  std::string fCovarianceFile;  //!< Covariance output with hg/cov
+  double fExposure;  //!< Target exposure (POT) for scaling, 0 for none
+  double fBaseline;  //!< Baseline [km]
+  size_t fThreads;  //!< Number of worker threads
+  std::vector<std::string> fSampleNames;  //!< Sample names
+  std::vector<std::vector<double> > fRecoEdges;  //!< Reco bins per sample
+  std::vector<size_t> fOffsets;  //!< First joint bin of each sample
+  size_t fNbins;  //!< Total reco bins
+  std::vector<double> fTrueEdges;  //!< True energy bin edges [MeV]
+  std::vector<Component> fComponents;  //!< Inputs
+  std::vector<double> fAxes[kNParameters];  //!< Grid axis values
+  double fNull[kNParameters];  //!< Null hypothesis parameters
+  std::vector<double> fChi2;  //!< Chi-square at each grid point
+};
+
+}  // namespace util
+
+#endif  // __ts_GridScan__
+
@@ -0,0 +1,41 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <json/json.h>
+#include <GridScan.hh>
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cout << "Usage: " << argv[0] << " config.json" << std::endl;
+    return 1;
+  }
+
+  Json::Value config;
+  std::ifstream configstream(argv[1], std::ifstream::binary);
+  Json::Reader reader;
+  if (!reader.parse(configstream, config)) {
+    std::cerr << "Error parsing configuration file " << argv[1] << std::endl;
+    return 2;
+  }
+
+  util::GridScan scan;
+  scan.Configure(&config);
+
+  std::cout << "Filling responses... " << std::endl;
+  scan.Fill();
+
+  auto t0 = std::chrono::steady_clock::now();
+  if (!scan.Scan()) {
+    return 3;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  double dt = std::chrono::duration<double>(t1 - t0).count();
+  std::cout << "Scanned " << scan.GetNpoints() << " points in " << dt
+            << " s (" << scan.GetNpoints() / dt << " points/s)" << std::endl;
+
+  scan.Write();
+
+  return 0;
+}
+
@@ -1,27 +1,95 @@
+#include <algorithm>
+#include <cassert>
 #include <fstream>
 #include <iostream>
 #include <cstdio>
+#include <csignal>
 #include <cstdlib>
 #include <map>
 #include <vector>
+#include <getopt.h>
 #include <json/json.h>
 #include <ProcessorBase.hh>
 #include <ProcessorBlock.hh>
+#include <Catalog.hh>
+#include <FileWatcher.hh>
+#include <SkimList.hh>
 #include <TruthSelection.hh>
+#include <CovarianceProcessor.hh>
 #include <Config.hh>
 
+/** End a stream cleanly on SIGINT or SIGTERM. */
+static void StopStream(int) {
+  core::FileWatcher::Stop();
+}
+
+
 int main(int argc, char* argv[]) {
   // Parse command line arguments
   std::vector<char*> config_names;
+  std::string skim_name;
+  unsigned int skim_mask = ~0u;
+  size_t shard = 0, nshards = 1;
+  long skip = 0, max_events = -1;
+  unsigned int prescale = 1;
+  size_t nthreads = 1;
+  std::string watch_path;
+  double checkpoint = 10, idle = 0;
+
+  enum { kShard = 256, kSkip, kMaxEvents, kPrescale, kCheckpoint, kIdle };
+  static struct option long_options[] = {
+    { "shard", required_argument, NULL, kShard },
+    { "skip", required_argument, NULL, kSkip },
+    { "max-events", required_argument, NULL, kMaxEvents },
+    { "prescale", required_argument, NULL, kPrescale },
+    { "checkpoint", required_argument, NULL, kCheckpoint },
+    { "idle", required_argument, NULL, kIdle },
+    { NULL, 0, NULL, 0 }
+  };
 
   int c;
-  while ((c=getopt(argc, argv, "c:")) != -1) {
+  while ((c=getopt_long(argc, argv, "c:s:m:j:w:", long_options, NULL)) != -1) {
     switch (c) {
+      case kShard:
+        if (sscanf(optarg, "%zu/%zu", &shard, &nshards) != 2 ||
+            nshards < 1 || shard >= nshards) {
+          fprintf(stderr, "Invalid shard `%s', expected i/N.\n", optarg);
+          return 1;
+        }
+        break;
+      case kSkip:
+        skip = strtol(optarg, NULL, 10);
+        break;
+      case kMaxEvents:
+        max_events = strtol(optarg, NULL, 10);
+        break;
+      case kPrescale:
+        prescale = std::max(1L, strtol(optarg, NULL, 10));
+        break;
+      case kCheckpoint:
+        checkpoint = strtod(optarg, NULL);
+        break;
+      case kIdle:
+        idle = strtod(optarg, NULL);
+        break;
       case 'c':
         config_names.push_back(optarg);
         break;
+      case 's':
+        skim_name = optarg;
+        break;
+      case 'm':
+        skim_mask = strtoul(optarg, NULL, 0);
+        break;
+      case 'j':
+        nthreads = std::max(1L, strtol(optarg, NULL, 10));
+        break;
+      case 'w':
+        watch_path = optarg;
+        break;
       case '?':
-        if (optopt == 'c')
+        if (optopt == 'c' || optopt == 's' || optopt == 'm' ||
+            optopt == 'j' || optopt == 'w')
           fprintf(stderr, "Option -%c requires an argument.\n", optopt);
         else if (isprint(optopt))
           fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -33,24 +101,67 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  if (argc - optind < 1) {
+  if (argc - optind < 1 && skim_name.empty() && watch_path.empty()) {
     std::cout << "Usage: " << argv[0] << " [-c [Config]] "
-              << "INPUTDEF [...]" << std::endl;
+              << "INPUTDEF [...]" << std::endl
+              << "       " << argv[0] << " [-c [Config]] "
+              << "-s SKIMFILE [-m MASK]" << std::endl
+              << "       " << argv[0] << " [-c [Config]] "
+              << "-w DIRECTORY|LIST [--checkpoint SEC] [--idle SEC]"
+              << std::endl
+              << "Options: -j NTHREADS --shard i/N --skip N "
+              << "--max-events N --prescale N" << std::endl;
     return 0;
   }
 
   // Process input file definition
-  std::string filedef = argv[optind];
+  std::string filedef = optind < argc ? argv[optind] : "";
   std::string list_suffix = ".list";
   std::vector<std::string> filenames;
+  std::vector<long> entries;
+  core::SkimList skim;
 
-  if (std::equal(list_suffix.rbegin(), list_suffix.rend(), filedef.rbegin())) {
+  if (!watch_path.empty()) {
+    // Files are found by the FileWatcher as they arrive
+  }
+  else if (!skim_name.empty()) {
+    // Skim list written by an earlier job
+    if (!skim.Read(skim_name)) {
+      std::cerr << "No skim list in " << skim_name << std::endl;
+      return 1;
+    }
+    filenames = skim.sources;
+  }
+  else if (std::equal(list_suffix.rbegin(), list_suffix.rend(), filedef.rbegin())) {
     // File list
     std::ifstream infile(filedef);
     std::string filename;
     while (infile >> filename) {
       filenames.push_back(filename);
     }
+
+    // Use the pre-scanned catalog, if any, to drop unreadable files and
+    // to divide events without opening every file
+    core::Catalog catalog;
+    std::string catalog_name = core::Catalog::CatalogName(filedef);
+    if (catalog.Read(catalog_name)) {
+      if (catalog.Matches(filenames)) {
+        filenames.clear();
+        for (auto const& f : catalog.files) {
+          if (f.IsReadable()) {
+            filenames.push_back(f.path);
+            entries.push_back(f.entries);
+          }
+          else {
+            std::cerr << "Skipping unreadable file " << f.path << std::endl;
+          }
+        }
+      }
+      else {
+        std::cerr << "Catalog " << catalog_name << " is out of date for "
+                  << filedef << ", ignoring it" << std::endl;
+      }
+    }
   }
   else {
     // Files listed on command line
@@ -59,26 +170,58 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  assert(!filenames.empty());
+  assert(!filenames.empty() || !watch_path.empty());
 
   // Setup
+  // Configurations with a "Covariance" block accumulate matrices from the
+  // selections in process, so they are added after all of the selections
   int n_processors = config_names.empty() ? 1 : config_names.size();
-  std::vector<Json::Value*> configs(n_processors);
-  std::vector<ana::TruthSelection::TruthSelection*> procs(n_processors);
+  std::vector<std::pair<ana::TruthSelection::TruthSelection*, Json::Value*> > selections;
+  std::vector<std::pair<ana::TruthSelection::CovarianceProcessor*, Json::Value*> > covariances;
 
   std::cout << "Configuring... " << std::endl;
   for (size_t i=0; i<n_processors; i++) {
-    procs[i] = new ana::TruthSelection::TruthSelection;
-    configs[i] = config_names.empty() ? NULL : core::LoadConfig(config_names[i]);
+    Json::Value* config = config_names.empty() ? NULL : core::LoadConfig(config_names[i]);
+    if (config && config->isMember("Covariance")) {
+      covariances.push_back({ new ana::TruthSelection::CovarianceProcessor, config });
+    }
+    else {
+      selections.push_back({ new ana::TruthSelection::TruthSelection, config });
+    }
   }
 
   core::ProcessorBlock block;
-  for (int i=0; i<procs.size(); i++) {
-    block.AddProcessor(procs[i], configs[i]);
+  block.SetShard(shard, nshards);
+  block.SetSkip(skip);
+  block.SetMaxEvents(max_events);
+  block.SetPrescale(prescale);
+  block.SetEntryCounts(entries);
+  block.SetThreads(nthreads);
+  block.SetCheckpointInterval(checkpoint);
+  block.SetIdleTimeout(idle);
+  for (auto it : selections) {
+    block.AddProcessor(it.first, it.second);
+  }
+  for (auto it : covariances) {
+    for (auto sel : selections) {
+      it.first->AddSelection(sel.first);
+    }
+    block.AddProcessor(it.first, it.second);
   }
 
   std::cout << "Running... " << std::endl;
-  block.ProcessFiles(filenames);
+  if (!watch_path.empty()) {
+    signal(SIGINT, StopStream);
+    signal(SIGTERM, StopStream);
+    core::FileWatcher watcher(watch_path);
+    block.ProcessStream(watcher);
+  }
+  else if (!skim_name.empty()) {
+    block.ProcessSkim(skim, skim_mask);
+  }
+  else {
+    block.ProcessFiles(filenames);
+  }
 
   block.DeleteProcessors();
   std::cout << "Done!" << std::endl;
@@ -0,0 +1,788 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <TChain.h>
+#include <TClass.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TNamed.h>
+#include <TObjArray.h>
+#include <TParameter.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TTree.h>
+#include <TVectorD.h>
+#include "EventIndex.hh"
+#include "OutputMerger.hh"
+#include "SkimList.hh"
+
+namespace core {
+
+OutputMerger::OutputMerger() : fThreads(0), fFanIn(0) {}
+
+
+bool OutputMerger::Merge(const std::vector<std::string>& inputs,
+                         const std::string& output) {
+  assert(!inputs.empty());
+
+  size_t nthreads = fThreads;
+  if (nthreads == 0) {
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // By default, one group per thread, limiting the number of open files
+  size_t fanin = fFanIn;
+  if (fanin == 0) {
+    fanin = (inputs.size() + nthreads - 1) / nthreads;
+    fanin = std::min((size_t) 64, std::max((size_t) 2, fanin));
+  }
+  fanin = std::max((size_t) 2, fanin);
+
+  ROOT::EnableThreadSafety();
+
+  std::vector<std::string> level = inputs;
+  std::vector<std::string> temps;
+  bool ok = true;
+
+  for (int depth=0; ok && level.size() > fanin; depth++) {
+    size_t ngroups = (level.size() + fanin - 1) / fanin;
+    std::vector<std::string> next(ngroups);
+    for (size_t g=0; g<ngroups; g++) {
+      next[g] = output + Form(".tmp%i_%zu.root", depth, g);
+    }
+
+    std::cout << "OutputMerger: Merging " << level.size() << " files into "
+              << ngroups << " with " << std::min(nthreads, ngroups)
+              << " threads" << std::endl;
+
+    std::atomic<size_t> ngroup(0);
+    std::atomic<bool> failed(false);
+    auto worker = [&]() {
+      for (size_t g=ngroup++; g<ngroups; g=ngroup++) {
+        size_t first = g * fanin;
+        size_t last = std::min(level.size(), first + fanin);
+        std::vector<std::string> group(level.begin() + first,
+                                       level.begin() + last);
+        if (!MergeFiles(group, next[g])) {
+          failed = true;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<std::min(nthreads, ngroups); i++) {
+      threads.push_back(std::thread(worker));
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+
+    // Intermediate files from the previous level are no longer needed
+    for (auto const& t : temps) {
+      remove(t.c_str());
+    }
+
+    ok = !failed;
+    level = next;
+    temps = next;
+  }
+
+  if (ok) {
+    ok = MergeFiles(level, output);
+  }
+
+  for (auto const& t : temps) {
+    remove(t.c_str());
+  }
+
+  if (!ok) {
+    std::cerr << "OutputMerger: Merge failed" << std::endl;
+    return false;
+  }
+
+  // Summary
+  TFile f(output.c_str());
+  TTree* tree = (TTree*) f.Get("tsana");
+  TParameter<double>* pot = (TParameter<double>*) f.Get("pot");
+  TNamed* hash = (TNamed*) f.Get("config_hash");
+  std::cout << "OutputMerger: Wrote " << output << " from " << inputs.size()
+            << " files";
+  if (tree) {
+    std::cout << ", " << tree->GetEntries() << " events";
+  }
+  if (pot) {
+    std::cout << ", " << pot->GetVal() << " POT";
+  }
+  if (hash) {
+    std::cout << ", configuration " << hash->GetTitle();
+  }
+  std::cout << std::endl;
+
+  return true;
+}
+
+
+bool OutputMerger::MergeFiles(const std::vector<std::string>& inputs,
+                              const std::string& output) const {
+  std::vector<TFile*> files;
+  auto close = [&]() {
+    for (auto f : files) {
+      delete f;
+    }
+  };
+
+  for (auto const& path : inputs) {
+    TFile* f = TFile::Open(path.c_str());
+    if (!f || f->IsZombie()) {
+      std::cerr << "OutputMerger: Unable to open " << path << std::endl;
+      delete f;
+      close();
+      return false;
+    }
+    files.push_back(f);
+  }
+
+  // Object names, in order of first appearance, and their classes
+  std::vector<std::pair<std::string, std::string> > objects;
+  std::set<std::string> seen;
+  bool final = false;
+  for (auto f : files) {
+    TIter next(f->GetListOfKeys());
+    while (TKey* key = (TKey*) next()) {
+      std::string name = key->GetName();
+      if (seen.insert(name).second) {
+        objects.push_back({ name, key->GetClassName() });
+      }
+    }
+    final |= (f->Get("config_hash") != nullptr && !f->Get("functions"));
+  }
+
+  if (final) {
+    std::cerr << "OutputMerger: " << inputs[0] << "... contain final "
+              << "covariance matrices, which cannot be added. Merge the "
+              << "partial results and use covariance-merge." << std::endl;
+    close();
+    return false;
+  }
+
+  TFile* out = TFile::Open(output.c_str(), "recreate", "",
+                           files[0]->GetCompressionSettings());
+  if (!out || out->IsZombie()) {
+    std::cerr << "OutputMerger: Unable to write " << output << std::endl;
+    delete out;
+    close();
+    return false;
+  }
+
+  std::vector<long> offsets(files.size(), 0);
+  bool ok = true;
+
+  if (seen.count("tsana")) {
+    ok &= MergeTrees(files, out, offsets);
+  }
+
+  ok &= MergeLists(files, out, offsets);
+
+  std::set<std::string> handled = {
+    "tsana", "index", "index_sources", "skim", "skim_sources",
+    "skim_fractions"
+  };
+
+  for (auto const& obj : objects) {
+    const std::string& name = obj.first;
+    if (!ok || handled.count(name)) {
+      continue;
+    }
+
+    // Response matrices are handled as a group
+    size_t pos = name.rfind("_rowptr");
+    if (name.compare(0, 9, "response_") == 0 &&
+        pos != std::string::npos && pos + 7 == name.size()) {
+      ok &= MergeResponse(files, out, name.substr(0, pos + 1));
+      continue;
+    }
+    if (name.compare(0, 9, "response_") == 0) {
+      continue;
+    }
+
+    // Covariance partial sums are handled per input, with its metadata
+    size_t index;
+    if (sscanf(name.c_str(), "meta_input%zu", &index) == 1) {
+      ok &= MergePartial(files, out, index);
+      continue;
+    }
+    if (name.compare(0, 9, "enu_input") == 0 ||
+        name.compare(0, 10, "sums_input") == 0 ||
+        name.compare(0, 10, "bscv_input") == 0 ||
+        name.compare(0, 12, "bssums_input") == 0 ||
+        name.compare(0, 12, "fnsums_input") == 0) {
+      continue;
+    }
+
+    ok &= MergeObject(files, out, name, obj.second);
+  }
+
+  out->Close();
+  delete out;
+  close();
+
+  if (!ok) {
+    remove(output.c_str());
+  }
+
+  return ok;
+}
+
+
+bool OutputMerger::MergeTrees(const std::vector<TFile*>& files, TFile* out,
+                              std::vector<long>& offsets) const {
+  TTree* first = (TTree*) files[0]->Get("tsana");
+  if (!first) {
+    std::cerr << "OutputMerger: No tsana tree in " << files[0]->GetName()
+              << std::endl;
+    return false;
+  }
+
+  // Schema check: all trees must have the same branches and classes
+  std::vector<std::string> schema;
+  TObjArray* branches = first->GetListOfBranches();
+  for (int i=0; i<branches->GetEntriesFast(); i++) {
+    TBranch* b = (TBranch*) branches->At(i);
+    schema.push_back(std::string(b->GetName()) + ":" + b->GetClassName());
+  }
+
+  TChain chain("tsana");
+  bool fast = true;
+  long offset = 0;
+  for (size_t i=0; i<files.size(); i++) {
+    TTree* t = (TTree*) files[i]->Get("tsana");
+    if (!t) {
+      std::cerr << "OutputMerger: No tsana tree in " << files[i]->GetName()
+                << std::endl;
+      return false;
+    }
+
+    std::vector<std::string> s;
+    TObjArray* b = t->GetListOfBranches();
+    for (int k=0; k<b->GetEntriesFast(); k++) {
+      TBranch* br = (TBranch*) b->At(k);
+      s.push_back(std::string(br->GetName()) + ":" + br->GetClassName());
+    }
+    if (s != schema) {
+      std::cerr << "OutputMerger: Tree branches in " << files[i]->GetName()
+                << " differ from " << files[0]->GetName() << std::endl;
+      return false;
+    }
+
+    fast &= (files[i]->GetCompressionSettings() ==
+             out->GetCompressionSettings());
+
+    offsets[i] = offset;
+    offset += t->GetEntries();
+    chain.Add(files[i]->GetName());
+  }
+
+  // Copy the compressed baskets directly if the compression matches
+  out->cd();
+  chain.Merge(out, 0, fast ? "fast keep" : "keep");
+
+  return true;
+}
+
+
+bool OutputMerger::MergeLists(const std::vector<TFile*>& files, TFile* out,
+                              const std::vector<long>& offsets) const {
+  // Combined source file list
+  std::vector<std::string> sources;
+  std::map<std::string, int> ids;
+  auto id = [&](const std::string& path) {
+    auto it = ids.find(path);
+    if (it != ids.end()) {
+      return it->second;
+    }
+    ids[path] = sources.size();
+    sources.push_back(path);
+    return (int) sources.size() - 1;
+  };
+
+  EventIndex index;
+  SkimList skim;
+  size_t nindex = 0, nskim = 0;
+
+  // POT fraction of each source counted by each skim list, which add up
+  // over jobs reading disjoint parts of the same files
+  std::vector<std::vector<std::pair<int, double> > > fractions;
+  bool fractional = false;
+
+  for (size_t i=0; i<files.size(); i++) {
+    EventIndex idx;
+    if (idx.Read(files[i])) {
+      nindex++;
+      for (auto r : idx.records) {
+        r.entry += offsets[i];
+        if (r.file >= 0 && r.file < (int) idx.sources.size()) {
+          r.file = id(idx.sources[r.file]);
+        }
+        index.Add(r);
+      }
+    }
+
+    SkimList s;
+    if (s.Read(files[i])) {
+      nskim++;
+      for (auto const& e : s.entries) {
+        // Without its source the entry can't be located, so fail the merge
+        if (e.file < 0 || e.file >= (int) s.sources.size()) {
+          std::cerr << "OutputMerger: Bad skim source index " << e.file
+                    << " in " << files[i]->GetName() << std::endl;
+          return false;
+        }
+        skim.Add(id(s.sources[e.file]), e.entry, e.mask);
+      }
+
+      fractions.emplace_back();
+      fractional |= !s.fractions.empty();
+      for (size_t j=0; j<s.sources.size(); j++) {
+        fractions.back().push_back(
+          { id(s.sources[j]), s.fractions.empty() ? 1.0 : s.fractions[j] });
+      }
+    }
+  }
+
+  if (nindex > 0 && nindex < files.size()) {
+    std::cerr << "OutputMerger: Event index missing in "
+              << files.size() - nindex << " files" << std::endl;
+  }
+  if (nskim > 0 && nskim < files.size()) {
+    std::cerr << "OutputMerger: Skim list missing in "
+              << files.size() - nskim << " files" << std::endl;
+  }
+
+  if (nindex > 0) {
+    index.SetSources(sources);
+    index.Write(out);
+  }
+
+  if (nskim > 0) {
+    if (fractional) {
+      std::vector<double> total(sources.size(), 0);
+      for (auto const& list : fractions) {
+        for (auto const& it : list) {
+          total[it.first] += it.second;
+        }
+      }
+      skim.SetFractions(total);
+    }
+
+    skim.SetSources(sources);
+    skim.Write(out);
+  }
+
+  return true;
+}
+
+
+bool OutputMerger::MergeResponse(const std::vector<TFile*>& files,
+                                 TFile* out,
+                                 const std::string& prefix) const {
+  std::vector<double> true_edges, reco_edges, norm;
+  std::map<size_t, std::vector<double> > cells;
+  size_t stride = 0;
+
+  auto get = [&](TFile* f, const char* part) {
+    return (TVectorD*) f->Get((prefix + part).c_str());
+  };
+
+  for (auto f : files) {
+    TVectorD* te = get(f, "true_edges");
+    TVectorD* re = get(f, "reco_edges");
+    TVectorD* rp = get(f, "rowptr");
+    TVectorD* nm = get(f, "norm");
+    TVectorD* ci = get(f, "colidx");
+    TVectorD* vals = get(f, "values");
+    if (!te || !re || !rp || !nm) {
+      std::cerr << "OutputMerger: Incomplete response " << prefix << " in "
+                << f->GetName() << std::endl;
+      return false;
+    }
+
+    std::vector<double> t(te->GetMatrixArray(),
+                          te->GetMatrixArray() + te->GetNrows());
+    std::vector<double> r(re->GetMatrixArray(),
+                          re->GetMatrixArray() + re->GetNrows());
+    const size_t ntrue = t.size() - 1;
+    const size_t nreco = r.size() - 1;
+    const size_t s = nm->GetNrows() / ntrue;
+
+    if (true_edges.empty()) {
+      true_edges = t;
+      reco_edges = r;
+      stride = s;
+      norm.resize(stride * ntrue, 0);
+    }
+    else if (t != true_edges || r != reco_edges || s != stride) {
+      std::cerr << "OutputMerger: Response " << prefix << " binning or "
+                << "universes differ in " << f->GetName() << std::endl;
+      return false;
+    }
+
+    // Undo the normalization, so cells can be summed
+    const size_t nnz = ci ? ci->GetNrows() : 0;
+    for (size_t row=0; row<ntrue; row++) {
+      for (long k=(*rp)[row]; k<(*rp)[row + 1]; k++) {
+        std::vector<double>& cell = cells[row * nreco + (size_t) (*ci)[k]];
+        cell.resize(stride, 0);
+        for (size_t u=0; u<stride; u++) {
+          cell[u] += (*vals)[u * nnz + k] * (*nm)[u * ntrue + row];
+        }
+      }
+    }
+
+    for (size_t k=0; k<norm.size(); k++) {
+      norm[k] += (*nm)[k];
+    }
+  }
+
+  const size_t ntrue = true_edges.size() - 1;
+  const size_t nreco = reco_edges.size() - 1;
+  const size_t nnz = cells.size();
+
+  TVectorD rowptr(ntrue + 1), colidx(nnz), values(stride * nnz);
+  size_t k = 0;
+  for (auto const& it : cells) {
+    size_t row = it.first / nreco;
+    rowptr[row + 1]++;
+    colidx[k] = it.first % nreco;
+    for (size_t u=0; u<stride; u++) {
+      double n = norm[u * ntrue + row];
+      values[u * nnz + k] = (n > 0 ? it.second[u] / n : 0);
+    }
+    k++;
+  }
+  for (size_t row=0; row<ntrue; row++) {
+    rowptr[row + 1] += rowptr[row];
+  }
+
+  out->cd();
+  TVectorD(true_edges.size(), true_edges.data()).Write(
+    (prefix + "true_edges").c_str());
+  TVectorD(reco_edges.size(), reco_edges.data()).Write(
+    (prefix + "reco_edges").c_str());
+  rowptr.Write((prefix + "rowptr").c_str());
+  if (nnz > 0) {
+    colidx.Write((prefix + "colidx").c_str());
+    values.Write((prefix + "values").c_str());
+  }
+  TVectorD(norm.size(), norm.data()).Write((prefix + "norm").c_str());
+
+  return true;
+}
+
+
+bool OutputMerger::MergePartial(const std::vector<TFile*>& files,
+                                TFile* out, size_t index) const {
+  auto get = [&](TFile* f, const char* part) {
+    return f->Get(Form("%s_input%zu", part, index));
+  };
+
+  // Keep the smallest nonzero universe count, as for truncated jobs in
+  // util::Covariance::Merge
+  auto keep = [](size_t& m, size_t c) {
+    if (c > 0 && (m == 0 || c < m)) {
+      m = c;
+    }
+  };
+
+  TH1* enu = nullptr;
+  std::vector<double> meta(3, 0);
+  size_t nbins = 0, nu = 0;
+  std::map<std::string, size_t> fn_n;
+  const std::string fn_prefix = Form("fnsums_input%zu_", index);
+
+  for (auto f : files) {
+    TVectorD* m = (TVectorD*) get(f, "meta");
+    TH1* h = (TH1*) get(f, "enu");
+    if (!m || m->GetNrows() != 3 || !h ||
+        (enu && (size_t) h->GetNbinsX() != nbins)) {
+      std::cerr << "OutputMerger: Partial input " << index << " is missing "
+                << "or differs in " << f->GetName() << std::endl;
+      delete enu;
+      return false;
+    }
+
+    if (!enu) {
+      enu = (TH1*) h->Clone(Form("enu_input%zu", index));
+      enu->SetDirectory(nullptr);
+      nbins = enu->GetNbinsX();
+    }
+    else {
+      enu->Add(h);
+    }
+
+    meta[0] += (*m)[0];
+    meta[1] += (*m)[1];
+    if (get(f, "sums")) {
+      keep(nu, (*m)[2]);
+    }
+
+    TIter next(f->GetListOfKeys());
+    while (TKey* key = (TKey*) next()) {
+      std::string name = key->GetName();
+      if (name.compare(0, fn_prefix.size(), fn_prefix) == 0) {
+        TVectorD* v = (TVectorD*) f->Get(name.c_str());
+        keep(fn_n[name.substr(fn_prefix.size())], v->GetNrows() / nbins);
+      }
+    }
+  }
+  meta[2] = nu;
+
+  // Add the first dnu universes of each row of a partial's sums (stride
+  // snu), or if it has none, its nominal value for the row in every
+  // universe, so inputs without weights are not biased low
+  auto add = [](std::vector<double>& dst, size_t dnu,
+                const TVectorD* src, size_t snu,
+                const std::vector<double>& nominal) {
+    for (size_t r=0; r<nominal.size(); r++) {
+      for (size_t k=0; k<dnu; k++) {
+        dst[r * dnu + k] += (src ? (*src)[r * snu + k] : nominal[r]);
+      }
+    }
+  };
+
+  // Check a partial's sums have whole rows of at least dnu universes
+  auto rows = [&](TFile* f, const char* name, const TVectorD* v,
+                  size_t nrows, size_t dnu) {
+    if (v && (v->GetNrows() % nrows != 0 ||
+              (size_t) v->GetNrows() / nrows < dnu)) {
+      std::cerr << "OutputMerger: " << name << " length differs in "
+                << f->GetName() << std::endl;
+      return false;
+    }
+    return true;
+  };
+
+  std::vector<std::vector<double> > cv(files.size());
+  for (size_t i=0; i<files.size(); i++) {
+    TH1* h = (TH1*) get(files[i], "enu");
+    for (size_t j=0; j<nbins; j++) {
+      cv[i].push_back(h->GetBinContent(j + 1));
+    }
+  }
+
+  out->cd();
+  enu->Write(Form("enu_input%zu", index));
+  delete enu;
+  TVectorD(meta.size(), meta.data()).Write(Form("meta_input%zu", index));
+
+  if (nu > 0) {
+    std::string name = Form("sums_input%zu", index);
+    std::vector<double> sums(nbins * nu, 0);
+    for (size_t i=0; i<files.size(); i++) {
+      TVectorD* s = (TVectorD*) files[i]->Get(name.c_str());
+      if (!rows(files[i], name.c_str(), s, nbins, nu)) {
+        return false;
+      }
+      add(sums, nu, s, s ? s->GetNrows() / nbins : 0, cv[i]);
+    }
+    TVectorD(sums.size(), sums.data()).Write(name.c_str());
+  }
+
+  for (auto const& it : fn_n) {
+    const size_t nf = it.second;
+    const std::string name = fn_prefix + it.first;
+    std::vector<double> fsums(nbins * nf, 0);
+    for (size_t i=0; i<files.size(); i++) {
+      TVectorD* s = (TVectorD*) files[i]->Get(name.c_str());
+      if (!rows(files[i], name.c_str(), s, nbins, nf)) {
+        return false;
+      }
+      add(fsums, nf, s, s ? s->GetNrows() / nbins : 0, cv[i]);
+    }
+    TVectorD(fsums.size(), fsums.data()).Write(name.c_str());
+  }
+
+  // Bootstrap replicas, [bin][replica], and their universes; replicas
+  // without universe sums are nominal in every universe
+  std::vector<double> bscv;
+  for (auto f : files) {
+    TVectorD* v = (TVectorD*) get(f, "bscv");
+    if (!v) {
+      continue;
+    }
+    if (bscv.empty()) {
+      bscv.resize(v->GetNrows(), 0);
+    }
+    if ((size_t) v->GetNrows() != bscv.size()) {
+      std::cerr << "OutputMerger: bscv_input" << index << " length differs "
+                << "in " << f->GetName() << std::endl;
+      return false;
+    }
+    for (size_t k=0; k<bscv.size(); k++) {
+      bscv[k] += (*v)[k];
+    }
+  }
+
+  if (!bscv.empty()) {
+    TVectorD(bscv.size(), bscv.data()).Write(Form("bscv_input%zu", index));
+  }
+
+  if (!bscv.empty() && nu > 0) {
+    std::string name = Form("bssums_input%zu", index);
+    std::vector<double> bssums(bscv.size() * nu, 0);
+    for (auto f : files) {
+      TVectorD* v = (TVectorD*) get(f, "bscv");
+      TVectorD* s = (TVectorD*) f->Get(name.c_str());
+      if (!v) {
+        continue;
+      }
+      if (!rows(f, name.c_str(), s, bscv.size(), nu)) {
+        return false;
+      }
+      std::vector<double> nominal(v->GetMatrixArray(),
+                                  v->GetMatrixArray() + v->GetNrows());
+      add(bssums, nu, s, s ? s->GetNrows() / bscv.size() : 0, nominal);
+    }
+    TVectorD(bssums.size(), bssums.data()).Write(name.c_str());
+  }
+
+  return true;
+}
+
+
+bool OutputMerger::MergeObject(const std::vector<TFile*>& files,
+                               TFile* out, const std::string& name,
+                               const std::string& cls) const {
+  const char* n = name.c_str();
+  std::vector<TObject*> objs;
+  std::vector<TFile*> sources;
+  for (auto f : files) {
+    TObject* o = f->Get(n);
+    if (o) {
+      objs.push_back(o);
+      sources.push_back(f);
+    }
+  }
+  assert(!objs.empty());
+
+  out->cd();
+
+  if (cls == "TParameter<double>") {
+    double v = ((TParameter<double>*) objs[0])->GetVal();
+    for (size_t i=1; i<objs.size(); i++) {
+      double vi = ((TParameter<double>*) objs[i])->GetVal();
+      if (name == "prescale") {
+        if (vi != v) {
+          std::cerr << "OutputMerger: Prescale differs in "
+                    << sources[i]->GetName() << std::endl;
+          return false;
+        }
+      }
+      else {
+        v += vi;
+      }
+    }
+    TParameter<double>(n, v).Write();
+  }
+  else if (cls == "TNamed") {
+    std::string title = objs[0]->GetTitle();
+
+    if (name == "functions") {
+      // Union of the weight functions, in order
+      std::vector<std::string> fns;
+      for (auto o : objs) {
+        std::string list = o->GetTitle();
+        for (size_t pos=0; !list.empty() && pos != std::string::npos; ) {
+          size_t next = list.find(';', pos);
+          std::string fn = list.substr(pos, next - pos);
+          if (std::find(fns.begin(), fns.end(), fn) == fns.end()) {
+            fns.push_back(fn);
+          }
+          pos = (next == std::string::npos ? next : next + 1);
+        }
+      }
+      title.clear();
+      for (size_t i=0; i<fns.size(); i++) {
+        title += (i > 0 ? ";" : "") + fns[i];
+      }
+    }
+    else {
+      for (size_t i=1; i<objs.size(); i++) {
+        if (title != objs[i]->GetTitle()) {
+          std::cerr << "OutputMerger: " << name << " differs in "
+                    << sources[i]->GetName() << std::endl;
+          return false;
+        }
+      }
+    }
+
+    TNamed(n, title.c_str()).Write();
+  }
+  else if (cls == "TVectorT<double>") {
+    TVectorD* v0 = (TVectorD*) objs[0];
+    std::vector<double> sum(v0->GetMatrixArray(),
+                            v0->GetMatrixArray() + v0->GetNrows());
+    bool edges = (name.find("edges") != std::string::npos);
+
+    for (size_t i=1; i<objs.size(); i++) {
+      TVectorD* v = (TVectorD*) objs[i];
+      if ((size_t) v->GetNrows() != sum.size()) {
+        std::cerr << "OutputMerger: " << name << " length differs in "
+                  << sources[i]->GetName() << std::endl;
+        return false;
+      }
+
+      for (size_t k=0; k<sum.size(); k++) {
+        double x = (*v)[k];
+        if (edges) {
+          if (x != sum[k]) {
+            std::cerr << "OutputMerger: " << name << " differs in "
+                      << sources[i]->GetName() << std::endl;
+            return false;
+          }
+        }
+        else {
+          sum[k] += x;
+        }
+      }
+    }
+
+    TVectorD(sum.size(), sum.data()).Write(n);
+  }
+  else if (TClass::GetClass(cls.c_str()) &&
+           TClass::GetClass(cls.c_str())->InheritsFrom("TH1")) {
+    TH1* sum = (TH1*) objs[0]->Clone(n);
+    sum->SetDirectory(nullptr);
+    for (size_t i=1; i<objs.size(); i++) {
+      TH1* h = (TH1*) objs[i];
+      if (h->GetNbinsX() != sum->GetNbinsX() ||
+          h->GetNbinsY() != sum->GetNbinsY()) {
+        std::cerr << "OutputMerger: " << name << " binning differs in "
+                  << sources[i]->GetName() << std::endl;
+        delete sum;
+        return false;
+      }
+      sum->Add(h);
+    }
+    sum->Write(n);
+    delete sum;
+  }
+  else {
+    std::cerr << "OutputMerger: Keeping the first " << name << " ("
+              << cls << ")" << std::endl;
+    objs[0]->Write(n);
+  }
+
+  return true;
+}
+
+}  // namespace core
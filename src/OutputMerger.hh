@@ -0,0 +1,150 @@
+#ifndef __ts_core_OutputMerger__
+#define __ts_core_OutputMerger__
+
+/**
+ * \file OutputMerger.hh
+ *
+ * Merging of sharded selection and covariance outputs.
+ */
+
+#include <string>
+#include <vector>
+
+class TFile;
+
+namespace core {
+
+/**
+ * \class core::OutputMerger
+ * \brief Combines output files of the same job run over disjoint inputs
+ *
+ * Objects are combined according to what they hold:
+ *
+ *   - tsana trees are concatenated, copying compressed baskets directly
+ *     when all inputs have the same compression settings, and must have
+ *     the same branches.
+ *   - Event indices and skim lists are concatenated, with tree entries
+ *     offset and source files renumbered into the combined source list.
+ *   - POT and spill counts (TParameter<double>) are summed; "prescale"
+ *     must match.
+ *   - Response matrices (response_<name>_*) are re-weighted by their
+ *     normalizations, summed and re-normalized.
+ *   - Covariance partial results (*_input<i>) are combined as by
+ *     util::Covariance::Merge: inputs without (some) universe sums count
+ *     at the nominal weight in those universes, and inputs truncated to
+ *     different universe counts keep the universes they share. The
+ *     configuration hashes must match; the functions lists are combined.
+ *   - Other histograms are added and other vectors summed; bin edges and
+ *     other TNamed objects must match.
+ *
+ * Final covariance outputs (without partial sums) cannot be combined this
+ * way and are rejected: merge the partial results, then compute the
+ * matrices with covariance-merge.
+ *
+ * Many files are merged as a tree: groups of files are merged
+ * concurrently into temporary files, which are then merged in turn.
+ * Groups are contiguous, so the input order is kept.
+ */
+class OutputMerger {
+public:
+  /** Constructor. */
+  OutputMerger();
+
+  /**
+   * Set the number of concurrent merges.
+   *
+   * \param n The number of threads (0 for the number of cores)
+   */
+  void SetThreads(size_t n) { fThreads = n; }
+
+  /**
+   * Set the maximum number of files merged at once.
+   *
+   * \param n The fan-in (0 to choose from the file and thread counts)
+   */
+  void SetFanIn(size_t n) { fFanIn = n; }
+
+  /**
+   * Merge files.
+   *
+   * \param inputs The input paths, in order
+   * \param output The output path
+   * \returns True on success
+   */
+  bool Merge(const std::vector<std::string>& inputs,
+             const std::string& output);
+
+  /**
+   * Merge files in one step.
+   *
+   * \param inputs The input paths, in order
+   * \param output The output path
+   * \returns True on success
+   */
+  bool MergeFiles(const std::vector<std::string>& inputs,
+                  const std::string& output) const;
+
+protected:
+  /**
+   * Concatenate the tsana trees.
+   *
+   * \param files The inputs
+   * \param out The output
+   * \param offsets Set to the first output entry of each input
+   * \returns True on success
+   */
+  bool MergeTrees(const std::vector<TFile*>& files, TFile* out,
+                  std::vector<long>& offsets) const;
+
+  /**
+   * Merge the event indices and skim lists.
+   *
+   * \param files The inputs
+   * \param out The output
+   * \param offsets The first output entry of each input
+   * \returns True on success, false if a skim list has a bad source index
+   */
+  bool MergeLists(const std::vector<TFile*>& files, TFile* out,
+                  const std::vector<long>& offsets) const;
+
+  /**
+   * Merge the response matrices.
+   *
+   * \param files The inputs
+   * \param out The output
+   * \param prefix The object name prefix, response_<name>_
+   * \returns True on success
+   */
+  bool MergeResponse(const std::vector<TFile*>& files, TFile* out,
+                     const std::string& prefix) const;
+
+  /**
+   * Merge the partial covariance sums of one input (*_input<i>).
+   *
+   * \param files The inputs
+   * \param out The output
+   * \param index The covariance input index i
+   * \returns True on success
+   */
+  bool MergePartial(const std::vector<TFile*>& files, TFile* out,
+                    size_t index) const;
+
+  /**
+   * Merge an object found in one or more inputs.
+   *
+   * \param files The inputs
+   * \param out The output
+   * \param name The object name
+   * \param cls The object class name
+   * \returns True on success
+   */
+  bool MergeObject(const std::vector<TFile*>& files, TFile* out,
+                   const std::string& name, const std::string& cls) const;
+
+  size_t fThreads;  //!< Number of concurrent merges
+  size_t fFanIn;  //!< Maximum files per merge
+};
+
+}  // namespace core
+
+#endif  // __ts_core_OutputMerger__
@@ -4,6 +4,7 @@
 #include <TTree.h>
 #include "gallery/Handle.h"
 #include "canvas/Utilities/InputTag.h"
+#include "canvas/Persistency/Provenance/EventAuxiliary.h"
 #include "nusimdata/SimulationBase/MCTruth.h"
 #include "nusimdata/SimulationBase/MCNeutrino.h"
 #include "uboone/EventWeight/MCEventWeight.h"
@@ -14,14 +15,38 @@
 
 namespace core {
 
-ProcessorBase::ProcessorBase() : fEventIndex(0), fOutputFilename("output.root") {}
+ProcessorBase::ProcessorBase()
+    : fEventIndex(0), fOutputFilename("output.root"), fOutputFile(nullptr),
+      fTree(nullptr), fEvent(nullptr), fWriteTree(true), fPOT(0),
+      fSourceFile(-1), fSourceEntry(-1), fSkim(false), fPassMask(0),
+      fBuffered(false) {}
 
 
-ProcessorBase::~ProcessorBase() {}
+ProcessorBase::~ProcessorBase() {
+  // Worker thread copies own their in-memory trees
+  if (fBuffered) {
+    delete fTree;
+    delete fEvent;
+  }
+}
 
 
 void ProcessorBase::FillTree() {
-  fTree->Fill();
+  if (fSkim) {
+    fSkimList.Add(fSourceFile, fSourceEntry, fPassMask);
+  }
+  else if (fWriteTree) {
+    EventIndex::Record r;
+    r.run = fEvent->metadata.run;
+    r.subrun = fEvent->metadata.subrun;
+    r.event = fEvent->metadata.eventID;
+    r.entry = fTree->GetEntries();
+    r.file = fSourceFile;
+    r.source_entry = fSourceEntry;
+    fIndex.Add(r);
+
+    fTree->Fill();
+  }
   fEventIndex++;
 }
 
@@ -47,12 +72,21 @@ void ProcessorBase::Setup(Json::Value* config) {
     fTruthTag = { config->get("MCTruthTag", "generator").asString() };
     fWeightTag = { config->get("MCWeightTag", "eventweight").asString() };
     fOutputFilename = config->get("OutputFile", "output.root").asString();
+    fWriteTree = config->get("WriteTree", true).asBool();
+    fSkim = config->get("Skim", false).asBool();
   }
 
   // Open the output file and create the standard event tree
-  fOutputFile = TFile::Open(fOutputFilename.c_str(), "recreate");
+  if (!fBuffered) {
+    fOutputFile = TFile::Open(fOutputFilename.c_str(), "recreate");
+  }
   fTree = new TTree("tsana", "TS Analysis Tree");
-  fTree->AutoSave("overwrite");
+  if (fBuffered) {
+    fTree->SetDirectory(nullptr);
+  }
+  else {
+    fTree->AutoSave("overwrite");
+  }
   fEvent = new Event();
   fTree->Branch("events", &fEvent);
 }
@@ -62,10 +96,29 @@ void ProcessorBase::Teardown() {
   // Write the standard tree and close the output file
   fOutputFile->cd();
   fTree->Write("tsana", TObject::kOverwrite);
+  if (fSkim) {
+    fSkimList.Write(fOutputFile);
+  }
+  else if (fWriteTree) {
+    fIndex.Write(fOutputFile);
+  }
   fOutputFile->Close();
 }
 
 
+void ProcessorBase::Checkpoint() {
+  // The event index is rewritten whole, so it is only written at the end
+  fOutputFile->cd();
+  if (fSkim) {
+    fSkimList.Write(fOutputFile);
+  }
+
+  // Replaces the previous tree header and saves the directory, so readers
+  // see a consistent file
+  fTree->AutoSave("saveself;overwrite");
+}
+
+
 void ProcessorBase::BuildEventTree(gallery::Event& ev) {
   // Get MCTruth information
   gallery::Handle<std::vector<simb::MCTruth> > mctruths;
@@ -86,6 +139,13 @@ void ProcessorBase::BuildEventTree(gallery::Event& ev) {
 
   fTree->GetEntry(fEventIndex);
 
+  // Event ID and source location
+  auto const& aux = ev.eventAuxiliary();
+  fEvent->metadata.run = aux.run();
+  fEvent->metadata.subrun = aux.subRun();
+  fEvent->metadata.eventID = aux.event();
+  fSourceEntry = ev.eventEntry();
+
   fEvent->ninteractions = std::min(Event::kMaxInteractions, mctruths->size());
 
   if (mctruths->size() > Event::kMaxInteractions) {
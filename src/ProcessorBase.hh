@@ -13,6 +13,8 @@
 #include <vector>
 #include <TTree.h>
 #include "gallery/Event.h"
+#include "EventIndex.hh"
+#include "SkimList.hh"
 
 class TBranch;
 class TFile;
@@ -40,9 +42,57 @@ public:
 
   /**
    * Fill the tree and increment the event index.
+   *
+   * The tree is only filled if "WriteTree" (default true) is set in the
+   * configuration. Written events are added to the event index.
+   *
+   * In skim mode ("Skim": true), only the source location and pass mask
+   * of the event are recorded, and written as a SkimList in place of the
+   * tree contents.
    */
   virtual void FillTree();
 
+  /** The standard event data for the current event. */
+  const Event* GetEvent() const { return fEvent; }
+
+  /** Entry of the current event in its source file. */
+  long GetSourceEntry() const { return fSourceEntry; }
+
+  /**
+   * Whether the results for an input file may be served from a cache.
+   *
+   * True only if the output depends on nothing but the tree contents of
+   * the accepted events, i.e. nothing is accumulated over all events for
+   * Finalize, and no other processor depends on this one running. See
+   * ResultCache.
+   *
+   * \returns True if the processor's results can be cached
+   */
+  virtual bool IsCacheable() const { return false; }
+
+  /**
+   * Whether copies of the processor may run concurrently.
+   *
+   * True only if ProcessEvent uses no state shared between instances, the
+   * output depends on nothing but the tree contents of the accepted events
+   * (as for IsCacheable), and Clone is implemented. See
+   * ProcessorBlock::SetThreads.
+   *
+   * \returns True if the processor can run in worker threads
+   */
+  virtual bool IsThreadSafe() const { return false; }
+
+  /**
+   * Create a new, unconfigured instance of the same processor.
+   *
+   * The block configures the copy with the same configuration, for use
+   * in a worker thread.
+   *
+   * \returns The new instance (caller takes ownership), or null if
+   *          not supported
+   */
+  virtual ProcessorBase* Clone() const { return nullptr; }
+
   /**
    * Add a branch to the output tree.
    *
@@ -97,15 +147,36 @@ protected:
   /**
    * Perform framework-level initialization.
    *
+   * Opens the output file, or for worker thread copies (fBuffered),
+   * creates the tree in memory only.
+   *
    * \param config A configuration as a JSON object
    */
   virtual void Setup(Json::Value* config=NULL);
 
-  /** Perform framework-level finalization. */
+  /**
+   * Perform framework-level finalization.
+   *
+   * Writes the standard tree and the event index (see EventIndex), or
+   * the skim list in skim mode.
+   */
   virtual void Teardown();
 
   /**
-   * Populate the default event tree variables.
+   * Write a snapshot of the output so far, leaving the file open.
+   *
+   * Called periodically when processing a stream of files (see
+   * ProcessorBlock::ProcessStream). Writes the tree (or skim list) and
+   * the file's directory, so the file can be read while the job continues;
+   * the event index is only written by Teardown. Subclasses that
+   * accumulate results for Finalize may write a copy of them too, then call
+   * this.
+   */
+  virtual void Checkpoint();
+
+  /**
+   * Populate the default event tree variables, including the event ID
+   * metadata from the event auxiliary data.
    *
    * \param ev The current gallery event
   */
@@ -116,6 +187,15 @@ protected:
   TFile* fOutputFile;  //!< The output ROOT file
   TTree* fTree;  //!< The output ROOT tree
   Event* fEvent;  //!< The standard output event data structure
+  bool fWriteTree;  //!< Write accepted events to the output tree
+  double fPOT;  //!< Exposure of the input files, set before Finalize
+  EventIndex fIndex;  //!< Index of written events
+  int fSourceFile;  //!< Index of the current source file, set by the block
+  long fSourceEntry;  //!< Entry of the current event in its source file
+  bool fSkim;  //!< Record accepted events in a skim list only
+  SkimList fSkimList;  //!< Accepted events, in skim mode
+  unsigned int fPassMask;  //!< Processors accepting the current event
+  bool fBuffered;  //!< A worker thread copy, with an in-memory tree
   art::InputTag fTruthTag;  //!< art tag for MCTruth information
   art::InputTag fWeightTag;  //!< art tag for MCEventWeight information
 };
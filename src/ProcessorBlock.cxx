@@ -1,15 +1,42 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <json/json.h>
+#include <TBranch.h>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TParameter.h>
+#include <TROOT.h>
+#include <TTree.h>
+#include "canvas/Persistency/Common/Wrapper.h"
+#include "canvas/Persistency/Provenance/EventAuxiliary.h"
+#include "larcoreobj/SummaryData/POTSummary.h"
+#include "FileWatcher.hh"
 #include "ProcessorBase.hh"
 #include "ProcessorBlock.hh"
+#include "SkimList.hh"
+#include "CounterRNG.hh"
 
 namespace core {
 
-ProcessorBlock::ProcessorBlock() {}
+ProcessorBlock::ProcessorBlock()
+    : fPOTLabel("generator"), fPOT(0), fGoodPOT(0), fSpills(0),
+      fGoodSpills(0), fNSubRuns(0), fRawPOT(0), fShard(0), fNShards(1),
+      fSkip(0), fMaxEvents(-1), fPrescale(1), fRangeStart(0),
+      fPartial(false), fThreads(1), fChunkSize(1000), fCheckpointInterval(10),
+      fIdleTimeout(0), fCache(nullptr) {}
 
 
-ProcessorBlock::~ProcessorBlock() {}
+ProcessorBlock::~ProcessorBlock() {
+  delete fCache;
+}
 
 
 void ProcessorBlock::AddProcessor(ProcessorBase* processor,
@@ -19,31 +46,850 @@ void ProcessorBlock::AddProcessor(ProcessorBase* processor,
 
 
 void ProcessorBlock::ProcessFiles(std::vector<std::string> filenames) {
-  // Setup
+  Begin(filenames);
+
+  bool threaded = (fThreads > 1 && !fCache);
+  for (auto it : fProcessors) {
+    threaded &= it.first->IsThreadSafe();
+  }
+  if (fThreads > 1 && !threaded) {
+    std::cerr << "ProcessorBlock: Not all processors are thread-safe, "
+              << "using one thread" << std::endl;
+  }
+
+  if (fCache) {
+    for (size_t i=0; i<filenames.size(); i++) {
+      ProcessCachedFile(filenames[i], i);
+    }
+  }
+  else if (threaded) {
+    ProcessParallel(filenames);
+  }
+  else if (fNShards > 1 || fSkip > 0 || fMaxEvents >= 0) {
+    ProcessRange(filenames);
+  }
+  else {
+    for (gallery::Event ev(filenames); !ev.atEnd(); ev.next()) {
+      ProcessEvent(ev, ev.fileEntry());
+    }
+  }
+
+  End(filenames);
+}
+
+
+void ProcessorBlock::ProcessSkim(const SkimList& skim, unsigned int mask) {
+  const std::vector<std::string>& filenames = skim.sources;
+
+  // The exposure comes from the list, so the whole list is read
+  if (fNShards > 1 || fSkip > 0 || fMaxEvents >= 0 || fPrescale > 1) {
+    std::cerr << "ProcessorBlock: Event ranges and prescaling do not apply "
+              << "to a skim, ignoring them" << std::endl;
+    fNShards = 1;
+    fSkip = 0;
+    fMaxEvents = -1;
+    fPrescale = 1;
+  }
+
+  // Group the selected entries by file
+  std::vector<std::vector<long> > entries(filenames.size());
+  size_t nselected = 0;
+  for (auto const& it : skim.entries) {
+    if (it.mask & mask) {
+      entries[it.file].push_back(it.entry);
+      nselected++;
+    }
+  }
+
+  std::cout << "ProcessorBlock: Processing " << nselected << " skimmed "
+            << "events from " << filenames.size() << " files" << std::endl;
+
+  Begin(filenames);
+  fSkimFractions = skim.fractions;
+
+  for (size_t i=0; i<filenames.size(); i++) {
+    if (entries[i].empty()) {
+      continue;
+    }
+
+    gallery::Event ev({ filenames[i] });
+    for (long entry : entries[i]) {
+      ev.goToEntry(entry);
+      ProcessEvent(ev, i);
+    }
+  }
+
+  End(filenames);
+}
+
+
+void ProcessorBlock::ProcessStream(FileWatcher& watcher) {
+  if (fNShards > 1 || fSkip > 0 || fMaxEvents >= 0) {
+    std::cerr << "ProcessorBlock: Event ranges do not apply to a stream, "
+              << "ignoring them" << std::endl;
+    fNShards = 1;
+    fSkip = 0;
+    fMaxEvents = -1;
+  }
+  if (fThreads > 1) {
+    std::cerr << "ProcessorBlock: Streams are processed with one thread"
+              << std::endl;
+  }
+
+  std::vector<std::string> filenames;
+  Begin(filenames);
+
+  std::cout << "ProcessorBlock: Watching " << watcher.GetPath()
+            << std::endl;
+
+  typedef std::chrono::steady_clock Clock;
+  const std::chrono::duration<double> interval(fCheckpointInterval);
+  const std::chrono::duration<double> idle(fIdleTimeout);
+  Clock::time_point last_checkpoint = Clock::now();
+  Clock::time_point last_file = Clock::now();
+  bool dirty = false;
+
+  std::vector<std::string> pending;
+  std::set<std::string> warned;
+
+  while (!FileWatcher::Stopped()) {
+    std::vector<std::string> arrived = watcher.Poll(1000);
+    pending.insert(pending.end(), arrived.begin(), arrived.end());
+
+    // Files that cannot be read yet are tried again at the next poll
+    std::vector<std::string> waiting;
+    for (auto const& filename : pending) {
+      if (FileWatcher::Stopped() || !IsComplete(filename)) {
+        if (!FileWatcher::Stopped() && warned.insert(filename).second) {
+          std::cerr << "ProcessorBlock: " << filename << " is not "
+                    << "readable yet, will retry" << std::endl;
+        }
+        waiting.push_back(filename);
+        continue;
+      }
+
+      const size_t i = filenames.size();
+      filenames.push_back(filename);
+      fFilePOT.push_back(std::vector<double>(4, 0));
+      fVisited.push_back(0);
+      fKept.push_back(0);
+      for (auto it : fProcessors) {
+        it.first->fIndex.SetSources(filenames);
+        it.first->fSkimList.SetSources(filenames);
+      }
+
+      Clock::time_point start = Clock::now();
+
+      if (fCache) {
+        ProcessCachedFile(filename, i);
+      }
+      else {
+        for (gallery::Event ev({ filename }); !ev.atEnd(); ev.next()) {
+          ProcessEvent(ev, i);
+        }
+      }
+
+      // Files without events are not visited by the event loop
+      if (fPOTFiles.find(i) == fPOTFiles.end()) {
+        TFile* f = TFile::Open(filename.c_str());
+        if (f && !f->IsZombie()) {
+          AccumulatePOT(f, i);
+        }
+        delete f;
+      }
+
+      std::chrono::duration<double> dt = Clock::now() - start;
+      std::cout << "ProcessorBlock: Processed " << filename << " in "
+                << dt.count() << " s" << std::endl;
+
+      dirty = true;
+      last_file = Clock::now();
+    }
+    pending = waiting;
+
+    if (dirty && Clock::now() - last_checkpoint >= interval) {
+      Checkpoint(filenames);
+      dirty = false;
+      last_checkpoint = Clock::now();
+    }
+
+    if (fIdleTimeout > 0 && Clock::now() - last_file >= idle) {
+      std::cout << "ProcessorBlock: No new files for " << fIdleTimeout
+                << " s, stopping" << std::endl;
+      break;
+    }
+  }
+
+  if (!pending.empty()) {
+    std::cerr << "ProcessorBlock: " << pending.size() << " files were not "
+              << "processed" << std::endl;
+  }
+
+  End(filenames);
+}
+
+
+bool ProcessorBlock::IsComplete(const std::string& filename) {
+  // Files still being written have no keys list yet, or are recovered
+  TFile* f = TFile::Open(filename.c_str());
+  bool complete = (f && !f->IsZombie() && !f->TestBit(TFile::kRecovered) &&
+                   f->Get("Events") != nullptr);
+  delete f;
+  return complete;
+}
+
+
+void ProcessorBlock::Checkpoint(const std::vector<std::string>& filenames) {
+  // The totals keep accumulating, so correct a copy as at the end
+  const double pot = fPOT, goodpot = fGoodPOT;
+  const double spills = fSpills, goodspills = fGoodSpills;
+  fRawPOT = fPOT;
+  if (fPrescale > 1) {
+    CorrectPOT(filenames.size());
+  }
+
+  for (auto it : fProcessors) {
+    it.first->fSkimList.SetFractions(fFractions);
+    it.first->fPOT = fPOT;
+    WritePOT(it.first);
+    it.first->Checkpoint();
+  }
+
+  std::cout << "ProcessorBlock: Checkpoint after " << filenames.size()
+            << " files, " << fPOT << " POT" << std::endl;
+
+  fPOT = pot;
+  fGoodPOT = goodpot;
+  fSpills = spills;
+  fGoodSpills = goodspills;
+}
+
+
+void ProcessorBlock::GetRange(const std::vector<std::string>& filenames,
+                              long& lo, long& hi) {
+  if (fEntryCounts.size() == filenames.size()) {
+    fEntries = fEntryCounts;
+  }
+  else {
+    fEntries = CountEntries(filenames);
+  }
+
+  long total = 0;
+  for (long n : fEntries) {
+    total += n;
+  }
+
+  // Global range [lo, hi) for this job
+  lo = total * fShard / fNShards;
+  hi = total * (fShard + 1) / fNShards;
+  lo = std::min(hi, lo + fSkip);
+  if (fMaxEvents >= 0) {
+    hi = std::min(hi, lo + fMaxEvents);
+  }
+  fRangeStart = lo;
+  fPartial = (lo > 0 || hi < total);
+
+  std::cout << "ProcessorBlock: Processing events " << lo << " to " << hi
+            << " of " << total << std::endl;
+}
+
+
+void ProcessorBlock::ProcessRange(const std::vector<std::string>& filenames) {
+  long lo, hi;
+  GetRange(filenames, lo, hi);
+
+  long offset = 0;
+  for (size_t i=0; i<filenames.size(); i++) {
+    long first = std::max(lo - offset, 0L);
+    long last = std::min(hi - offset, fEntries[i]);
+    offset += fEntries[i];
+
+    if (first >= last) {
+      continue;
+    }
+
+    gallery::Event ev({ filenames[i] });
+    ev.goToEntry(first);
+    for (long entry=first; entry<last && !ev.atEnd(); entry++, ev.next()) {
+      ProcessEvent(ev, i);
+    }
+  }
+}
+
+
+void ProcessorBlock::ProcessParallel(
+    const std::vector<std::string>& filenames) {
+  long lo, hi;
+  GetRange(filenames, lo, hi);
+
+  const size_t n = fProcessors.size();
+
+  // Consecutive entries of one file, and the rows it produced
+  struct Chunk {
+    size_t file;  // Index of the file
+    long first;  // First entry
+    long last;  // One past the last entry
+    size_t worker;  // The thread that processed the chunk
+    std::vector<long> begin;  // First buffered row, per processor
+    std::vector<std::vector<std::pair<long, unsigned int> > > rows;
+  };
+
+  std::vector<Chunk> chunks;
+  long offset = 0;
+  for (size_t i=0; i<filenames.size(); i++) {
+    long first = std::max(lo - offset, 0L);
+    long last = std::min(hi - offset, fEntries[i]);
+    offset += fEntries[i];
+
+    for (long e=first; e<last; e+=fChunkSize) {
+      Chunk c;
+      c.file = i;
+      c.first = e;
+      c.last = std::min(last, e + fChunkSize);
+      c.worker = 0;
+      c.begin.resize(n, 0);
+      c.rows.resize(n);
+      chunks.push_back(c);
+    }
+  }
+
+  const size_t nthreads = \
+    std::min(fThreads, std::max((size_t) 1, chunks.size()));
+
+  std::cout << "ProcessorBlock: Processing " << chunks.size() << " chunks "
+            << "with " << nthreads << " threads" << std::endl;
+
+  ROOT::EnableThreadSafety();
+
+  // Copies of the processors for each thread, with in-memory trees
+  std::vector<std::vector<ProcessorBase*> > copies(nthreads);
+  for (size_t w=0; w<nthreads; w++) {
+    for (auto it : fProcessors) {
+      ProcessorBase* c = it.first->Clone();
+      assert(c);
+      c->fBuffered = true;
+      c->Setup(it.second);
+      c->Initialize(it.second);
+      copies[w].push_back(c);
+    }
+  }
+
+  // Each thread starts with a contiguous block of chunks, then steals from
+  // the far end of the other blocks
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> chunks;
+  };
+  std::vector<Queue> queues(nthreads);
+  for (size_t c=0; c<chunks.size(); c++) {
+    queues[c * nthreads / chunks.size()].chunks.push_back(c);
+  }
+
+  auto next = [&](size_t w, size_t& c) {
+    for (size_t k=0; k<nthreads; k++) {
+      Queue& q = queues[(w + k) % nthreads];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.chunks.empty()) {
+        continue;
+      }
+      if (k == 0) {
+        c = q.chunks.front();
+        q.chunks.pop_front();
+      }
+      else {
+        c = q.chunks.back();
+        q.chunks.pop_back();
+      }
+      return true;
+    }
+    return false;
+  };
+
+  // Per-thread event counts, by file
+  std::vector<std::vector<long> > visited(
+    nthreads, std::vector<long>(filenames.size(), 0));
+  std::vector<std::vector<long> > kept(
+    nthreads, std::vector<long>(filenames.size(), 0));
+
+  auto worker = [&](size_t w) {
+    std::vector<ProcessorBase*>& procs = copies[w];
+    std::unique_ptr<gallery::Event> ev;
+    size_t ev_file = 0;
+    std::vector<bool> accept(n);
+
+    size_t c;
+    while (next(w, c)) {
+      Chunk& chunk = chunks[c];
+      chunk.worker = w;
+      for (size_t k=0; k<n; k++) {
+        chunk.begin[k] = procs[k]->fTree->GetEntries();
+      }
+
+      if (!ev || ev_file != chunk.file) {
+        ev.reset(new gallery::Event({ filenames[chunk.file] }));
+        ev_file = chunk.file;
+      }
+      ev->goToEntry(chunk.first);
+
+      for (long entry=chunk.first; entry<chunk.last && !ev->atEnd();
+           entry++, ev->next()) {
+        visited[w][chunk.file]++;
+        if (!KeepEvent(*ev)) {
+          continue;
+        }
+        kept[w][chunk.file]++;
+
+        unsigned int mask = 0;
+        for (size_t k=0; k<n; k++) {
+          procs[k]->fSourceFile = chunk.file;
+          procs[k]->BuildEventTree(*ev);
+          accept[k] = procs[k]->ProcessEvent(*ev);
+          if (accept[k] && k < 32) {
+            mask |= 1u << k;
+          }
+        }
+
+        for (size_t k=0; k<n; k++) {
+          if (accept[k]) {
+            procs[k]->fTree->Fill();
+            procs[k]->fEventIndex++;
+            chunk.rows[k].push_back({ entry, mask });
+          }
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t w=0; w<nthreads; w++) {
+    threads.push_back(std::thread(worker, w));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (size_t w=0; w<nthreads; w++) {
+    for (size_t i=0; i<filenames.size(); i++) {
+      fVisited[i] += visited[w][i];
+      fKept[i] += kept[w][i];
+    }
+  }
+
+  // Write the buffered rows out in chunk order
+  for (size_t k=0; k<n; k++) {
+    ProcessorBase* p = fProcessors[k].first;
+    for (size_t w=0; w<nthreads; w++) {
+      p->fTree->CopyAddresses(copies[w][k]->fTree);
+    }
+
+    for (auto const& chunk : chunks) {
+      TTree* t = copies[chunk.worker][k]->fTree;
+      for (size_t r=0; r<chunk.rows[k].size(); r++) {
+        t->GetEntry(chunk.begin[k] + r);
+        p->fSourceFile = chunk.file;
+        p->fSourceEntry = chunk.rows[k][r].first;
+        p->fPassMask = chunk.rows[k][r].second;
+        p->FillTree();
+      }
+    }
+  }
+
+  for (auto& procs : copies) {
+    for (auto c : procs) {
+      c->fTree->ResetBranchAddresses();
+      delete c;
+    }
+  }
+}
+
+
+std::vector<long> ProcessorBlock::CountEntries(
+    const std::vector<std::string>& filenames) {
+  std::vector<long> entries(filenames.size(), 0);
+
+  for (size_t i=0; i<filenames.size(); i++) {
+    TFile* f = TFile::Open(filenames[i].c_str());
+    TTree* events = (f && !f->IsZombie()) ? (TTree*) f->Get("Events") : NULL;
+    if (events) {
+      entries[i] = events->GetEntries();
+    }
+    else {
+      std::cerr << "ProcessorBlock: Unable to read events from "
+                << filenames[i] << std::endl;
+    }
+    delete f;
+  }
+
+  return entries;
+}
+
+
+void ProcessorBlock::Begin(const std::vector<std::string>& filenames) {
+  fFilePOT.assign(filenames.size(), std::vector<double>(4, 0));
+  fVisited.assign(filenames.size(), 0);
+  fKept.assign(filenames.size(), 0);
+  fEntries.clear();
+  fRangeStart = 0;
+  fPartial = false;
+  fFractions.clear();
+  fSkimFractions.clear();
+
   for (auto it : fProcessors) {
     it.first->Setup(it.second);
     it.first->Initialize(it.second);
+    it.first->fIndex.SetSources(filenames);
+    it.first->fSkimList.SetSources(filenames);
   }
 
-  // Event loop
-  for (gallery::Event ev(filenames); !ev.atEnd(); ev.next()) {
+  if (!fProcessors.empty() && fProcessors[0].second) {
+    fPOTLabel = \
+      fProcessors[0].second->get("POTSummaryTag", fPOTLabel).asString();
+
+    std::string cache_dir = \
+      fProcessors[0].second->get("CacheDir", "").asString();
+
+    bool cacheable = true;
     for (auto it : fProcessors) {
-      it.first->BuildEventTree(ev);
-      bool accept = it.first->ProcessEvent(ev);
-      if (accept) {
-        it.first->FillTree();
+      cacheable &= it.first->IsCacheable();
+    }
+
+    bool partial = (fNShards > 1 || fSkip > 0 || fMaxEvents >= 0 ||
+                    fPrescale > 1);
+
+    if (!cache_dir.empty() && !cacheable) {
+      std::cerr << "ProcessorBlock: Not all processors are cacheable, "
+                << "ignoring CacheDir" << std::endl;
+    }
+    else if (!cache_dir.empty() && partial) {
+      std::cerr << "ProcessorBlock: Caching applies to whole files, "
+                << "ignoring CacheDir with event ranges or prescaling"
+                << std::endl;
+    }
+    else if (!cache_dir.empty()) {
+      fCache = new ResultCache(cache_dir);
+      fCacheKeys.clear();
+      for (auto it : fProcessors) {
+        fCacheKeys.push_back(ResultCache::ProcessorKey(it.first, it.second));
+      }
+    }
+  }
+}
+
+
+void ProcessorBlock::ProcessEvent(gallery::Event& ev, size_t file) {
+  // Count exposure on entering each file
+  if (fPOTFiles.find(file) == fPOTFiles.end()) {
+    AccumulatePOT(ev.getTFile(), file);
+  }
+
+  fVisited[file]++;
+  if (!KeepEvent(ev)) {
+    return;
+  }
+  fKept[file]++;
+
+  // Run all processors first, so the pass mask is complete when filling
+  const long entry = ev.eventEntry();
+  std::vector<bool> accept(fProcessors.size());
+  for (size_t i=0; i<fProcessors.size(); i++) {
+    if (!fReaders.empty() && fReaders[i]) {
+      accept[i] = fReaders[i]->Has(entry);
+      continue;
+    }
+
+    ProcessorBase* p = fProcessors[i].first;
+    p->fSourceFile = file;
+    p->BuildEventTree(ev);
+    accept[i] = p->ProcessEvent(ev);
+  }
+
+  FillEvent(file, entry, accept);
+}
+
+
+bool ProcessorBlock::KeepEvent(gallery::Event& ev) const {
+  if (fPrescale <= 1) {
+    return true;
+  }
+
+  // Deterministic subsample by event ID
+  auto const& aux = ev.eventAuxiliary();
+  util::CounterRNG rng(0, aux.run(), aux.subRun(), aux.event());
+  return rng.Next() % fPrescale == 0;
+}
+
+
+void ProcessorBlock::FillEvent(size_t file, long entry,
+                               const std::vector<bool>& accept) {
+  unsigned int mask = 0;
+  for (size_t i=0; i<accept.size() && i<32; i++) {
+    if (accept[i]) {
+      mask |= 1u << i;
+    }
+  }
+
+  for (size_t i=0; i<fProcessors.size(); i++) {
+    if (!accept[i]) {
+      continue;
+    }
+
+    ProcessorBase* p = fProcessors[i].first;
+
+    if (!fReaders.empty() && fReaders[i]) {
+      fReaders[i]->Load(entry);
+      p->fSourceFile = file;
+      p->fSourceEntry = entry;
+    }
+
+    p->fPassMask = mask;
+    p->FillTree();
+
+    if (!fWriters.empty() && fWriters[i]) {
+      fWriters[i]->Fill(entry);
+    }
+  }
+}
+
+
+void ProcessorBlock::ProcessCachedFile(const std::string& filename,
+                                       size_t file) {
+  const size_t n = fProcessors.size();
+  std::string file_key = ResultCache::FileKey(filename);
+
+  // Look up the cached results for each processor
+  fReaders.assign(n, nullptr);
+  fWriters.assign(n, nullptr);
+  size_t nhits = 0;
+  for (size_t i=0; i<n && !file_key.empty(); i++) {
+    std::string path = fCache->Path(file_key, fCacheKeys[i]);
+    ResultCache::Reader* r = \
+      new ResultCache::Reader(path, fProcessors[i].first->fTree);
+    if (r->IsValid()) {
+      fReaders[i] = r;
+      nhits++;
+    }
+    else {
+      delete r;
+    }
+  }
+
+  if (nhits == n) {
+    // Everything is cached: replay the accepted events, in order
+    std::set<long> entries;
+    for (auto r : fReaders) {
+      std::vector<long> e = r->Entries();
+      entries.insert(e.begin(), e.end());
+    }
+
+    for (long entry : entries) {
+      std::vector<bool> accept(n);
+      for (size_t i=0; i<n; i++) {
+        accept[i] = fReaders[i]->Has(entry);
+      }
+      FillEvent(file, entry, accept);
+    }
+
+    const std::vector<double>& pot = fReaders[0]->GetPOT();
+    if (fPOTFiles.find(file) == fPOTFiles.end() && pot.size() == 5) {
+      fPOTFiles.insert(file);
+      fPOT += pot[0];
+      fGoodPOT += pot[1];
+      fSpills += pot[2];
+      fGoodSpills += pot[3];
+      fNSubRuns += pot[4];
+    }
+  }
+  else {
+    // Read the file, running only the processors without cached results
+    for (size_t i=0; i<n && !file_key.empty(); i++) {
+      if (!fReaders[i]) {
+        std::string path = fCache->Path(file_key, fCacheKeys[i]);
+        fWriters[i] = \
+          new ResultCache::Writer(path, fProcessors[i].first->fTree);
       }
     }
+
+    std::vector<double> pot0 = \
+      { fPOT, fGoodPOT, fSpills, fGoodSpills, (double) fNSubRuns };
+
+    for (gallery::Event ev({ filename }); !ev.atEnd(); ev.next()) {
+      ProcessEvent(ev, file);
+    }
+
+    if (fPOTFiles.find(file) == fPOTFiles.end()) {
+      TFile* f = TFile::Open(filename.c_str());
+      if (f && !f->IsZombie()) {
+        AccumulatePOT(f, file);
+      }
+      delete f;
+    }
+
+    std::vector<double> pot = \
+      { fPOT, fGoodPOT, fSpills, fGoodSpills, (double) fNSubRuns };
+    for (size_t k=0; k<pot.size(); k++) {
+      pot[k] -= pot0[k];
+    }
+
+    for (auto w : fWriters) {
+      if (w) {
+        w->Close(pot);
+      }
+    }
+  }
+
+  std::cout << "ProcessorBlock: " << filename << ": " << nhits << "/" << n
+            << " cached" << std::endl;
+
+  for (size_t i=0; i<n; i++) {
+    delete fReaders[i];
+    delete fWriters[i];
+  }
+  fReaders.clear();
+  fWriters.clear();
+}
+
+
+void ProcessorBlock::End(const std::vector<std::string>& filenames) {
+  const bool ranged = !fEntries.empty();
+
+  // Files without events are not visited by the event loop
+  for (size_t i=0; i<filenames.size(); i++) {
+    if (ranged && fEntries[i] > 0 && fVisited[i] == 0) {
+      continue;  // Out of range
+    }
+    if (fPOTFiles.find(i) == fPOTFiles.end()) {
+      TFile* f = TFile::Open(filenames[i].c_str());
+      if (f && !f->IsZombie()) {
+        AccumulatePOT(f, i);
+      }
+      delete f;
+    }
+  }
+
+  std::cout << "ProcessorBlock: " << fPOT << " POT (" << fGoodPOT
+            << " good) in " << fNSubRuns << " subruns" << std::endl;
+
+  // Scale the exposure of each file by the fraction of its events used
+  fRawPOT = fPOT;
+  if (fPartial || fPrescale > 1 || !fSkimFractions.empty()) {
+    CorrectPOT(filenames.size());
+
+    std::cout << "ProcessorBlock: " << fPOT << " POT after range and "
+              << "prescale corrections" << std::endl;
   }
 
   // Finalize
   for (auto it : fProcessors) {
+    it.first->fSkimList.SetFractions(fFractions);
+    it.first->fPOT = fPOT;
     it.first->Finalize();
+    WritePOT(it.first);
     it.first->Teardown();
   }
 }
 
 
+void ProcessorBlock::CorrectPOT(size_t nfiles) {
+  const bool ranged = !fEntries.empty();
+
+  fPOT = fGoodPOT = fSpills = fGoodSpills = 0;
+  fFractions.assign(nfiles, 1.0);
+  for (size_t i=0; i<nfiles; i++) {
+    long n = ranged ? fEntries[i] : fVisited[i];
+    double fraction;
+    if (!fSkimFractions.empty()) {
+      // As counted by the job that wrote the skim list
+      fraction = fSkimFractions[i];
+    }
+    else if (n > 0) {
+      fraction = 1.0 * fKept[i] / n;
+    }
+    else {
+      // Files without events are assigned to the first range
+      fraction = (fRangeStart == 0 ? 1.0 : 0.0) / fPrescale;
+    }
+    fFractions[i] = fraction;
+    fPOT += fraction * fFilePOT[i][0];
+    fGoodPOT += fraction * fFilePOT[i][1];
+    fSpills += fraction * fFilePOT[i][2];
+    fGoodSpills += fraction * fFilePOT[i][3];
+  }
+}
+
+
+void ProcessorBlock::AccumulatePOT(TFile* f, size_t index) {
+  fPOTFiles.insert(index);
+
+  TTree* subruns = (TTree*) f->Get("SubRuns");
+  if (!subruns) {
+    std::cerr << "ProcessorBlock: No SubRuns tree in " << f->GetName()
+              << std::endl;
+    return;
+  }
+
+  // Branches are named <class>_<label>_<instance>_<process>.
+  std::string prefix = "sumdata::POTSummary_" + fPOTLabel + "_";
+  TBranch* branch = nullptr;
+  TObjArray* branches = subruns->GetListOfBranches();
+  for (int i=0; i<branches->GetEntriesFast(); i++) {
+    std::string name = branches->At(i)->GetName();
+    if (name.compare(0, prefix.size(), prefix) == 0) {
+      branch = (TBranch*) branches->At(i);
+      break;
+    }
+  }
+
+  if (!branch) {
+    std::cerr << "ProcessorBlock: No POTSummary with label " << fPOTLabel
+              << " in " << f->GetName() << std::endl;
+    return;
+  }
+
+  art::Wrapper<sumdata::POTSummary>* pot = nullptr;
+  branch->SetAddress(&pot);
+
+  for (long i=0; i<branch->GetEntries(); i++) {
+    branch->GetEntry(i);
+    if (!pot || !pot->isPresent()) {
+      continue;
+    }
+    const sumdata::POTSummary* s = pot->product();
+    fPOT += s->totpot;
+    fGoodPOT += s->totgoodpot;
+    fSpills += s->totspills;
+    fGoodSpills += s->goodspills;
+    fNSubRuns++;
+
+    if (index < fFilePOT.size()) {
+      fFilePOT[index][0] += s->totpot;
+      fFilePOT[index][1] += s->totgoodpot;
+      fFilePOT[index][2] += s->totspills;
+      fFilePOT[index][3] += s->goodspills;
+    }
+  }
+
+  branch->ResetAddress();
+  delete pot;
+}
+
+
+void ProcessorBlock::WritePOT(ProcessorBase* processor) {
+  processor->fOutputFile->cd();
+
+  // Replace any values written at a checkpoint
+  const int opt = TObject::kOverwrite;
+  TParameter<double>("pot", fPOT).Write(nullptr, opt);
+  TParameter<double>("goodpot", fGoodPOT).Write(nullptr, opt);
+  TParameter<double>("spills", fSpills).Write(nullptr, opt);
+  TParameter<double>("goodspills", fGoodSpills).Write(nullptr, opt);
+
+  if (fRawPOT != fPOT || fPrescale > 1) {
+    TParameter<double>("rawpot", fRawPOT).Write(nullptr, opt);
+    TParameter<double>("prescale", fPrescale).Write(nullptr, opt);
+  }
+}
+
+
 void ProcessorBlock::DeleteProcessors() {
   for (auto it : fProcessors) {
     delete it.first;
@@ -9,8 +9,16 @@
  * Author: A. Mastbaum <mastbaum@uchicago.edu>, 2018/01/30
  */
 
+#include <set>
 #include <string>
 #include <vector>
+#include "ResultCache.hh"
+
+class TFile;
+
+namespace gallery {
+  class Event;
+}
 
 namespace Json {
   class Value;
@@ -18,6 +26,10 @@ namespace Json {
 
 namespace core {
 
+class FileWatcher;
+class ProcessorBase;
+class SkimList;
+
 /**
  * \class core::ProcessorBlock
  * \brief A set of Processors
@@ -43,16 +55,287 @@ public:
   /**
    * Process a set of files.
    *
+   * The POT and spill counts from the SubRun POTSummary products of all
+   * files are added up as each file is entered, and written to every
+   * processor's output file as TParameter<double> objects "pot",
+   * "goodpot", "spills" and "goodspills". The POTSummary label is set by
+   * "POTSummaryTag" (default "generator") in the first configuration.
+   *
+   * If the first configuration sets "CacheDir", the results of each
+   * processor on each file are kept there (see ResultCache), and files are
+   * only read for processors without an up-to-date entry. Files for which
+   * every processor has an entry are not opened at all. The cache is only
+   * used if all processors are cacheable (ProcessorBase::IsCacheable).
+   *
    * \param filenames A list of art ROOT files to process
    */
   virtual void ProcessFiles(std::vector<std::string> filenames);
 
+  /**
+   * Process the events in a skim list.
+   *
+   * Only the listed entries of the source files are read, jumping directly
+   * to each. The POT is that counted by the job that wrote the list: that
+   * of all of the source files, scaled by the list's fractions if that job
+   * used an event range or prescale. Ranges and prescaling do not apply
+   * here, and are ignored.
+   *
+   * \param skim The skim list (see SkimList)
+   * \param mask Process only entries accepted by one of these processors
+   */
+  virtual void ProcessSkim(const SkimList& skim, unsigned int mask=~0u);
+
+  /**
+   * Process files as they arrive, until stopped (FileWatcher::Stop) or
+   * idle (see SetIdleTimeout).
+   *
+   * Each new file is processed as a whole as soon as it can be read, with
+   * processor state kept between files. While new events arrive, a
+   * snapshot of every output is written at most once per checkpoint
+   * interval (see ProcessorBase::Checkpoint), with the POT so far. The
+   * outputs are finalized when the stream ends, as for ProcessFiles.
+   * Event ranges and threads do not apply; the result cache and prescale
+   * do.
+   *
+   * \param watcher The source of new files
+   */
+  virtual void ProcessStream(FileWatcher& watcher);
+
   /** Delete all processors owned by the block. */
   virtual void DeleteProcessors();
 
+  /**
+   * Process only one of several equal shards of the input events.
+   *
+   * The events of all files, in order, are divided into count contiguous
+   * ranges of (nearly) equal size, and only range index is processed.
+   *
+   * \param index The shard index, from 0
+   * \param count The number of shards
+   */
+  void SetShard(size_t index, size_t count) {
+    fShard = index;
+    fNShards = count;
+  }
+
+  /** Skip the first n events (of the shard, if sharded). */
+  void SetSkip(long n) { fSkip = n; }
+
+  /** Process at most n events (after skipping), or all if negative. */
+  void SetMaxEvents(long n) { fMaxEvents = n; }
+
+  /**
+   * Process a deterministic subsample of 1 in n events.
+   *
+   * Events are chosen with a hash of (run, subrun, event), so the same
+   * events are chosen regardless of sharding or file order.
+   *
+   * \param n The prescale factor
+   */
+  void SetPrescale(unsigned int n) { fPrescale = n; }
+
+  /**
+   * Process events in several threads.
+   *
+   * The events (of the range, if set) are split into chunks of
+   * consecutive entries within a file. Each thread starts with a
+   * contiguous block of chunks and, when done, takes chunks from the far
+   * end of the other threads' blocks. Threads have their own
+   * gallery::Event and copies of the processors (ProcessorBase::Clone),
+   * which fill in-memory trees; these are written out in chunk order after
+   * the event loop, so the output is the same as for a single thread.
+   * Only used if all processors are thread-safe
+   * (ProcessorBase::IsThreadSafe) and no result cache is in use.
+   *
+   * \param n The number of threads
+   */
+  void SetThreads(size_t n) { fThreads = n; }
+
+  /** Set the number of events per chunk, for threaded processing. */
+  void SetChunkSize(long n) { fChunkSize = n; }
+
+  /** Set the minimum time between stream checkpoints, in seconds. */
+  void SetCheckpointInterval(double s) { fCheckpointInterval = s; }
+
+  /** End a stream after this many seconds without new files (0: never). */
+  void SetIdleTimeout(double s) { fIdleTimeout = s; }
+
+  /**
+   * Set the number of events in each input file, e.g. from a Catalog,
+   * so files need not be opened to divide the events into ranges.
+   *
+   * \param entries The number of events in each file, in input order
+   */
+  void SetEntryCounts(const std::vector<long>& entries) {
+    fEntryCounts = entries;
+  }
+
+  /**
+   * Count the events in each file, from the art Events tree.
+   *
+   * \param filenames The files
+   * \returns The number of events in each file (0 if unreadable)
+   */
+  static std::vector<long> CountEntries(
+      const std::vector<std::string>& filenames);
+
 protected:
+  /**
+   * Set up and initialize all processors.
+   *
+   * \param filenames The input files
+   */
+  void Begin(const std::vector<std::string>& filenames);
+
+  /**
+   * Run all processors on an event.
+   *
+   * \param ev The event
+   * \param file The index of the event's file in the input list
+   */
+  void ProcessEvent(gallery::Event& ev, size_t file);
+
+  /**
+   * Check whether a file is complete enough to process: it opens without
+   * recovery and has an Events tree.
+   *
+   * \param filename The file path
+   * \returns True if the file can be processed
+   */
+  static bool IsComplete(const std::string& filename);
+
+  /**
+   * Write a snapshot of every processor's output, with the POT so far.
+   *
+   * \param filenames The files processed so far
+   */
+  void Checkpoint(const std::vector<std::string>& filenames);
+
+  /**
+   * Find the range of events to process over all files (see SetShard,
+   * SetSkip and SetMaxEvents), counting the events in each file.
+   *
+   * \param filenames The input files
+   * \param lo The first event
+   * \param hi One past the last event
+   */
+  void GetRange(const std::vector<std::string>& filenames, long& lo,
+                long& hi);
+
+  /**
+   * Process the configured range of events, reading only the files that
+   * overlap it.
+   *
+   * \param filenames The input files
+   */
+  void ProcessRange(const std::vector<std::string>& filenames);
+
+  /**
+   * Process the configured range of events in several threads (see
+   * SetThreads).
+   *
+   * \param filenames The input files
+   */
+  void ProcessParallel(const std::vector<std::string>& filenames);
+
+  /**
+   * Apply the prescale.
+   *
+   * \param ev The event
+   * \returns True if the event is kept
+   */
+  bool KeepEvent(gallery::Event& ev) const;
+
+  /**
+   * Process one file using the result cache.
+   *
+   * \param filename The file path
+   * \param file The index of the file in the input list
+   */
+  void ProcessCachedFile(const std::string& filename, size_t file);
+
+  /**
+   * Fill the output of every processor that accepted an event.
+   *
+   * Processors served from the cache have the cached row loaded first,
+   * and processors writing to the cache record the event.
+   *
+   * \param file The index of the event's file in the input list
+   * \param entry The entry of the event in its file
+   * \param accept Whether each processor accepted the event
+   */
+  void FillEvent(size_t file, long entry, const std::vector<bool>& accept);
+
+  /**
+   * Count the remaining POT, then finalize all processors.
+   *
+   * When only part of the events were processed (a range or prescale),
+   * the POT of each file is scaled by the fraction of its events that
+   * were processed, so the written POT matches the events in the output.
+   * The uncorrected total is also written, as "rawpot", with the
+   * prescale factor as "prescale".
+   *
+   * \param filenames The input files
+   */
+  void End(const std::vector<std::string>& filenames);
+
+  /**
+   * Scale the POT totals by the fraction of each file's events processed
+   * (or by the fractions of a skim list being processed), and record the
+   * fractions for the processors' skim lists.
+   *
+   * \param nfiles The number of input files
+   */
+  void CorrectPOT(size_t nfiles);
+
+  /**
+   * Add the POT summaries in a file's SubRuns tree to the totals.
+   *
+   * \param f The open file
+   * \param index The index of the file in the input list
+   */
+  void AccumulatePOT(TFile* f, size_t index);
+
+  /**
+   * Write the POT totals to a processor's output file.
+   *
+   * \param processor The processor
+   */
+  void WritePOT(ProcessorBase* processor);
+
   /** Processors and their configurations. */
   std::vector<std::pair<ProcessorBase*, Json::Value*> > fProcessors;
+
+  std::string fPOTLabel;  //!< Module label of the POTSummary products
+  std::set<size_t> fPOTFiles;  //!< Indices of files already counted
+  double fPOT;  //!< Total POT
+  double fGoodPOT;  //!< Total good POT
+  double fSpills;  //!< Total spills
+  double fGoodSpills;  //!< Total good spills
+  size_t fNSubRuns;  //!< Number of subruns counted
+  std::vector<std::vector<double> > fFilePOT;  //!< Per-file POT counts
+  double fRawPOT;  //!< Total POT before range and prescale corrections
+  std::vector<double> fFractions;  //!< POT fraction of each file counted
+  std::vector<double> fSkimFractions;  //!< POT fractions of a skim input
+  size_t fShard;  //!< Shard index
+  size_t fNShards;  //!< Number of shards
+  long fSkip;  //!< Events to skip
+  long fMaxEvents;  //!< Maximum events to process (all if negative)
+  unsigned int fPrescale;  //!< Prescale factor
+  long fRangeStart;  //!< First event processed, over all files
+  bool fPartial;  //!< The range excludes some events
+  size_t fThreads;  //!< Number of threads
+  long fChunkSize;  //!< Events per chunk, for threaded processing
+  double fCheckpointInterval;  //!< Seconds between stream checkpoints
+  double fIdleTimeout;  //!< Seconds without new files to end a stream
+  std::vector<long> fEntries;  //!< Events per file (in range mode)
+  std::vector<long> fEntryCounts;  //!< Events per file, if known in advance
+  std::vector<long> fVisited;  //!< Events read per file
+  std::vector<long> fKept;  //!< Events passing the prescale per file
+  ResultCache* fCache;  //!< Result cache (null if disabled)
+  std::vector<std::string> fCacheKeys;  //!< Processor cache keys
+  std::vector<ResultCache::Reader*> fReaders;  //!< Cached results, by processor
+  std::vector<ResultCache::Writer*> fWriters;  //!< Cache entries being written
 };
 
 }  // namespace core
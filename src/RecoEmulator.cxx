@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <json/json.h>
+#include "CounterRNG.hh"
+#include "RecoEmulator.hh"
+
+namespace util {
+
+void RecoEmulator::Particles::clear() {
+  id.clear();
+  pdg.clear();
+  energy.clear();
+}
+
+
+void RecoEmulator::Particles::push_back(int _id, int _pdg, double _energy) {
+  id.push_back(_id);
+  pdg.push_back(_pdg);
+  energy.push_back(_energy);
+}
+
+
+RecoEmulator::RecoEmulator(uint64_t seed)
+    : fSeed(seed), fEfficiencyAsWeight(false) {}
+
+
+void RecoEmulator::Configure(const Json::Value& config) {
+  fSeed = config.get("Seed", 0).asUInt64();
+  fEfficiencyAsWeight = config.get("EfficiencyAsWeight", false).asBool();
+
+  for (auto const& pc : config["Particles"]) {
+    ParticleClass c;
+    for (auto const& pdg : pc["PDG"]) {
+      c.pdgs.push_back(pdg.asInt());
+    }
+    c.scale = pc.get("Scale", 1.0).asDouble();
+    c.stochastic = pc.get("Stochastic", 0.0).asDouble();
+    c.constant = pc.get("Constant", 0.0).asDouble();
+
+    const Json::Value& eff = pc["Efficiency"];
+    for (auto const& e : eff["Energy"]) {
+      c.eff_energy.push_back(e.asDouble());
+    }
+    for (auto const& v : eff["Value"]) {
+      c.eff_value.push_back(v.asDouble());
+    }
+
+    double p = 0;
+    for (auto const& m : pc["Confusion"]) {
+      p += m.get("Probability", 0.0).asDouble();
+      c.mis_pdg.push_back(m["PDG"].asInt());
+      c.mis_cdf.push_back(p);
+    }
+
+    AddClass(c);
+  }
+}
+
+
+void RecoEmulator::AddClass(const ParticleClass& c) {
+  if (c.eff_energy.size() != c.eff_value.size()) {
+    std::cerr << "RecoEmulator: Efficiency table size mismatch" << std::endl;
+    assert(false);
+  }
+
+  if (!c.mis_cdf.empty() && c.mis_cdf.back() > 1) {
+    std::cerr << "RecoEmulator: Confusion probabilities exceed 1"
+              << std::endl;
+    assert(false);
+  }
+
+  int index = fClasses.size();
+  fClasses.push_back(c);
+  for (auto pdg : c.pdgs) {
+    fClassIndex[std::abs(pdg)] = index;
+  }
+}
+
+
+void RecoEmulator::Emulate(uint64_t run, uint64_t subrun, uint64_t event,
+                           Particles& p) const {
+  const size_t n = p.size();
+  p.reco_pdg.assign(p.pdg.begin(), p.pdg.end());
+  p.reco_energy.resize(n);
+  p.efficiency.assign(n, 1.0);
+  p.detected.assign(n, 1);
+  p.cls.resize(n);
+  p.rnd.resize(4 * n);
+
+  // Class lookup, and four uniform deviates per particle from the
+  // particle's own stream: two for the smearing, one for the efficiency
+  // and one for the particle ID
+  for (size_t i=0; i<n; i++) {
+    auto it = fClassIndex.find(std::abs(p.pdg[i]));
+    p.cls[i] = (it == fClassIndex.end() ? -1 : it->second);
+
+    CounterRNG rng(fSeed, run, subrun, event, (uint64_t) (int64_t) p.id[i]);
+    double* u = p.rnd.data() + 4 * i;
+    u[0] = rng.Uniform();
+    u[1] = rng.Uniform();
+    u[2] = rng.Uniform();
+    u[3] = rng.Uniform();
+  }
+
+  // Energy smearing, as a flat loop over particles
+  const int* cls = p.cls.data();
+  const double* e = p.energy.data();
+  const double* u = p.rnd.data();
+  double* ereco = p.reco_energy.data();
+  for (size_t i=0; i<n; i++) {
+    if (cls[i] < 0) {
+      ereco[i] = e[i];
+      continue;
+    }
+    const ParticleClass& c = fClasses[cls[i]];
+    double g = sqrt(-2 * log(u[4 * i])) * cos(2 * M_PI * u[4 * i + 1]);
+    double st = (e[i] > 0 ? c.stochastic / sqrt(e[i] / 1000) : 0);
+    double sigma = sqrt(st * st + c.constant * c.constant);
+    ereco[i] = std::max(0.0, e[i] * c.scale * (1 + sigma * g));
+  }
+
+  // Efficiency and particle ID confusion
+  for (size_t i=0; i<n; i++) {
+    if (cls[i] < 0) {
+      continue;
+    }
+    const ParticleClass& c = fClasses[cls[i]];
+
+    if (!c.eff_energy.empty()) {
+      const std::vector<double>& te = c.eff_energy;
+      const std::vector<double>& tv = c.eff_value;
+      double eff;
+      if (e[i] <= te.front()) {
+        eff = tv.front();
+      }
+      else if (e[i] >= te.back()) {
+        eff = tv.back();
+      }
+      else {
+        size_t k = std::upper_bound(te.begin(), te.end(), e[i]) - te.begin();
+        double f = (e[i] - te[k - 1]) / (te[k] - te[k - 1]);
+        eff = tv[k - 1] + f * (tv[k] - tv[k - 1]);
+      }
+      p.efficiency[i] = eff;
+      if (!fEfficiencyAsWeight) {
+        p.detected[i] = (u[4 * i + 2] < eff);
+      }
+    }
+
+    for (size_t k=0; k<c.mis_cdf.size(); k++) {
+      if (u[4 * i + 3] < c.mis_cdf[k]) {
+        p.reco_pdg[i] = (p.pdg[i] < 0 ? -1 : 1) * c.mis_pdg[k];
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace util
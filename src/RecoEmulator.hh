@@ -0,0 +1,149 @@
+#ifndef __ts_RecoEmulator__
+#define __ts_RecoEmulator__
+
+/**
+ * \file RecoEmulator.hh
+ *
+ * Deterministic emulation of reconstruction from true particles.
+ */
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace Json {
+  class Value;
+}
+
+namespace util {
+
+/**
+ * \class RecoEmulator
+ * \brief Per-particle energy smearing, efficiency and particle ID confusion
+ *
+ * Particles are grouped into classes by |PDG| code. For each class:
+ *
+ *   E_reco = E * Scale * (1 + sigma * g),
+ *   sigma = sqrt((Stochastic / sqrt(E / GeV))^2 + Constant^2),
+ *
+ * with g a standard normal deviate, an efficiency interpolated linearly in
+ * true energy, and a list of reconstructed PDG codes the particle may be
+ * mistaken for, with probabilities. Particles in no class pass through
+ * unchanged.
+ *
+ * Random numbers for a particle come from a counter-based stream keyed by
+ * (seed, run, subrun, event, particle ID), so results are identical
+ * regardless of how events are divided among threads, files or jobs.
+ * Emulate is const and safe to call concurrently.
+ */
+class RecoEmulator {
+public:
+  /**
+   * \struct RecoEmulator::ParticleClass
+   * \brief Response parameters for a class of particles
+   */
+  struct ParticleClass {
+    ParticleClass() : scale(1), stochastic(0), constant(0) {}
+
+    std::vector<int> pdgs;  //!< PDG codes (absolute values)
+    double scale;  //!< Energy scale
+    double stochastic;  //!< Stochastic resolution term, at 1 GeV
+    double constant;  //!< Constant resolution term
+    std::vector<double> eff_energy;  //!< Efficiency table energies [MeV]
+    std::vector<double> eff_value;  //!< Efficiency table values
+    std::vector<int> mis_pdg;  //!< Confused PDG codes
+    std::vector<double> mis_cdf;  //!< Cumulative confusion probabilities
+  };
+
+  /**
+   * \struct RecoEmulator::Particles
+   * \brief The particles of one event, as parallel arrays
+   */
+  struct Particles {
+    /** Remove all particles, keeping storage. */
+    void clear();
+
+    /**
+     * Add a true particle.
+     *
+     * \param id Particle ID, unique within the event (e.g. the track ID)
+     * \param pdg PDG code
+     * \param energy True energy [MeV]
+     */
+    void push_back(int id, int pdg, double energy);
+
+    /** Number of particles. */
+    size_t size() const { return id.size(); }
+
+    std::vector<int> id;  //!< Particle IDs
+    std::vector<int> pdg;  //!< True PDG codes
+    std::vector<double> energy;  //!< True energies [MeV]
+
+    std::vector<int> reco_pdg;  //!< Reconstructed PDG codes
+    std::vector<double> reco_energy;  //!< Reconstructed energies [MeV]
+    std::vector<double> efficiency;  //!< Reconstruction efficiency
+    std::vector<char> detected;  //!< Particle was reconstructed
+
+    std::vector<int> cls;  //!< Working storage: class index per particle
+    std::vector<double> rnd;  //!< Working storage: uniform deviates
+  };
+
+  /**
+   * Constructor.
+   *
+   * \param seed The global seed
+   */
+  RecoEmulator(uint64_t seed=0);
+
+  /**
+   * Configure from JSON.
+   *
+   * { "Seed": 0, "EfficiencyAsWeight": false, "Particles": [
+   *   { "PDG": [11, 22], "Scale": 1.0, "Stochastic": 0.15,
+   *     "Constant": 0.02, "Efficiency": { "Energy": [...],
+   *     "Value": [...] }, "Confusion": [{ "PDG": 22, "Probability": 0.05 }]
+   *   }, ...] }
+   *
+   * With "EfficiencyAsWeight", every particle is detected and the
+   * efficiency is left for the caller to use as a weight, instead of
+   * rejecting particles at random.
+   *
+   * \param config The configuration
+   */
+  void Configure(const Json::Value& config);
+
+  /**
+   * Add a particle class.
+   *
+   * \param c The class parameters
+   */
+  void AddClass(const ParticleClass& c);
+
+  /**
+   * Emulate the reconstruction of one event.
+   *
+   * \param run Run number
+   * \param subrun Subrun number
+   * \param event Event number
+   * \param p The particles; reconstructed fields are overwritten
+   */
+  void Emulate(uint64_t run, uint64_t subrun, uint64_t event,
+               Particles& p) const;
+
+  /** Set whether efficiencies are weights rather than rejections. */
+  void SetEfficiencyAsWeight(bool w) { fEfficiencyAsWeight = w; }
+
+  /** Get whether efficiencies are weights rather than rejections. */
+  bool GetEfficiencyAsWeight() const { return fEfficiencyAsWeight; }
+
+protected:
+  uint64_t fSeed;  //!< Global seed
+  bool fEfficiencyAsWeight;  //!< Efficiencies are weights
+  std::vector<ParticleClass> fClasses;  //!< Particle classes
+  std::map<int, int> fClassIndex;  //!< |PDG| to class index
+};
+
+}  // namespace util
+
+#endif  // __ts_RecoEmulator__
+
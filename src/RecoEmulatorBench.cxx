@@ -0,0 +1,125 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <CounterRNG.hh>
+#include <RecoEmulator.hh>
+
+/**
+ * Emulate a range of synthetic events.
+ *
+ * Events are generated from their index, so any range can be processed
+ * independently.
+ *
+ * \param emu The emulator
+ * \param first First event index
+ * \param last One past the last event index
+ * \param nparticles Particles per event
+ * \param sum Output: sum of reconstructed energies of detected particles
+ */
+void Run(const util::RecoEmulator& emu, size_t first, size_t last,
+         size_t nparticles, double* sum) {
+  static const int pdgs[] = { 11, 13, 22, 211, 2212, 2112 };
+
+  util::RecoEmulator::Particles p;
+  double s = 0;
+
+  for (size_t ev=first; ev<last; ev++) {
+    util::CounterRNG rng(0, ev);
+
+    p.clear();
+    for (size_t i=0; i<nparticles; i++) {
+      p.push_back(i + 1, pdgs[rng.Next() % 6], 50 + 1950 * rng.Uniform());
+    }
+
+    emu.Emulate(1, ev / 100, ev, p);
+
+    for (size_t i=0; i<p.size(); i++) {
+      if (p.detected[i]) {
+        s += p.reco_energy[i];
+      }
+    }
+  }
+
+  *sum = s;
+}
+
+
+int main(int argc, char* argv[]) {
+  size_t nevents = (argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000);
+  size_t nthreads = (argc > 2 ? strtoul(argv[2], nullptr, 10) :
+                     std::thread::hardware_concurrency());
+  const size_t nparticles = 8;
+  nthreads = std::max<size_t>(nthreads, 1);
+
+  // A plausible detector: showers, tracks and confusion between them
+  util::RecoEmulator emu(1);
+
+  util::RecoEmulator::ParticleClass em;
+  em.pdgs = { 11, 22 };
+  em.stochastic = 0.15;
+  em.constant = 0.02;
+  em.eff_energy = { 0, 30, 200 };
+  em.eff_value = { 0, 0.5, 0.9 };
+  em.mis_pdg = { 22 };
+  em.mis_cdf = { 0.05 };
+  emu.AddClass(em);
+
+  util::RecoEmulator::ParticleClass mip;
+  mip.pdgs = { 13, 211 };
+  mip.stochastic = 0.03;
+  mip.constant = 0.05;
+  mip.eff_energy = { 100, 200 };
+  mip.eff_value = { 0, 0.95 };
+  mip.mis_pdg = { 211 };
+  mip.mis_cdf = { 0.1 };
+  emu.AddClass(mip);
+
+  util::RecoEmulator::ParticleClass proton;
+  proton.pdgs = { 2212 };
+  proton.scale = 0.98;
+  proton.constant = 0.1;
+  proton.eff_energy = { 938, 980 };
+  proton.eff_value = { 0, 0.9 };
+  emu.AddClass(proton);
+
+  // Single thread
+  double sum1;
+  auto t0 = std::chrono::steady_clock::now();
+  Run(emu, 0, nevents, nparticles, &sum1);
+  auto t1 = std::chrono::steady_clock::now();
+
+  // Threaded, with the events split in contiguous ranges
+  std::vector<double> sums(nthreads, 0);
+  std::vector<std::thread> threads;
+  for (size_t i=0; i<nthreads; i++) {
+    threads.push_back(std::thread(Run, std::cref(emu),
+                                  nevents * i / nthreads,
+                                  nevents * (i + 1) / nthreads,
+                                  nparticles, &sums[i]));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  double sumn = 0;
+  for (auto s : sums) {
+    sumn += s;
+  }
+
+  double ts = std::chrono::duration<double>(t1 - t0).count();
+  double tn = std::chrono::duration<double>(t2 - t1).count();
+
+  std::cout << "RecoEmulatorBench: " << nevents << " events, "
+            << nparticles << " particles each" << std::endl;
+  std::cout << "  1 thread: " << nevents / ts << " events/s" << std::endl;
+  std::cout << "  " << nthreads << " threads: " << nevents / tn
+            << " events/s" << std::endl;
+  std::cout << "  Energy sums: " << sum1 << " / " << sumn
+            << (std::abs(sum1 - sumn) <= 1e-9 * std::abs(sum1) ?
+                " (match)" : " (MISMATCH)") << std::endl;
+
+  return 0;
+}
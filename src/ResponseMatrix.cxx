@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <TVectorD.h>
+#include "ResponseMatrix.hh"
+
+namespace util {
+
+ResponseMatrix::ResponseMatrix(const std::vector<double>& _true_edges,
+                               const std::vector<double>& _reco_edges)
+    : true_edges(_true_edges), reco_edges(_reco_edges), nuniverses(0),
+      has_universes(false) {
+  assert(true_edges.size() > 1 && reco_edges.size() > 1);
+  norm.resize(true_edges.size() - 1, 0);
+}
+
+
+void ResponseMatrix::Fill(double etrue, double ereco, bool selected,
+                          double weight,
+                          const std::vector<double>& universes) {
+  // Fix the universe count with the first weighted event, copying the
+  // central value into the universes of anything filled before it
+  if (!has_universes && !universes.empty()) {
+    size_t n = universes.size();
+    auto restride = [n](std::vector<double>& v) {
+      std::vector<double> r((v.size()) * (n + 1));
+      for (size_t i=0; i<v.size(); i++) {
+        std::fill(r.begin() + i * (n + 1), r.begin() + (i + 1) * (n + 1),
+                  v[i]);
+      }
+      v.swap(r);
+    };
+    restride(norm);
+    restride(values);
+    nuniverses = n;
+    has_universes = true;
+  }
+
+  const size_t stride = nuniverses + 1;
+
+  auto it = std::upper_bound(true_edges.begin(), true_edges.end(), etrue);
+  if (it == true_edges.begin() || it == true_edges.end()) {
+    return;
+  }
+  const size_t t = it - true_edges.begin() - 1;
+
+  const size_t nu = std::min(nuniverses, universes.size());
+
+  double* nrow = norm.data() + t * stride;
+  nrow[0] += 1;
+  for (size_t u=0; u<nu; u++) {
+    nrow[u + 1] += universes[u];
+  }
+  for (size_t u=nu; u<nuniverses; u++) {
+    nrow[u + 1] += 1;
+  }
+
+  if (!selected) {
+    return;
+  }
+
+  it = std::upper_bound(reco_edges.begin(), reco_edges.end(), ereco);
+  if (it == reco_edges.begin() || it == reco_edges.end()) {
+    return;
+  }
+  const size_t r = it - reco_edges.begin() - 1;
+
+  const size_t key = t * (reco_edges.size() - 1) + r;
+  auto cell = cells.find(key);
+  if (cell == cells.end()) {
+    cell = cells.insert({ key, cells.size() }).first;
+    values.resize(values.size() + stride, 0);
+  }
+
+  double* vrow = values.data() + cell->second * stride;
+  vrow[0] += weight;
+  for (size_t u=0; u<nu; u++) {
+    vrow[u + 1] += weight * universes[u];
+  }
+  for (size_t u=nu; u<nuniverses; u++) {
+    vrow[u + 1] += weight;
+  }
+}
+
+
+void ResponseMatrix::Compress(std::vector<int>& rowptr,
+                              std::vector<int>& colidx,
+                              std::vector<double>& _values) const {
+  const size_t ntrue = true_edges.size() - 1;
+  const size_t nreco = reco_edges.size() - 1;
+  const size_t stride = nuniverses + 1;
+  const size_t nnz = cells.size();
+
+  // Order cells by (true, reco)
+  std::vector<std::pair<size_t, size_t> > order(cells.begin(), cells.end());
+  std::sort(order.begin(), order.end());
+
+  rowptr.assign(ntrue + 1, 0);
+  colidx.resize(nnz);
+  _values.assign(stride * nnz, 0);
+
+  for (size_t k=0; k<nnz; k++) {
+    size_t t = order[k].first / nreco;
+    size_t r = order[k].first % nreco;
+    rowptr[t + 1]++;
+    colidx[k] = r;
+
+    const double* vrow = values.data() + order[k].second * stride;
+    const double* nrow = norm.data() + t * stride;
+    for (size_t u=0; u<stride; u++) {
+      _values[u * nnz + k] = (nrow[u] > 0 ? vrow[u] / nrow[u] : 0);
+    }
+  }
+
+  for (size_t t=0; t<ntrue; t++) {
+    rowptr[t + 1] += rowptr[t];
+  }
+}
+
+
+void ResponseMatrix::Write(const std::string& name) const {
+  const size_t ntrue = true_edges.size() - 1;
+  const size_t stride = nuniverses + 1;
+
+  std::vector<int> rowptr, colidx;
+  std::vector<double> v;
+  Compress(rowptr, colidx, v);
+
+  std::string prefix = "response_" + name + "_";
+
+  TVectorD te(true_edges.size(), true_edges.data());
+  te.Write((prefix + "true_edges").c_str(), TObject::kOverwrite);
+
+  TVectorD re(reco_edges.size(), reco_edges.data());
+  re.Write((prefix + "reco_edges").c_str(), TObject::kOverwrite);
+
+  TVectorD rp(rowptr.size());
+  for (size_t i=0; i<rowptr.size(); i++) {
+    rp[i] = rowptr[i];
+  }
+  rp.Write((prefix + "rowptr").c_str(), TObject::kOverwrite);
+
+  // Empty vectors are not written
+  if (!colidx.empty()) {
+    TVectorD ci(colidx.size());
+    for (size_t i=0; i<colidx.size(); i++) {
+      ci[i] = colidx[i];
+    }
+    ci.Write((prefix + "colidx").c_str(), TObject::kOverwrite);
+
+    TVectorD vals(v.size(), v.data());
+    vals.Write((prefix + "values").c_str(), TObject::kOverwrite);
+  }
+
+  TVectorD nm(stride * ntrue);
+  for (size_t t=0; t<ntrue; t++) {
+    for (size_t u=0; u<stride; u++) {
+      nm[u * ntrue + t] = norm[t * stride + u];
+    }
+  }
+  nm.Write((prefix + "norm").c_str(), TObject::kOverwrite);
+
+  std::cout << "ResponseMatrix: Wrote " << name << " ("
+            << ntrue << "x" << reco_edges.size() - 1 << ", "
+            << colidx.size() << " nonzero, "
+            << nuniverses << " universes)" << std::endl;
+}
+
+}  // namespace util
+
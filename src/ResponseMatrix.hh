@@ -0,0 +1,102 @@
+#ifndef __ts_ResponseMatrix__
+#define __ts_ResponseMatrix__
+
+/**
+ * \file ResponseMatrix.hh
+ *
+ * Sparse true-vs-reco response matrices with systematic universes.
+ */
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace util {
+
+/**
+ * \class ResponseMatrix
+ * \brief Accumulates response matrices for a selection in its event loop
+ *
+ * Every event in the true-energy range is counted in its true bin (the
+ * normalization), and selected events are also counted in their
+ * (true, reco) cell with the selection weight. The response element is
+ * the ratio, R[t][r] = P(selected, reco bin r | true bin t), so it
+ * includes the selection efficiency, and a reco-space prediction is
+ * R^T applied to a true-space spectrum. The same is done for every
+ * systematic universe.
+ *
+ * Cells are allocated only when first filled, and each holds the central
+ * value plus all universes contiguously. The output is in compressed
+ * sparse row (CSR) form, with rows in true energy, and all universes
+ * sharing the sparsity pattern.
+ */
+class ResponseMatrix {
+public:
+  /**
+   * Constructor.
+   *
+   * \param true_edges Bin edges in true energy
+   * \param reco_edges Bin edges in reconstructed energy
+   */
+  ResponseMatrix(const std::vector<double>& true_edges,
+                 const std::vector<double>& reco_edges);
+
+  /**
+   * Accumulate one event.
+   *
+   * The universe count is fixed by the first event with weights; events
+   * with more universes are truncated, and missing universes are filled
+   * with the central value.
+   *
+   * \param etrue True energy
+   * \param ereco Reconstructed energy (ignored if not selected)
+   * \param selected True if the event passed the selection
+   * \param weight Selection weight (e.g. an efficiency)
+   * \param universes Universe weights for the event (may be empty)
+   */
+  void Fill(double etrue, double ereco, bool selected, double weight,
+            const std::vector<double>& universes);
+
+  /**
+   * Build the normalized matrices in CSR form.
+   *
+   * \param rowptr Row offsets (ntrue + 1 entries)
+   * \param colidx Reco bin of each nonzero element
+   * \param values Elements, universe-major: values[u * nnz + k], where
+   *               u = 0 is the central value and u = 1... the universes
+   */
+  void Compress(std::vector<int>& rowptr, std::vector<int>& colidx,
+                std::vector<double>& values) const;
+
+  /**
+   * Write the matrices to the current directory.
+   *
+   * Objects are TVectorDs named response_<name>_<part>, with parts
+   * true_edges, reco_edges, rowptr, colidx, values (as for Compress) and
+   * norm, the weighted event count per true bin and universe
+   * (norm[u * ntrue + t]).
+   *
+   * \param name The sample name
+   */
+  void Write(const std::string& name) const;
+
+  /** Number of universes (excluding the central value). */
+  size_t GetNUniverses() const { return nuniverses; }
+
+  /** Number of allocated (nonzero) cells. */
+  size_t GetNNonZero() const { return cells.size(); }
+
+protected:
+  std::vector<double> true_edges;  //!< True energy bin edges
+  std::vector<double> reco_edges;  //!< Reco energy bin edges
+  size_t nuniverses;  //!< Number of universes
+  bool has_universes;  //!< Universe count has been fixed
+  std::vector<double> norm;  //!< Per true bin totals, [bin][1 + universe]
+  std::unordered_map<size_t, size_t> cells;  //!< Cell (t * nreco + r) to slot
+  std::vector<double> values;  //!< Cell sums, [slot][1 + universe]
+};
+
+}  // namespace util
+
+#endif  // __ts_ResponseMatrix__
+
@@ -0,0 +1,201 @@
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <json/json.h>
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TString.h>
+#include <TTree.h>
+#include <TVectorD.h>
+#include "ProcessorBase.hh"
+#include "ResultCache.hh"
+
+namespace core {
+
+ResultCache::Reader::Reader(const std::string& path, TTree* _target)
+    : file(nullptr), tree(nullptr), target(_target) {
+  if (access(path.c_str(), R_OK) != 0) {
+    return;
+  }
+
+  TDirectory* cwd = gDirectory;
+  file = TFile::Open(path.c_str());
+  cwd->cd();
+
+  if (!file || file->IsZombie()) {
+    std::cerr << "ResultCache: Unable to read " << path << std::endl;
+    return;
+  }
+
+  TTree* t = (TTree*) file->Get("cache");
+  TVectorD* p = (TVectorD*) file->Get("pot");
+  if (!t || !p || !t->GetBranch("source_entry")) {
+    std::cerr << "ResultCache: Incomplete entry " << path << std::endl;
+    return;
+  }
+
+  // Entries written before a change to the output tree are stale
+  TObjArray* branches = target->GetListOfBranches();
+  for (int i=0; i<branches->GetEntriesFast(); i++) {
+    if (!t->GetBranch(branches->At(i)->GetName())) {
+      return;
+    }
+  }
+
+  long entry;
+  t->SetBranchAddress("source_entry", &entry);
+  TBranch* b = t->GetBranch("source_entry");
+  for (long i=0; i<t->GetEntries(); i++) {
+    b->GetEntry(i);
+    rows[entry] = i;
+  }
+  t->ResetBranchAddress(b);
+
+  pot.assign(p->GetMatrixArray(), p->GetMatrixArray() + p->GetNrows());
+  target->CopyAddresses(t);
+  tree = t;
+}
+
+
+ResultCache::Reader::~Reader() {
+  if (tree) {
+    tree->ResetBranchAddresses();
+  }
+  if (file) {
+    file->Close();
+  }
+  delete file;
+}
+
+
+std::vector<long> ResultCache::Reader::Entries() const {
+  std::vector<long> entries;
+  for (auto const& it : rows) {
+    entries.push_back(it.first);
+  }
+  return entries;
+}
+
+
+void ResultCache::Reader::Load(long entry) {
+  auto it = rows.find(entry);
+  assert(it != rows.end());
+  tree->GetEntry(it->second);
+}
+
+
+ResultCache::Writer::Writer(const std::string& _path, TTree* source)
+    : path(_path), tree(nullptr) {
+  tmppath = path + Form(".tmp%i", (int) getpid());
+
+  TDirectory* cwd = gDirectory;
+  file = TFile::Open(tmppath.c_str(), "recreate");
+  tree = source->CloneTree(0);
+  tree->SetDirectory(file);
+  tree->Branch("source_entry", &source_entry);
+  cwd->cd();
+}
+
+
+ResultCache::Writer::~Writer() {
+  if (file) {
+    // Not committed; discard the partial entry
+    file->Close();
+    delete file;
+    unlink(tmppath.c_str());
+  }
+}
+
+
+void ResultCache::Writer::Fill(long entry) {
+  source_entry = entry;
+  tree->Fill();
+}
+
+
+void ResultCache::Writer::Close(const std::vector<double>& pot) {
+  TDirectory* cwd = gDirectory;
+  file->cd();
+  tree->Write("cache", TObject::kOverwrite);
+  TVectorD p(pot.size(), pot.data());
+  p.Write("pot", TObject::kOverwrite);
+  file->Close();
+  cwd->cd();
+
+  delete file;
+  file = nullptr;
+  tree = nullptr;
+
+  if (rename(tmppath.c_str(), path.c_str()) != 0) {
+    std::cerr << "ResultCache: Unable to write " << path << std::endl;
+    unlink(tmppath.c_str());
+  }
+}
+
+
+ResultCache::ResultCache(const std::string& dir) : fDir(dir) {
+  mkdir(fDir.c_str(), 0755);
+
+  struct stat s;
+  if (stat(fDir.c_str(), &s) != 0 || !S_ISDIR(s.st_mode)) {
+    std::cerr << "ResultCache: Unable to create directory " << fDir
+              << std::endl;
+    assert(false);
+  }
+}
+
+
+std::string ResultCache::FileKey(const std::string& filename) {
+  struct stat s;
+  if (stat(filename.c_str(), &s) != 0) {
+    return "";
+  }
+
+  return HashString(filename + "\n" +
+                    std::to_string((long long) s.st_size) + "\n" +
+                    std::to_string((long long) s.st_mtime));
+}
+
+
+std::string ResultCache::ProcessorKey(const ProcessorBase* processor,
+                                      const Json::Value* config) {
+  // Settings that only affect how the results are written out
+  Json::Value hashed;
+  if (config) {
+    hashed = *config;
+    hashed.removeMember("OutputFile");
+    hashed.removeMember("WriteTree");
+    hashed.removeMember("Skim");
+    hashed.removeMember("CacheDir");
+  }
+
+  Json::FastWriter writer;
+  return HashString(std::string(typeid(*processor).name()) + "\n" +
+                    writer.write(hashed));
+}
+
+
+std::string ResultCache::Path(const std::string& file_key,
+                              const std::string& processor_key) const {
+  return fDir + "/" + file_key + "_" + processor_key + ".root";
+}
+
+
+std::string ResultCache::HashString(const std::string& s) {
+  // 64-bit FNV-1a, stable across platforms and builds
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i=0; i<s.size(); i++) {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211ULL;
+  }
+  return Form("%016llx", h);
+}
+
+}  // namespace core
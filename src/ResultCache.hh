@@ -0,0 +1,178 @@
+#ifndef __ts_core_ResultCache__
+#define __ts_core_ResultCache__
+
+/**
+ * \file ResultCache.hh
+ *
+ * On-disk cache of per-file processor results.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+class TFile;
+class TTree;
+
+namespace Json {
+  class Value;
+}
+
+namespace core {
+
+class ProcessorBase;
+
+/**
+ * \class core::ResultCache
+ * \brief Stores the accepted events of each (input file, processor) pair
+ *
+ * An entry holds the output tree rows of the events a processor accepted
+ * in one input file, with their source entries (so the pass bits of every
+ * event are known), and the POT counted in the file. Entries are keyed by
+ * the input file (path, size and modification time) and the processor
+ * (class and configuration, less output-only settings), so an entry is
+ * stale as soon as either changes. Changes to the processor code are not
+ * detected: clear the cache directory after rebuilding.
+ *
+ * Each entry is a ROOT file <dir>/<file key>_<processor key>.root with a
+ * tree "cache" (the output tree branches plus source_entry) and a TVectorD
+ * "pot" (POT, good POT, spills, good spills, subruns). Entries are written
+ * to a temporary file and renamed when complete, so interrupted jobs do
+ * not leave partial entries.
+ */
+class ResultCache {
+public:
+  /**
+   * \class ResultCache::Reader
+   * \brief Serves cached rows into a processor's output tree
+   */
+  class Reader {
+  public:
+    /**
+     * Constructor.
+     *
+     * \param path The entry path
+     * \param target The output tree to load rows into
+     */
+    Reader(const std::string& path, TTree* target);
+
+    /** Destructor. */
+    ~Reader();
+
+    /** True if the entry exists and matches the target tree. */
+    bool IsValid() const { return tree != nullptr; }
+
+    /** True if the processor accepted a source entry. */
+    bool Has(long entry) const { return rows.find(entry) != rows.end(); }
+
+    /** Accepted source entries, in order. */
+    std::vector<long> Entries() const;
+
+    /**
+     * Load the row of an accepted event into the target tree's branches.
+     *
+     * \param entry The source entry
+     */
+    void Load(long entry);
+
+    /** The POT counted in the file (see ResultCache). */
+    const std::vector<double>& GetPOT() const { return pot; }
+
+  protected:
+    TFile* file;  //!< The entry file
+    TTree* tree;  //!< The cached rows
+    TTree* target;  //!< The output tree
+    std::map<long, long> rows;  //!< Source entry to cached row
+    std::vector<double> pot;  //!< POT counts
+  };
+
+  /**
+   * \class ResultCache::Writer
+   * \brief Records a processor's accepted events for one file
+   */
+  class Writer {
+  public:
+    /**
+     * Constructor.
+     *
+     * \param path The entry path
+     * \param source The output tree, whose branches are copied
+     */
+    Writer(const std::string& path, TTree* source);
+
+    /** Destructor; discards the entry if it was not closed. */
+    ~Writer();
+
+    /**
+     * Record the current values of the output tree branches.
+     *
+     * \param entry The source entry
+     */
+    void Fill(long entry);
+
+    /**
+     * Write and commit the entry.
+     *
+     * \param pot The POT counted in the file (see ResultCache)
+     */
+    void Close(const std::vector<double>& pot);
+
+  protected:
+    std::string path;  //!< The entry path
+    std::string tmppath;  //!< Path while writing
+    TFile* file;  //!< The temporary file
+    TTree* tree;  //!< The cached rows
+    long source_entry;  //!< Branch buffer
+  };
+
+  /**
+   * Constructor.
+   *
+   * \param dir The cache directory, created if needed
+   */
+  ResultCache(const std::string& dir);
+
+  /**
+   * Key for an input file, from its path, size and modification time.
+   *
+   * \param filename The file path
+   * \returns The key, or an empty string if the file cannot be examined
+   *          (e.g. a remote file), in which case it is not cached
+   */
+  static std::string FileKey(const std::string& filename);
+
+  /**
+   * Key for a processor, from its class and configuration.
+   *
+   * \param processor The processor
+   * \param config The configuration, if any
+   * \returns The key
+   */
+  static std::string ProcessorKey(const ProcessorBase* processor,
+                                  const Json::Value* config);
+
+  /**
+   * Path to the entry for a file and processor.
+   *
+   * \param file_key The file key
+   * \param processor_key The processor key
+   * \returns The path
+   */
+  std::string Path(const std::string& file_key,
+                   const std::string& processor_key) const;
+
+protected:
+  /**
+   * Stable hash of a string (64-bit FNV-1a), as hex.
+   *
+   * \param s The string
+   * \returns The hash as 16 hex digits
+   */
+  static std::string HashString(const std::string& s);
+
+  std::string fDir;  //!< The cache directory
+};
+
+}  // namespace core
+
+#endif  // __ts_core_ResultCache__
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TNamed.h>
+#include <TTree.h>
+#include <TVectorD.h>
+#include "SkimList.hh"
+
+namespace core {
+
+void SkimList::Write(TDirectory* dir) const {
+  dir->cd();
+
+  Entry e;
+  TTree* tree = new TTree("skim", "Accepted events");
+  tree->Branch("file", &e.file);
+  tree->Branch("entry", &e.entry);
+  tree->Branch("mask", &e.mask);
+
+  for (auto const& it : entries) {
+    e = it;
+    tree->Fill();
+  }
+
+  tree->Write("skim", TObject::kOverwrite);
+  delete tree;
+
+  std::string list;
+  for (size_t i=0; i<sources.size(); i++) {
+    list += (i > 0 ? "\n" : "") + sources[i];
+  }
+  TNamed names("skim_sources", list.c_str());
+  names.Write("skim_sources", TObject::kOverwrite);
+
+  if (!fractions.empty()) {
+    TVectorD(fractions.size(), fractions.data()).Write(
+      "skim_fractions", TObject::kOverwrite);
+  }
+}
+
+
+bool SkimList::Read(TDirectory* dir) {
+  TTree* tree = (TTree*) dir->Get("skim");
+  TNamed* names = (TNamed*) dir->Get("skim_sources");
+  if (!tree || !names) {
+    return false;
+  }
+
+  Entry e;
+  tree->SetBranchAddress("file", &e.file);
+  tree->SetBranchAddress("entry", &e.entry);
+  tree->SetBranchAddress("mask", &e.mask);
+
+  entries.clear();
+  entries.reserve(tree->GetEntries());
+  for (long i=0; i<tree->GetEntries(); i++) {
+    tree->GetEntry(i);
+    entries.push_back(e);
+  }
+  delete tree;
+
+  std::stable_sort(entries.begin(), entries.end());
+
+  sources.clear();
+  std::string list = names->GetTitle();
+  for (size_t pos=0; !list.empty() && pos != std::string::npos; ) {
+    size_t next = list.find('\n', pos);
+    sources.push_back(list.substr(pos, next - pos));
+    pos = (next == std::string::npos ? next : next + 1);
+  }
+
+  for (auto const& it : entries) {
+    if (it.file < 0 || it.file >= (int) sources.size()) {
+      std::cerr << "SkimList: Entry refers to unknown file " << it.file
+                << std::endl;
+      return false;
+    }
+  }
+
+  fractions.clear();
+  TVectorD* v = (TVectorD*) dir->Get("skim_fractions");
+  if (v) {
+    if (v->GetNrows() != (int) sources.size()) {
+      std::cerr << "SkimList: Fractions do not match the " << sources.size()
+                << " source files" << std::endl;
+      return false;
+    }
+    fractions.assign(v->GetMatrixArray(), v->GetMatrixArray() + v->GetNrows());
+    delete v;
+  }
+
+  return true;
+}
+
+
+bool SkimList::Read(const std::string& filename) {
+  TFile* f = TFile::Open(filename.c_str());
+  if (!f || f->IsZombie()) {
+    std::cerr << "SkimList: Unable to open " << filename << std::endl;
+    delete f;
+    return false;
+  }
+
+  bool found = Read(f);
+  f->Close();
+  delete f;
+
+  return found;
+}
+
+}  // namespace core
@@ -0,0 +1,105 @@
+#ifndef __ts_core_SkimList__
+#define __ts_core_SkimList__
+
+/**
+ * \file SkimList.hh
+ *
+ * Compact lists of accepted source events.
+ */
+
+#include <string>
+#include <vector>
+
+class TDirectory;
+
+namespace core {
+
+/**
+ * \class core::SkimList
+ * \brief The source locations of accepted events
+ *
+ * Each entry holds the index of the source art file, the entry within it,
+ * and a bitmask of the processors in the block that accepted the event
+ * (bit i for processor i, for the first 32 processors). A list can be
+ * used as the input of a later job (see ProcessorBlock::ProcessSkim),
+ * which reads only the listed events.
+ *
+ * The list is stored as a TTree "skim" with branches file, entry and mask,
+ * and the source file paths as a TNamed "skim_sources" (newline-separated).
+ * A list written by a job that read only part of its sources (an event
+ * range or a prescale) also has a TVectorD "skim_fractions", the fraction
+ * of each source's POT that the job counted.
+ */
+class SkimList {
+public:
+  /**
+   * \struct SkimList::Entry
+   * \brief The location of one event
+   */
+  struct Entry {
+    int file;  //!< Index of the source file
+    long entry;  //!< Entry in the source file
+    unsigned int mask;  //!< Bitmask of accepting processors
+
+    /** Order by source location. */
+    bool operator<(const Entry& o) const {
+      if (file != o.file) return file < o.file;
+      return entry < o.entry;
+    }
+  };
+
+  /**
+   * Add an event.
+   *
+   * \param file Index of the source file
+   * \param entry Entry in the source file
+   * \param mask Bitmask of accepting processors
+   */
+  void Add(int file, long entry, unsigned int mask) {
+    entries.push_back({ file, entry, mask });
+  }
+
+  /** Set the source file paths. */
+  void SetSources(const std::vector<std::string>& _sources) {
+    sources = _sources;
+  }
+
+  /** Set the fraction of each source's POT counted (empty for all). */
+  void SetFractions(const std::vector<double>& _fractions) {
+    fractions = _fractions;
+  }
+
+  /**
+   * Write the list to a directory.
+   *
+   * \param dir The directory (e.g. the output file)
+   */
+  void Write(TDirectory* dir) const;
+
+  /**
+   * Read a list from a directory, sorted by source location.
+   *
+   * \param dir The directory
+   * \returns True if a list was found
+   */
+  bool Read(TDirectory* dir);
+
+  /**
+   * Read a list from a ROOT file.
+   *
+   * \param filename The file path
+   * \returns True if a list was found
+   */
+  bool Read(const std::string& filename);
+
+  /** Number of entries. */
+  size_t size() const { return entries.size(); }
+
+  std::vector<Entry> entries;  //!< Accepted events
+  std::vector<std::string> sources;  //!< Source file paths
+  std::vector<double> fractions;  //!< POT fraction per source (empty: all)
+};
+
+}  // namespace core
+
+#endif  // __ts_core_SkimList__
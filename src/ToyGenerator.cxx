@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TFile.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TTree.h"
+#include "CounterRNG.hh"
+#include "CovarianceModes.hh"
+#include "ToyGenerator.hh"
+
+namespace util {
+
+ToyGenerator::ToyGenerator(const TH1D* _cv, const TH2D* cov, uint64_t seed)
+    : fNModes(0), fSeed(seed), fPoisson(true) {
+  const size_t n = _cv->GetNbinsX();
+  cv.resize(n);
+  for (size_t i=0; i<n; i++) {
+    cv[i] = _cv->GetBinContent(i + 1);
+  }
+
+  // V = U^T U if positive definite, otherwise V = M M^T with the modes
+  CovarianceModes modes(cov);
+  if (modes.IsPositiveDefinite()) {
+    const TMatrixD& u = modes.GetCholesky();
+    fNModes = n;
+    fA.resize(n * n);
+    for (size_t i=0; i<n; i++) {
+      for (size_t k=0; k<n; k++) {
+        fA[i * n + k] = u(k, i);
+      }
+    }
+  }
+  else {
+    TMatrixD m = modes.Modes(modes.GetRank());
+    fNModes = m.GetNcols();
+    fA.resize(n * fNModes);
+    for (size_t i=0; i<n; i++) {
+      for (size_t k=0; k<fNModes; k++) {
+        fA[i * fNModes + k] = m(i, k);
+      }
+    }
+    std::cerr << "ToyGenerator: Covariance is not positive definite, using "
+              << fNModes << " modes" << std::endl;
+  }
+}
+
+
+void ToyGenerator::Generate(uint64_t index, float* out) const {
+  CounterRNG rng(fSeed, index);
+
+  const size_t n = cv.size();
+  std::vector<double> z(fNModes);
+  for (size_t k=0; k<fNModes; k++) {
+    z[k] = rng.Gaus();
+  }
+
+  for (size_t i=0; i<n; i++) {
+    const double* ai = fA.data() + i * fNModes;
+    double x = cv[i];
+    for (size_t k=0; k<fNModes; k++) {
+      x += ai[k] * z[k];
+    }
+    x = std::max(x, 0.0);
+    out[i] = (fPoisson ? rng.Poisson(x) : x);
+  }
+}
+
+
+void ToyGenerator::Generate(uint64_t first, size_t count, float* out,
+                            size_t nthreads) const {
+  if (nthreads == 0) {
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  const size_t n = cv.size();
+  const size_t kBlock = 1024;
+  std::atomic<size_t> next(0);
+
+  auto worker = [&]() {
+    for (size_t i0=next.fetch_add(kBlock); i0<count;
+         i0=next.fetch_add(kBlock)) {
+      size_t m = std::min(kBlock, count - i0);
+      for (size_t i=i0; i<i0+m; i++) {
+        Generate(first + i, out + i * n);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i=0; i<nthreads; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+
+void ToyGenerator::Write(std::string filename, size_t count,
+                         size_t nthreads) const {
+  TFile f(filename.c_str(), "recreate");
+
+  const size_t n = cv.size();
+  std::vector<float> bins(n);
+  Long64_t index;
+
+  TTree* t = new TTree("toys", "Pseudo-experiments");
+  t->Branch("index", &index, "index/L");
+  for (size_t i=0; i<n; i++) {
+    t->Branch(Form("b%zu", i), &bins[i], Form("b%zu/F", i));
+  }
+
+  const size_t kChunk = 65536;
+  std::vector<float> buffer(kChunk * n);
+  for (size_t i0=0; i0<count; i0+=kChunk) {
+    size_t m = std::min(kChunk, count - i0);
+    Generate(i0, m, buffer.data(), nthreads);
+    for (size_t i=0; i<m; i++) {
+      index = i0 + i;
+      std::copy(buffer.begin() + i * n, buffer.begin() + (i + 1) * n,
+                bins.begin());
+      t->Fill();
+    }
+  }
+
+  t->Write();
+  f.Close();
+
+  std::cout << "ToyGenerator: Wrote " << count << " toys to " << filename
+            << std::endl;
+}
+
+}  // namespace util
+
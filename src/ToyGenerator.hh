@@ -0,0 +1,89 @@
+#ifndef __ts_ToyGenerator__
+#define __ts_ToyGenerator__
+
+/**
+ * \file ToyGenerator.hh
+ *
+ * Pseudo-experiment generation from a covariance matrix.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class TH1D;
+class TH2D;
+
+namespace util {
+
+/**
+ * \class ToyGenerator
+ * \brief Correlated Gaussian plus Poisson fake-data spectra
+ *
+ * The covariance V is factored once, V = A A^T, using the Cholesky factor
+ * when V is positive definite and the principal-component modes otherwise.
+ * Toy i is x = cv + A z with z ~ N(0, 1), truncated at zero and optionally
+ * Poisson fluctuated. All random numbers for toy i come from a
+ * CounterRNG stream keyed by (seed, i), so every toy is reproducible by
+ * index whatever the number of threads or the order of generation.
+ */
+class ToyGenerator {
+public:
+  /**
+   * Constructor.
+   *
+   * \param cv The nominal spectrum
+   * \param cov The covariance matrix
+   * \param seed The random seed
+   */
+  ToyGenerator(const TH1D* cv, const TH2D* cov, uint64_t seed=0);
+
+  /** Number of bins. */
+  size_t GetN() const { return cv.size(); }
+
+  /** Include Poisson fluctuations (default true). */
+  void SetPoisson(bool p) { fPoisson = p; }
+
+  /**
+   * Generate one toy.
+   *
+   * \param index The toy index
+   * \param out Output spectrum (N values)
+   */
+  void Generate(uint64_t index, float* out) const;
+
+  /**
+   * Generate a range of toys in parallel.
+   *
+   * \param first Index of the first toy
+   * \param count Number of toys
+   * \param out Output spectra, toy-major (count x N values)
+   * \param nthreads Number of threads (0 for all cores)
+   */
+  void Generate(uint64_t first, size_t count, float* out,
+                size_t nthreads=0) const;
+
+  /**
+   * Generate toys and write them to a ROOT file as a tree ("toys") with
+   * one float branch per bin (b0, b1, ...) and the toy index.
+   *
+   * Toys are generated in parallel in chunks and filled in index order.
+   *
+   * \param filename The output file path
+   * \param count Number of toys
+   * \param nthreads Number of threads (0 for all cores)
+   */
+  void Write(std::string filename, size_t count, size_t nthreads=0) const;
+
+protected:
+  std::vector<double> cv;  //!< Nominal spectrum
+  std::vector<double> fA;  //!< Factor A (N x fNModes), row-major
+  size_t fNModes;  //!< Number of columns of A
+  uint64_t fSeed;  //!< Random seed
+  bool fPoisson;  //!< Include Poisson fluctuations
+};
+
+}  // namespace util
+
+#endif  // __ts_ToyGenerator__
+
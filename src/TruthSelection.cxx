@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
+#include <TFile.h>
 #include <TH2D.h>
 #include <TTree.h>
 #include <json/json.h>
@@ -7,7 +11,10 @@
 #include "canvas/Utilities/InputTag.h"
 #include "lardataobj/MCBase/MCTrack.h"
 #include "lardataobj/MCBase/MCShower.h"
+#include "Event.hh"
 #include "ProcessorBase.hh"
+#include "RecoEmulator.hh"
+#include "ResponseMatrix.hh"
 #include "TruthSelection.hh"
 #include "Selections.hh"
 
@@ -15,7 +22,14 @@ namespace ana {
   namespace TruthSelection {
 
 TruthSelection::TruthSelection()
-    : ProcessorBase(), fEventCounter(0), fSelectedCounter(0) {}
+    : ProcessorBase(), fEventCounter(0), fSelectedCounter(0), fPass(false),
+      fResponse(nullptr), fEmulator(nullptr) {}
+
+
+TruthSelection::~TruthSelection() {
+  delete fResponse;
+  delete fEmulator;
+}
 
 
 void TruthSelection::Initialize(Json::Value* config) {
@@ -30,6 +44,22 @@ void TruthSelection::Initialize(Json::Value* config) {
     fTruthTag = { (*config)["TruthSelection"].get("MCTrithTag", "generator").asString() };
     fTrackTag = { (*config)["TruthSelection"].get("MCTrackTag", "mcreco").asString() };
     fShowerTag = { (*config)["TruthSelection"].get("MCShowerTag", "mcreco").asString() };
+
+    const Json::Value& response = (*config)["TruthSelection"]["Response"];
+    if (!response.isNull()) {
+      fResponse = new util::ResponseMatrix(
+        util::Covariance::ParseBinning(response["TrueBinning"]),
+        util::Covariance::ParseBinning(response["RecoBinning"]));
+      for (auto const& w : response["Weights"]) {
+        fResponseWeights.insert(w.asString());
+      }
+    }
+
+    const Json::Value& emulation = (*config)["TruthSelection"]["RecoEmulation"];
+    if (!emulation.isNull()) {
+      fEmulator = new util::RecoEmulator;
+      fEmulator->Configure(emulation);
+    }
   }
 
   // Add custom branches
@@ -39,7 +69,89 @@ void TruthSelection::Initialize(Json::Value* config) {
 }
 
 
-void TruthSelection::Finalize() {}
+void TruthSelection::Finalize() {
+  if (fResponse) {
+    fOutputFile->cd();
+    fResponse->Write(fSelectionType);
+  }
+}
+
+
+void TruthSelection::Checkpoint() {
+  if (fResponse) {
+    fOutputFile->cd();
+    fResponse->Write(fSelectionType);
+  }
+  ProcessorBase::Checkpoint();
+}
+
+
+bool TruthSelection::EmulateReco(gallery::Event& ev,
+                                 const std::vector<sim::MCTrack>& mctracks,
+                                 const std::vector<sim::MCShower>& mcshowers) {
+  fParticles.clear();
+
+  for (auto const& t : mctracks) {
+    if (t.Process() == "primary" && t.Origin() == simb::kBeamNeutrino) {
+      fParticles.push_back(t.TrackID(), t.PdgCode(), t.Start().E());
+    }
+  }
+
+  for (auto const& s : mcshowers) {
+    if (s.Process() == "primary" && s.Origin() == simb::kBeamNeutrino) {
+      fParticles.push_back(s.TrackID(), s.PdgCode(), s.Start().E());
+    }
+  }
+
+  auto const& aux = ev.eventAuxiliary();
+  fEmulator->Emulate(aux.run(), aux.subRun(), aux.event(), fParticles);
+
+  // The highest-energy reconstructed particle with the selection PDG
+  int best = -1;
+  for (size_t i=0; i<fParticles.size(); i++) {
+    if (fParticles.detected[i] &&
+        std::abs(fParticles.reco_pdg[i]) == fRecoPDG &&
+        (best < 0 ||
+         fParticles.reco_energy[i] > fParticles.reco_energy[best])) {
+      best = i;
+    }
+  }
+
+  if (best < 0) {
+    return false;
+  }
+
+  // The emulated efficiency replaces the selection's constant one
+  fRecoEnergy = fParticles.reco_energy[best];
+  fWeight = 1.0;
+  if (fEmulator->GetEfficiencyAsWeight()) {
+    fWeight *= fParticles.efficiency[best];
+  }
+
+  return true;
+}
+
+
+void TruthSelection::FillResponse(bool pass, double weight) {
+  if (fEvent->ninteractions == 0) {
+    return;
+  }
+
+  const Event::Interaction& interaction = fEvent->interactions[0];
+
+  // Universe-wise product of the requested weight functions, truncated to
+  // the shortest, with the map positions resolved once per layout
+  util::Covariance::WeightPlan& plan = fPlans[interaction.weights.size()];
+  if (!plan.Apply(interaction.weights, fUniverses)) {
+    plan.Resolve(interaction.weights, fResponseWeights, fSelectionType);
+    bool valid = plan.Apply(interaction.weights, fUniverses);
+    assert(valid);
+    (void) valid;
+  }
+
+  fResponse->Fill(interaction.neutrino.energy * 1000, fRecoEnergy,
+                  pass, weight, fUniverses);
+}
 
 
 bool TruthSelection::ProcessEvent(gallery::Event& ev) {
@@ -57,7 +169,7 @@ bool TruthSelection::ProcessEvent(gallery::Event& ev) {
 
   // Apply selection using tracks and showers
   bool pass = false;
-  double fWeight = 1.0;
+  fWeight = 1.0;
 
   if (fSelectionType == "ccnue_true") {
     pass = selections::CCNueTrue(mctruths, mctracks, mcshowers, fRecoEnergy, fWeight);
@@ -93,6 +205,16 @@ bool TruthSelection::ProcessEvent(gallery::Event& ev) {
     assert(false);
   }
 
+  if (pass && fEmulator) {
+    pass = EmulateReco(ev, mctracks, mcshowers);
+  }
+
+  if (fResponse) {
+    FillResponse(pass, fWeight);
+  }
+
+  fPass = pass;
+
   if (pass) {
     fSelectedCounter++;
     return true;
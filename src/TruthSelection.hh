@@ -9,13 +9,26 @@
  * Author: A. Mastbaum <mastbaum@uchicago.edu>
  */
 
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include "canvas/Utilities/InputTag.h"
+#include "Covariance.hh"
 #include "ProcessorBase.hh"
+#include "RecoEmulator.hh"
 
 class TH2D;
 
+namespace sim {
+  class MCTrack;
+  class MCShower;
+}
+
+namespace util {
+  class ResponseMatrix;
+}
+
 namespace ana {
   namespace TruthSelection {
 
@@ -28,9 +41,23 @@ public:
   /** Constructor. */
   TruthSelection();
 
+  /** Destructor. */
+  ~TruthSelection();
+
   /**
    * Initialization.
    *
+   * A response matrix is accumulated for the selection if the
+   * configuration has "Response": { "TrueBinning": {...},
+   * "RecoBinning": {...}, "Weights": ["*"] } under "TruthSelection".
+   * Binnings are given as for Covariance, in MeV, and universes are the
+   * product of the listed weight functions ("*" for all; none if omitted).
+   *
+   * Reconstruction is emulated if "RecoEmulation" is set under
+   * "TruthSelection" (see util::RecoEmulator::Configure). The selection
+   * then also requires a reconstructed particle with the selection PDG, and
+   * the highest-energy such particle gives the reconstructed energy.
+   *
    * \param config A configuration, as a JSON object
    */
   void Initialize(Json::Value* config=NULL);
@@ -38,6 +65,9 @@ public:
   /** Finalize and write objects to the output file. */
   void Finalize();
 
+  /** Write a snapshot of the output, including any response matrix. */
+  void Checkpoint();
+
   /**
    * Process one event.
    *
@@ -46,15 +76,67 @@ public:
    */
   bool ProcessEvent(gallery::Event& ev);
 
+  /** Cacheable unless filling response matrices over all events. */
+  bool IsCacheable() const { return fResponse == nullptr; }
+
+  /** Thread-safe unless filling response matrices over all events. */
+  bool IsThreadSafe() const { return fResponse == nullptr; }
+
+  /** A new, unconfigured TruthSelection. */
+  core::ProcessorBase* Clone() const { return new TruthSelection; }
+
+  /** The selection type name. */
+  const std::string& GetSelectionType() const { return fSelectionType; }
+
+  /** True if the last processed event passed the selection. */
+  bool GetPass() const { return fPass; }
+
+  /** Reconstructed energy of the last processed event. */
+  double GetRecoEnergy() const { return fRecoEnergy; }
+
+  /** Selection weight of the last processed event. */
+  double GetWeight() const { return fWeight; }
+
 protected:
+  /**
+   * Add the current event to the response matrix.
+   *
+   * \param pass True if the event passed the selection
+   * \param weight The selection weight
+   */
+  void FillResponse(bool pass, double weight);
+
+  /**
+   * Emulate reconstruction for the primary particles in the event.
+   *
+   * The emulated efficiency replaces any constant efficiency applied by
+   * the selection: the weight is reset, then (with EfficiencyAsWeight)
+   * scaled by the selected particle's efficiency.
+   *
+   * \param ev The event
+   * \param mctracks True MC tracks
+   * \param mcshowers True MC showers
+   * \returns True if a particle is reconstructed with the selection PDG
+   */
+  bool EmulateReco(gallery::Event& ev,
+                   const std::vector<sim::MCTrack>& mctracks,
+                   const std::vector<sim::MCShower>& mcshowers);
+
   unsigned fEventCounter;  //!< Count processed events
   unsigned fSelectedCounter;  //!< Count selected events
+  bool fPass;  //!< The last processed event passed the selection
 
   /// Configuration parameters
   art::InputTag fTruthTag;  //!< art tag for MCTruth information
   art::InputTag fTrackTag;  //!< art tag for MCTrack information
   art::InputTag fShowerTag;  //!< art tag for MCShower information
   std::string fSelectionType;  //!< Selection type, from configuration parameter
+  util::ResponseMatrix* fResponse;  //!< Response matrix (null if disabled)
+  util::RecoEmulator* fEmulator;  //!< Reco emulation (null if disabled)
+  util::RecoEmulator::Particles fParticles;  //!< Emulation particle buffer
+  std::set<std::string> fResponseWeights;  //!< Weights for response universes
+  std::map<size_t, util::Covariance::WeightPlan> fPlans;  //!< Response plans
+  std::vector<double> fUniverses;  //!< Universe weight buffer
 
   /// Custom data branches
   double fWeight;  //!< Efficiency weight
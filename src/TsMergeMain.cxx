@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <OutputMerger.hh>
+
+int main(int argc, char* argv[]) {
+  size_t nthreads = 0;
+  size_t fanin = 0;
+
+  int c;
+  while ((c=getopt(argc, argv, "j:f:")) != -1) {
+    switch (c) {
+      case 'j':
+        nthreads = strtoul(optarg, NULL, 10);
+        break;
+      case 'f':
+        fanin = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        return 1;
+    }
+  }
+
+  if (argc - optind < 2) {
+    std::cout << "Usage: " << argv[0] << " [-j NTHREADS] [-f FANIN] "
+              << "OUTPUT.root INPUT.root [...]" << std::endl
+              << "       " << argv[0] << " [-j NTHREADS] [-f FANIN] "
+              << "OUTPUT.root INPUTS.list" << std::endl;
+    return 1;
+  }
+
+  std::string output = argv[optind];
+  std::vector<std::string> inputs;
+
+  std::string list_suffix = ".list";
+  std::string first = argv[optind + 1];
+  if (argc - optind == 2 && first.size() > list_suffix.size() &&
+      std::equal(list_suffix.rbegin(), list_suffix.rend(), first.rbegin())) {
+    // File list
+    std::ifstream infile(first);
+    std::string filename;
+    while (infile >> filename) {
+      inputs.push_back(filename);
+    }
+  }
+  else {
+    for (int i=optind+1; i<argc; i++) {
+      inputs.push_back(argv[i]);
+    }
+  }
+
+  if (inputs.empty()) {
+    std::cerr << "No input files" << std::endl;
+    return 2;
+  }
+
+  for (auto const& f : inputs) {
+    if (f == output) {
+      std::cerr << "Output " << output << " is also an input" << std::endl;
+      return 2;
+    }
+  }
+
+  core::OutputMerger merger;
+  merger.SetThreads(nthreads);
+  merger.SetFanIn(fanin);
+
+  if (!merger.Merge(inputs, output)) {
+    return 3;
+  }
+
+  return 0;
+}